@@ -4,22 +4,83 @@
  */
 
 #include "bi_wifi.hpp"
+#include "bi_wifi_driver.hpp"
+#include <cstddef>
 #include <cstring>
+#include <strings.h>
+#include <algorithm>
+#include <ctime>
+#include <cinttypes>
+#include <climits>
 #include "esp_mac.h"
 #include "esp_wifi.h"
 #include "esp_log.h"
 #include "esp_check.h"
 #include "esp_system.h"
+#include "esp_heap_caps.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "esp_rom_crc.h"
+#include "lwip/dhcp.h"
+#include "lwip/ip_addr.h"
+#include "lwip/netdb.h"
+#include "mbedtls/pkcs5.h"
+#include "mbedtls/platform_util.h"
+#if CONFIG_BI_WIFI_RELEASE_BT_MEMORY
+#include "esp_bt.h"
+#endif
+#if CONFIG_BI_WIFI_PROVISIONING_BLE && CONFIG_ESP_COEX_SW_COEXIST_ENABLE
+#include "esp_coexist.h"
+#endif
 
 // Event group bits
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT      BIT1
 #define PROVISIONING_DONE  BIT2
+#define WORKER_STOPPED_BIT BIT3
 
-WiFiManager::WiFiManager(const std::string& nvs_namespace)
+// One bit per WiFiState, set while the state is current
+#define STATE_BITS_SHIFT   4
+#define STATE_BITS_MASK    (0x1F << STATE_BITS_SHIFT)
+
+// Set when a scan sweep finishes, above the state bits
+#define SCAN_DONE_BIT      (1 << 9)
+
+// Set while no provisioned credentials are being persisted
+#define PERSIST_IDLE_BIT   (1 << 10)
+
+// Set by the worker when it frees a ring slot the event loop task waits for
+#define WORKER_SPACE_BIT   (1 << 11)
+
+// Re-runs the enclosing call on the event handler task when made from another task
+#define RUN_ON_EVENT_TASK(call)                                 \
+    do {                                                        \
+        if (deferCommand()) {                                   \
+            return runCommand([&] { return call; });            \
+        }                                                       \
+    } while (0)
+
+// Records the heap used by the enclosing call in footprint_.<phase>
+#if CONFIG_BI_WIFI_FOOTPRINT
+#define FOOTPRINT_SCOPE(phase) FootprintScope footprint_scope(footprint_.phase)
+#else
+#define FOOTPRINT_SCOPE(phase)
+#endif
+
+// Private event base for timer, ping and command work, see postInternalEvent()
+ESP_EVENT_DEFINE_BASE(BI_WIFI_INTERNAL_EVENT);
+
+// Last good connection context, kept across deep sleep
+RTC_DATA_ATTR WiFiManager::RtcContext WiFiManager::rtc_context_;
+
+// Boot session of the DHCP lease cache, must survive software resets too
+RTC_NOINIT_ATTR WiFiManager::RtcSession WiFiManager::rtc_session_;
+
+WiFiManager::WiFiManager(const std::string& nvs_namespace, DriverProfile driver_profile)
     : nvs_namespace_(nvs_namespace),
       state_(WiFiState::DISCONNECTED),
       connection_callback_(nullptr),
@@ -27,22 +88,178 @@ WiFiManager::WiFiManager(const std::string& nvs_namespace)
       wifi_event_group_(nullptr),
       initialized_(false),
       provisioning_active_(false),
-      current_ssid_(""),
-      current_password_(""),
+      current_ssid_{},
+      ssid_seq_(0),
+      ip_addr_(0),
       netif_sta_(nullptr),
-      netif_ap_(nullptr) {
+      netif_ap_(nullptr),
+      fast_connect_enabled_(true),
+      fast_connect_pending_(false),
+      fast_record_valid_(false),
+      fast_record_{},
+      fast_connect_stats_{},
+      pmk_storage_enabled_(false),
+      lease_cache_enabled_(false),
+      lease_applied_(false),
+      lease_record_valid_(false),
+      lease_record_{},
+      lease_renew_timer_(nullptr),
+      sta_connected_at_us_(0),
+      static_ip_{},
+      static_ip_applied_(false),
+      static_ip_from_rtc_(false),
+      power_profile_(PowerProfile::BALANCED),
+      driver_profile_(driver_profile),
+      driver_config_(driverProfileConfig(driver_profile)),
+      last_disconnect_reason_(0),
+      reconnect_policy_{500, 60000, 10, false},
+      reconnect_timer_(nullptr),
+      reconnect_attempts_(0),
+      auth_failures_(0),
+      jitter_state_(0),
+      worker_queue_{},
+      worker_head_(0),
+      worker_tail_(0),
+      worker_dropped_(0),
+      worker_stop_(false),
+      worker_space_wanted_(false),
+      worker_task_(nullptr),
+      creds_{},
+      networks_loaded_(false),
+      networks_{},
+      metrics_{},
+      assoc_started_at_us_(0),
+      prov_started_at_us_(0),
+      prov_phase_at_us_(0),
+      link_events_(),
+      link_channel_(0),
+      roaming_config_{false, 5000, -70, 8, 60000},
+      roam_timer_(nullptr),
+      roam_rssi_(0),
+      roam_scan_active_(false),
+      roam_scan_channels_(0),
+      last_roam_scan_us_(0),
+      roam_candidate_{},
+      roam_pending_(false),
+      roam_attempt_(false),
+      watchdog_config_{false, 2000, 30000, 1000, 3},
+      probe_session_(nullptr),
+      probe_timer_(nullptr),
+      probe_gateway_(0),
+      probe_interval_ms_(0),
+      probe_misses_(0),
+      default_scheme_(ProvisioningScheme::SOFTAP),
+      provisioning_scheme_(ProvisioningScheme::SOFTAP),
+      coex_active_(false),
+      prov_ssid_{},
+      prov_password_{},
+      scan_config_{ScanMode::ALL_CHANNELS, false, 0, 120, 360, 0, 10000},
+      scan_cache_(nullptr),
+      scan_cache_count_(0),
+      scan_cache_at_us_(0),
+      sweep_active_(false),
+      sweep_channels_(0),
+      sweep_stop_on_match_(false),
+      sweep_fallback_(false),
+      sweep_scanned_(false),
+      sweep_connect_(false),
+      sweep_started_us_(0),
+      hosts_{},
+      host_count_(0),
+      hosts_seq_(0),
+      notify_config_{false, 3000},
+      reported_state_(WiFiState::DISCONNECTED),
+      notify_timer_(nullptr),
+      down_since_us_(0),
+      down_reconnects_base_(0),
+      pending_changes_(0),
+      command_queue_(nullptr),
+      event_task_(nullptr),
+      wifi_event_handler_(nullptr),
+      got_ip_handler_(nullptr),
+      lost_ip_handler_(nullptr),
+      internal_event_handler_(nullptr) {
+#if CONFIG_BI_WIFI_FOOTPRINT
+    footprint_ = {};
+#endif
 }
 
 WiFiManager::~WiFiManager() {
+    stopWorker();
+    
+    // The persist task uses this instance until the credentials are saved
+    if (wifi_event_group_) {
+        xEventGroupWaitBits(wifi_event_group_, PERSIST_IDLE_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+    }
+    
+    if (lease_renew_timer_) {
+        esp_timer_stop(lease_renew_timer_);
+        esp_timer_delete(lease_renew_timer_);
+        lease_renew_timer_ = nullptr;
+    }
+    
+    if (reconnect_timer_) {
+        esp_timer_stop(reconnect_timer_);
+        esp_timer_delete(reconnect_timer_);
+        reconnect_timer_ = nullptr;
+    }
+    
+    if (roam_timer_) {
+        esp_timer_stop(roam_timer_);
+        esp_timer_delete(roam_timer_);
+        roam_timer_ = nullptr;
+    }
+    
+    if (notify_timer_) {
+        esp_timer_stop(notify_timer_);
+        esp_timer_delete(notify_timer_);
+        notify_timer_ = nullptr;
+    }
+    
+    stopLinkWatchdog();
+    if (probe_timer_) {
+        esp_timer_delete(probe_timer_);
+        probe_timer_ = nullptr;
+    }
+    if (probe_session_) {
+        esp_ping_delete_session(probe_session_);
+        probe_session_ = nullptr;
+    }
+    
     if (initialized_) {
-        esp_wifi_disconnect();
-        esp_wifi_stop();
-        esp_wifi_deinit();
+        // Nothing reaches this instance once the handlers are gone
+        esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event_handler_);
+        esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, got_ip_handler_);
+        esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_LOST_IP, lost_ip_handler_);
+        esp_event_handler_instance_unregister(BI_WIFI_INTERNAL_EVENT, ESP_EVENT_ANY_ID,
+                                              internal_event_handler_);
+        
+#if CONFIG_BI_WIFI_PROVISIONING
+        if (provisioning_active_) {
+            wifi_prov_mgr_stop_provisioning();
+            teardownProvisioning();
+        }
+#endif
+        if (netif_ap_) {
+            disableApInterface();
+        }
+        
+        if (state_ == WiFiState::CONNECTED || state_ == WiFiState::CONNECTING) {
+            esp_wifi_disconnect();
+        }
+        
+        // Stops the driver unless a SoftApService, EspNowChannel or other manager still uses it
+        WiFiDriver::instance().release(WiFiDriver::Role::STA);
+        netif_sta_ = nullptr;
         
         if (wifi_event_group_) {
             vEventGroupDelete(wifi_event_group_);
             wifi_event_group_ = nullptr;
         }
+        if (command_queue_) {
+            vQueueDelete(command_queue_);
+            command_queue_ = nullptr;
+        }
     }
 }
 
@@ -51,6 +268,8 @@ bool WiFiManager::init() {
         ESP_LOGD(TAG, "WiFi manager already initialized");
         return true;
     }
+    FOOTPRINT_SCOPE(init);
+    int64_t start_us = esp_timer_get_time();
     
     // Initialize NVS
     if (!initNVS()) {
@@ -66,11 +285,27 @@ bool WiFiManager::init() {
     
     initialized_ = true;
     updateState(WiFiState::DISCONNECTED);
+    applyRoamingConfig();
+    recordPhase(metrics_.init, start_us);
     
     ESP_LOGD(TAG, "WiFi manager initialized successfully");
     return true;
 }
 
+bool WiFiManager::init(const DriverConfig& config) {
+    if (initialized_) {
+        ESP_LOGE(TAG, "Driver settings must be given before the driver starts");
+        return false;
+    }
+    if (!isDriverConfigValid(config)) {
+        return false;
+    }
+    
+    driver_profile_ = DriverProfile::CUSTOM;
+    driver_config_ = config;
+    return init();
+}
+
 bool WiFiManager::initNVS() {
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -86,83 +321,378 @@ bool WiFiManager::initWiFi() {
         ESP_LOGE(TAG, "Failed to create event group");
         return false;
     }
+    xEventGroupSetBits(wifi_event_group_, PERSIST_IDLE_BIT);
     
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-    
-    // Create default station netif instance
-    netif_sta_ = esp_netif_create_default_wifi_sta();
-    if (netif_sta_ == NULL) {
-        ESP_LOGE(TAG, "Failed to create default STA netif");
+    command_queue_ = xQueueCreate(COMMAND_QUEUE_LEN, sizeof(Command*));
+    if (!command_queue_) {
+        ESP_LOGE(TAG, "Failed to create command queue");
         return false;
     }
     
-    // Also create AP netif for provisioning
-    netif_ap_ = esp_netif_create_default_wifi_ap();
-    if (netif_ap_ == NULL) {
-        ESP_LOGE(TAG, "Failed to create default AP netif");
+    // esp_netif, the default event loop and the driver are shared with other
+    // managers, SoftApService and EspNowChannel, and with components that
+    // brought them up before us. The AP netif is created on demand by
+    // startProvisioning()
+    WiFiDriver& driver = WiFiDriver::instance();
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    if (driver.isStarted()) {
+        ESP_LOGD(TAG, "WiFi driver already running, driver profile not applied");
+    } else {
+        applyDriverConfig(cfg);
+    }
+    if (!driver.acquire(WiFiDriver::Role::STA, cfg)) {
+        ESP_LOGE(TAG, "Failed to start WiFi driver");
         return false;
     }
-    
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    netif_sta_ = driver.getStaNetif();
     
     // Register event handlers
     ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
                                                        ESP_EVENT_ANY_ID,
                                                        &WiFiManager::eventHandler,
                                                        this,
-                                                       NULL));
+                                                       &wifi_event_handler_));
     ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
                                                        IP_EVENT_STA_GOT_IP,
                                                        &WiFiManager::eventHandler,
                                                        this,
-                                                       NULL));
+                                                       &got_ip_handler_));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
+                                                       IP_EVENT_STA_LOST_IP,
+                                                       &WiFiManager::eventHandler,
+                                                       this,
+                                                       &lost_ip_handler_));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(BI_WIFI_INTERNAL_EVENT,
+                                                       ESP_EVENT_ANY_ID,
+                                                       &WiFiManager::eventHandler,
+                                                       this,
+                                                       &internal_event_handler_));
+    
+    applyPowerProfile();
+    
+    return true;
+}
+
+void WiFiManager::applyDriverConfig(wifi_init_config_t& cfg) {
+    // Step down to smaller profiles until the static buffers fit next to the driver and lwIP
+    uint32_t free_heap = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    while (driver_profile_ != DriverProfile::LOW_MEMORY &&
+           driverStaticBytes(driver_config_, cfg) + DRIVER_HEAP_RESERVE > free_heap) {
+        ESP_LOGE(TAG, "Driver buffers need %" PRIu32 " bytes with %" PRIu32 " free, using a smaller profile",
+                driverStaticBytes(driver_config_, cfg) + DRIVER_HEAP_RESERVE, free_heap);
+        driver_profile_ = driver_profile_ == DriverProfile::BALANCED ? DriverProfile::LOW_MEMORY 
+                                                                     : DriverProfile::BALANCED;
+        driver_config_ = driverProfileConfig(driver_profile_);
+    }
+    
+    cfg.static_rx_buf_num = driver_config_.static_rx_buf_num;
+    cfg.dynamic_rx_buf_num = driver_config_.dynamic_rx_buf_num;
+    cfg.static_tx_buf_num = driver_config_.static_tx_buf_num;
+    cfg.dynamic_tx_buf_num = driver_config_.dynamic_tx_buf_num;
+    cfg.cache_tx_buf_num = driver_config_.cache_tx_buf_num;
+    cfg.ampdu_rx_enable = driver_config_.ampdu_rx_enable;
+    cfg.ampdu_tx_enable = driver_config_.ampdu_tx_enable;
+    cfg.rx_ba_win = driver_config_.rx_ba_win;
+    cfg.tx_ba_win = driver_config_.tx_ba_win;
+    ESP_LOGD(TAG, "Driver buffers: %d static RX, %d dynamic RX, %d dynamic TX, AMPDU RX %d/%d TX %d/%d",
+            cfg.static_rx_buf_num, cfg.dynamic_rx_buf_num, cfg.dynamic_tx_buf_num,
+            cfg.ampdu_rx_enable, cfg.rx_ba_win, cfg.ampdu_tx_enable, cfg.tx_ba_win);
+}
+
+uint32_t WiFiManager::driverStaticBytes(const DriverConfig& config, const wifi_init_config_t& cfg) {
+    // Static TX buffers are only allocated with CONFIG_ESP_WIFI_STATIC_TX_BUFFER (tx_buf_type 0)
+    uint32_t buffers = config.static_rx_buf_num + (cfg.tx_buf_type == 0 ? config.static_tx_buf_num : 0);
+    return buffers * WIFI_BUFFER_BYTES;
+}
+
+bool WiFiManager::isDriverConfigValid(const DriverConfig& config) {
+    if (config.static_rx_buf_num < 2 || config.dynamic_tx_buf_num < 1) {
+        ESP_LOGE(TAG, "Driver needs at least 2 static RX and 1 dynamic TX buffers");
+        return false;
+    }
+    if ((config.ampdu_rx_enable && (config.rx_ba_win < 2 || config.rx_ba_win > 32)) ||
+        (config.ampdu_tx_enable && (config.tx_ba_win < 2 || config.tx_ba_win > 32))) {
+        ESP_LOGE(TAG, "AMPDU block ack windows must be between 2 and 32");
+        return false;
+    }
+    
+    // A receive window larger than the buffers behind it cannot be honoured
+    if (config.ampdu_rx_enable && config.dynamic_rx_buf_num != 0 && 
+        config.rx_ba_win > config.dynamic_rx_buf_num) {
+        ESP_LOGE(TAG, "AMPDU RX window %d exceeds %d dynamic RX buffers", 
+                config.rx_ba_win, config.dynamic_rx_buf_num);
+        return false;
+    }
+    return true;
+}
+
+WiFiManager::DriverConfig WiFiManager::driverProfileConfig(DriverProfile profile) {
+    wifi_init_config_t defaults = WIFI_INIT_CONFIG_DEFAULT();
+    DriverConfig config;
+    config.static_rx_buf_num = defaults.static_rx_buf_num;
+    config.dynamic_rx_buf_num = defaults.dynamic_rx_buf_num;
+    config.static_tx_buf_num = defaults.static_tx_buf_num;
+    config.dynamic_tx_buf_num = defaults.dynamic_tx_buf_num;
+    config.cache_tx_buf_num = defaults.cache_tx_buf_num;
+    config.ampdu_rx_enable = defaults.ampdu_rx_enable;
+    config.ampdu_tx_enable = defaults.ampdu_tx_enable;
+    config.rx_ba_win = defaults.rx_ba_win;
+    config.tx_ba_win = defaults.tx_ba_win;
     
-    // Set WiFi mode to APSTA (supports both AP and STA mode)
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
-    ESP_ERROR_CHECK(esp_wifi_start());
+    switch (profile) {
+        case DriverProfile::LOW_MEMORY:
+            config.static_rx_buf_num = 4;
+            config.dynamic_rx_buf_num = 8;
+            config.static_tx_buf_num = 4;
+            config.dynamic_tx_buf_num = 8;
+            config.cache_tx_buf_num = 0;
+            config.ampdu_rx_enable = false;
+            config.ampdu_tx_enable = false;
+            break;
+        case DriverProfile::HIGH_THROUGHPUT:
+            // As in the ESP-IDF iperf example
+            config.static_rx_buf_num = 16;
+            config.dynamic_rx_buf_num = 64;
+            config.static_tx_buf_num = 16;
+            config.dynamic_tx_buf_num = 64;
+            config.ampdu_rx_enable = true;
+            config.ampdu_tx_enable = true;
+            config.rx_ba_win = 32;
+            config.tx_ba_win = 32;
+            break;
+        case DriverProfile::BALANCED:
+        case DriverProfile::CUSTOM:
+            break;
+    }
+    return config;
+}
+
+WiFiManager::DriverProfile WiFiManager::getDriverProfile() const {
+    return driver_profile_;
+}
+
+WiFiManager::DriverConfig WiFiManager::getDriverConfig() const {
+    return snapshot(driver_config_);
+}
+
+bool WiFiManager::enableApInterface() {
+    if (!netif_ap_) {
+        // Switches the driver to APSTA, fails while a SoftApService holds the AP
+        WiFiDriver& driver = WiFiDriver::instance();
+        if (!driver.acquire(WiFiDriver::Role::AP)) {
+            ESP_LOGE(TAG, "Failed to enable the AP interface");
+            return false;
+        }
+        netif_ap_ = driver.getApNetif();
+    }
     
+    // Provisioning runs at full power
+    applyPowerProfile();
     return true;
 }
 
+void WiFiManager::disableApInterface() {
+    if (netif_ap_) {
+        netif_ap_ = nullptr;
+        WiFiDriver::instance().release(WiFiDriver::Role::AP);
+    }
+    
+    applyPowerProfile();
+}
+
 bool WiFiManager::connect() {
+    RUN_ON_EVENT_TASK(connect());
+    FOOTPRINT_SCOPE(connect);
     if (!initialized_ && !init()) {
         ESP_LOGE(TAG, "Failed to initialize WiFi manager");
         return false;
     }
     
-    std::string ssid, password;
-    if (loadCredentials(ssid, password)) {
-        ESP_LOGD(TAG, "Found stored credentials, connecting to %s", ssid.c_str());
-        return connect(ssid, password, false);
+    if (loadNetworks() && networks_.count > 0) {
+        return connectBestNetwork();
+    }
+    
+    if (loadCredentials()) {
+        ESP_LOGD(TAG, "Found stored credentials, connecting to %s", creds_.ssid);
+        return connectInternal(creds_.ssid, creds_.key, false);
     } else {
         ESP_LOGD(TAG, "No stored credentials found, starting provisioning");
+        return startAutoProvisioning();
+    }
+}
+
+bool WiFiManager::connectBestNetwork() {
+    if (state_ == WiFiState::CONNECTING || state_ == WiFiState::CONNECTED) {
+        disconnect();
+    }
+    cancelReconnect();
+    
+    // connectSync() waits on these while the sweep runs, drop the previous outcome
+    xEventGroupClearBits(wifi_event_group_, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
+    
+    // One scan (or a recent cached one) for all candidates, picked once it is done
+    if (!isScanCacheFresh()) {
+        sweep_connect_ = true;
+        if (sweep_active_ || startNetworkScan()) {
+            return true;
+        }
+        sweep_connect_ = false;
+    }
+    return selectBestNetwork();
+}
+
+bool WiFiManager::selectBestNetwork() {
+    bool has_primary = loadCredentials();
+    
+    // Rank every visible candidate in a single pass over the scan results
+    int64_t now = (int64_t)time(nullptr);
+    int best_score = INT_MIN;
+    const char* best_ssid = nullptr;
+    const char* best_key = nullptr;
+    const wifi_ap_record_t* best_ap = nullptr;
+    for (uint16_t i = 0; scan_cache_ && i < scan_cache_count_; i++) {
+        if (!isCacheEntryFresh(scan_cache_[i])) {
+            continue;
+        }
+        const wifi_ap_record_t& ap = scan_cache_[i].ap;
+        const char* ap_ssid = (const char*)ap.ssid;
         
-        // Generate a unique AP name based on MAC address
-        uint8_t mac[6];
-        esp_wifi_get_mac(WIFI_IF_STA, mac);
-        char ap_name[32];
-        snprintf(ap_name, sizeof(ap_name), "zubIOT_%02X%02X%02X", mac[3], mac[4], mac[5]);
+        for (uint8_t j = 0; j < networks_.count; j++) {
+            const NetworkProfile& profile = networks_.entries[j];
+            if (strncmp(ap_ssid, profile.ssid, sizeof(profile.ssid)) != 0) {
+                continue;
+            }
+            int score = networkScore(ap, profile.priority, profile.bssid, profile.last_success, now);
+            if (score > best_score) {
+                best_score = score;
+                best_ssid = profile.ssid;
+                best_key = profile.key;
+                best_ap = &ap;
+            }
+        }
         
-        return startProvisioning(ap_name);
+        if (has_primary && strncmp(ap_ssid, creds_.ssid, sizeof(creds_.ssid)) == 0) {
+            bool cached = fast_record_valid_ && strcmp(fast_record_.ssid, creds_.ssid) == 0;
+            int score = networkScore(ap, 0, cached ? fast_record_.bssid : nullptr, 0, now);
+            if (score > best_score) {
+                best_score = score;
+                best_ssid = creds_.ssid;
+                best_key = creds_.key;
+                best_ap = &ap;
+            }
+        }
+    }
+    
+    if (best_ap) {
+        ESP_LOGD(TAG, "Best network %s (RSSI %d, score %d)", best_ssid, best_ap->rssi, best_score);
+        wifi_ap_record_t target = *best_ap;
+        return connectInternal(best_ssid, best_key, false, &target);
+    }
+    
+    // Nothing known is visible, keep trying the preferred network
+    if (has_primary) {
+        ESP_LOGD(TAG, "No known network visible, trying %s", creds_.ssid);
+        return connectInternal(creds_.ssid, creds_.key, false);
+    }
+    
+    const NetworkProfile* preferred = &networks_.entries[0];
+    for (uint8_t j = 1; j < networks_.count; j++) {
+        if (networks_.entries[j].priority > preferred->priority) {
+            preferred = &networks_.entries[j];
+        }
+    }
+    ESP_LOGD(TAG, "No known network visible, trying %s", preferred->ssid);
+    return connectInternal(preferred->ssid, preferred->key, false);
+}
+
+int WiFiManager::networkScore(const wifi_ap_record_t& ap, uint8_t priority, 
+                              const uint8_t* cached_bssid, int64_t last_success, int64_t now) {
+    int score = ap.rssi + priority * 10;
+    
+    // Prefer the AP and networks that worked recently
+    if (cached_bssid && memcmp(cached_bssid, ap.bssid, sizeof(ap.bssid)) == 0) {
+        score += 3;
+    }
+    if (last_success > 0 && now >= last_success && now - last_success < RECENT_SUCCESS_S) {
+        score += 5;
+    }
+    return score;
+}
+
+void WiFiManager::makeProvisioningName(char* name, size_t len) {
+    // Generate a unique AP name based on MAC address
+    uint8_t mac[6];
+    esp_wifi_get_mac(WIFI_IF_STA, mac);
+    snprintf(name, len, "zubIOT_%02X%02X%02X", mac[3], mac[4], mac[5]);
+}
+
+bool WiFiManager::resumeFromSleep() {
+    RUN_ON_EVENT_TASK(resumeFromSleep());
+    if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_UNDEFINED || !isRtcContextValid()) {
+        ESP_LOGD(TAG, "No valid sleep context, using cold connect path");
+        return connect();
+    }
+    
+    if (!initialized_ && !init()) {
+        ESP_LOGE(TAG, "Failed to initialize WiFi manager");
+        return false;
+    }
+    
+    // Seed the in-RAM caches so connect() does not touch NVS
+    fast_record_ = rtc_context_.fast;
+    fast_record_valid_ = true;
+    if (rtc_context_.lease_valid) {
+        lease_record_ = rtc_context_.lease;
+        lease_record_valid_ = true;
     }
+    static_ip_ = rtc_context_.static_ip;
+    static_ip_from_rtc_ = true;
+    
+    ESP_LOGD(TAG, "Resuming connection to %s from sleep context", rtc_context_.fast.ssid);
+    return connectInternal(rtc_context_.fast.ssid, rtc_context_.key, false);
 }
 
 bool WiFiManager::connect(const std::string& ssid, const std::string& password, bool save) {
+    // PBKDF2 runs on the calling task, the queued command only gets the derived key
+    char key[PMK_HEX_LEN + 1] = {};
+    bool ok = prepareKey(ssid.c_str(), password.c_str(), key) &&
+              runCommand([&] {
+                  FOOTPRINT_SCOPE(connect);
+                  return connectInternal(ssid.c_str(), key, save);
+              });
+    mbedtls_platform_zeroize(key, sizeof(key));
+    return ok;
+}
+
+bool WiFiManager::connectInternal(const char* ssid, const char* password, bool save,
+                                  const wifi_ap_record_t* ap) {
     if (!initialized_ && !init()) {
         ESP_LOGE(TAG, "Failed to initialize WiFi manager");
         return false;
     }
     
+    // An explicit network wins over a pending best-network pick
+    sweep_connect_ = false;
+    
     if (state_ == WiFiState::CONNECTING || state_ == WiFiState::CONNECTED) {
         ESP_LOGD(TAG, "Already connecting or connected, disconnecting first");
         disconnect();
     }
     
+    // A new connection starts with a fresh backoff sequence
+    cancelReconnect();
+    reconnect_attempts_ = 0;
+    auth_failures_ = 0;
+    
+    // Hand the driver a precomputed PMK instead of the passphrase if enabled
+    char key[PMK_HEX_LEN + 1] = {};
+    if (!prepareKey(ssid, password, key)) {
+        return false;
+    }
+    
     // Save credentials if requested
     if (save) {
-        saveCredentials(ssid, password);
+        saveCredentials(ssid, key);
     }
     
     // Clear event bits
@@ -172,39 +702,199 @@ bool WiFiManager::connect(const std::string& ssid, const std::string& password,
     wifi_config_t wifi_config = {};
     memset(&wifi_config, 0, sizeof(wifi_config_t));
     
-    strncpy((char*)wifi_config.sta.ssid, ssid.c_str(), sizeof(wifi_config.sta.ssid) - 1);
-    strncpy((char*)wifi_config.sta.password, password.c_str(), sizeof(wifi_config.sta.password) - 1);
+    strncpy((char*)wifi_config.sta.ssid, ssid, sizeof(wifi_config.sta.ssid) - 1);
+    wifi_config.sta.listen_interval = listenInterval(power_profile_);
+    
+    // Without a known BSSID the driver scans: first match or strongest AP
+    wifi_config.sta.scan_method = scan_config_.mode == ScanMode::FIRST_MATCH ? 
+                                  WIFI_FAST_SCAN : WIFI_ALL_CHANNEL_SCAN;
+    wifi_config.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+    
+    // Let the AP steer us (802.11v) and answer neighbor report requests (802.11k)
+    wifi_config.sta.rm_enabled = roaming_config_.enabled;
+    wifi_config.sta.btm_enabled = roaming_config_.enabled;
+    memcpy(wifi_config.sta.password, key, std::min(sizeof(wifi_config.sta.password), strlen(key)));
+    mbedtls_platform_zeroize(key, sizeof(key));
+    
+    // Use the scanned or cached BSSID/channel to skip the all-channel scan if available
+    fast_connect_pending_ = false;
+    const uint8_t* bssid = nullptr;
+    if (ap) {
+        memcpy(wifi_config.sta.bssid, ap->bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.channel = ap->primary;
+        wifi_config.sta.threshold.authmode = ap->authmode;
+        bssid = ap->bssid;
+    } else if (fast_connect_enabled_ && loadFastConnectRecord(ssid)) {
+        memcpy(wifi_config.sta.bssid, fast_record_.bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.channel = fast_record_.channel;
+        wifi_config.sta.threshold.authmode = (wifi_auth_mode_t)fast_record_.authmode;
+        bssid = fast_record_.bssid;
+    }
+    
+    // A static address replaces DHCP on this network, the sleep context already holds it
+    StaticIpConfig static_ip = {};
+    if (static_ip_from_rtc_) {
+        static_ip = static_ip_;
+        static_ip_from_rtc_ = false;
+    } else {
+        findStaticIp(ssid, &static_ip);
+    }
+    bool use_static_ip = applyStaticIp(static_ip);
+    
+    if (bssid) {
+        wifi_config.sta.bssid_set = true;
+        fast_connect_pending_ = true;
+        fast_connect_stats_.attempts++;
+        ESP_LOGD(TAG, "Fast-connect to " MACSTR " on channel %d", 
+                MAC2STR(bssid), wifi_config.sta.channel);
+        
+        // Reuse the cached DHCP lease if it was obtained from the same AP
+        if (lease_cache_enabled_ && !use_static_ip) {
+            applyCachedLease(bssid);
+        }
+    }
     
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_connect());
+    ESP_ERROR_CHECK(startAssociation());
     
     updateState(WiFiState::CONNECTING);
-    current_ssid_ = ssid;
-    current_password_ = password;
+    setCurrentSsid(ssid);
     
-    ESP_LOGD(TAG, "Connecting to %s...", ssid.c_str());
+    ESP_LOGD(TAG, "Connecting to %s...", ssid);
     return true;
 }
 
+WiFiManager::ConnectResult WiFiManager::connectSync(TickType_t timeout, uint8_t* reason) {
+    if (!connect()) {
+        return ConnectResult::START_FAILED;
+    }
+    if (state_ == WiFiState::PROVISIONING) {
+        return ConnectResult::PROVISIONING;
+    }
+    
+    EventBits_t bits = xEventGroupWaitBits(wifi_event_group_, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
+                                           pdFALSE, pdFALSE, timeout);
+    if (reason) {
+        *reason = last_disconnect_reason_;
+    }
+    
+    if (bits & WIFI_CONNECTED_BIT) {
+        return ConnectResult::CONNECTED;
+    }
+    return (bits & WIFI_FAIL_BIT) ? ConnectResult::FAILED : ConnectResult::TIMEOUT;
+}
+
+WiFiManager::ConnectResult WiFiManager::connectSync(const std::string& ssid, const std::string& password,
+                                                    TickType_t timeout, bool save, uint8_t* reason) {
+    if (!connect(ssid, password, save)) {
+        return ConnectResult::START_FAILED;
+    }
+    
+    EventBits_t bits = xEventGroupWaitBits(wifi_event_group_, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
+                                           pdFALSE, pdFALSE, timeout);
+    if (reason) {
+        *reason = last_disconnect_reason_;
+    }
+    
+    if (bits & WIFI_CONNECTED_BIT) {
+        return ConnectResult::CONNECTED;
+    }
+    return (bits & WIFI_FAIL_BIT) ? ConnectResult::FAILED : ConnectResult::TIMEOUT;
+}
+
+bool WiFiManager::waitForConnected(TickType_t timeout) {
+    if (!wifi_event_group_) {
+        return false;
+    }
+    
+    EventBits_t bits = xEventGroupWaitBits(wifi_event_group_, WIFI_CONNECTED_BIT,
+                                           pdFALSE, pdTRUE, timeout);
+    return (bits & WIFI_CONNECTED_BIT) != 0;
+}
+
+bool WiFiManager::waitForAny(std::initializer_list<WiFiState> states, TickType_t timeout, 
+                             WiFiState* reached) {
+    if (!wifi_event_group_) {
+        return false;
+    }
+    
+    EventBits_t mask = 0;
+    for (WiFiState state : states) {
+        mask |= stateBit(state);
+    }
+    if (mask == 0) {
+        return false;
+    }
+    
+    EventBits_t bits = xEventGroupWaitBits(wifi_event_group_, mask, pdFALSE, pdFALSE, timeout);
+    if (reached) {
+        *reached = state_;
+    }
+    return (bits & mask) != 0;
+}
+
+uint8_t WiFiManager::getLastDisconnectReason() const {
+    return last_disconnect_reason_;
+}
+
 bool WiFiManager::disconnect() {
+    RUN_ON_EVENT_TASK(disconnect());
     if (!initialized_) {
         ESP_LOGE(TAG, "WiFi manager not initialized");
         return false;
     }
     
+    // A running sweep still fills the cache but no longer joins a network
+    sweep_connect_ = false;
+    
+    // The disconnect event must not be taken for the first step of a roam
+    roam_pending_ = false;
+    roam_attempt_ = false;
+    
     esp_err_t err = esp_wifi_disconnect();
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Failed to disconnect from WiFi: %s", esp_err_to_name(err));
         return false;
     }
     
+    fast_connect_pending_ = false;
+    cancelReconnect();
+    restoreDhcp();
     updateState(WiFiState::DISCONNECTED);
     ESP_LOGD(TAG, "Disconnected from WiFi");
     return true;
 }
 
+#if CONFIG_BI_WIFI_PROVISIONING
 bool WiFiManager::startProvisioning(const std::string& ap_ssid, const std::string& ap_password, 
                                    uint8_t security, const std::string& pop) {
+    return startProvisioning(default_scheme_, ap_ssid, ap_password, security, pop);
+}
+
+bool WiFiManager::startProvisioning(ProvisioningScheme scheme, const std::string& service_name,
+                                   const std::string& ap_password, uint8_t security, 
+                                   const std::string& pop) {
+    RUN_ON_EVENT_TASK(startProvisioning(scheme, service_name, ap_password, security, pop));
+    return beginProvisioning(scheme, service_name, ap_password, security, pop, true);
+}
+
+bool WiFiManager::startReprovisioning(const std::string& service_name, const std::string& ap_password,
+                                      uint8_t security, const std::string& pop) {
+    RUN_ON_EVENT_TASK(startReprovisioning(service_name, ap_password, security, pop));
+    return beginProvisioning(default_scheme_, service_name, ap_password, security, pop, false);
+}
+
+bool WiFiManager::startAutoProvisioning() {
+    // Same defaults as startProvisioning(), the credentials that failed stay stored
+    char ap_name[32];
+    makeProvisioningName(ap_name, sizeof(ap_name));
+    return beginProvisioning(default_scheme_, ap_name, "", 1, "abcd1234", false);
+}
+
+bool WiFiManager::beginProvisioning(ProvisioningScheme scheme, const std::string& service_name,
+                                    const std::string& ap_password, uint8_t security,
+                                    const std::string& pop, bool erase_credentials) {
+    FOOTPRINT_SCOPE(start_provisioning);
     if (!initialized_ && !init()) {
         ESP_LOGE(TAG, "Failed to initialize WiFi manager");
         return false;
@@ -216,13 +906,17 @@ bool WiFiManager::startProvisioning(const std::string& ap_ssid, const std::strin
         return true;
     }
     
-    // Clear stored credentials before starting provisioning
-    clearStoredCredentials();
+#if !CONFIG_BI_WIFI_PROVISIONING_BLE
+    if (scheme == ProvisioningScheme::BLE) {
+        ESP_LOGE(TAG, "BLE provisioning is disabled (CONFIG_BI_WIFI_PROVISIONING_BLE)");
+        return false;
+    }
+#endif
     
-    // Clear event bits
-    xEventGroupClearBits(wifi_event_group_, PROVISIONING_DONE);
+    prov_started_at_us_ = esp_timer_get_time();
+    prov_phase_at_us_ = 0;
+    provisioning_scheme_ = scheme;
     
-    // Initialize provisioning manager with SoftAP scheme
     wifi_prov_mgr_config_t config = {
         .scheme = wifi_prov_scheme_softap,
         .scheme_event_handler = WIFI_PROV_EVENT_HANDLER_NONE,
@@ -230,7 +924,42 @@ bool WiFiManager::startProvisioning(const std::string& ap_ssid, const std::strin
         .wifi_prov_conn_cfg = {0}  // Initialize connection config to zero
     };
     
-    ESP_ERROR_CHECK(wifi_prov_mgr_init(config));
+    if (scheme == ProvisioningScheme::SOFTAP) {
+        // Bring up the SoftAP interface used by the provisioning scheme
+        if (!enableApInterface()) {
+            return false;
+        }
+    } else {
+#if CONFIG_BI_WIFI_PROVISIONING_BLE
+        config.scheme = wifi_prov_scheme_ble;
+#if CONFIG_BI_WIFI_RELEASE_BT_MEMORY
+        wifi_prov_event_handler_t free_btdm = WIFI_PROV_SCHEME_BLE_EVENT_HANDLER_FREE_BTDM;
+        config.scheme_event_handler = free_btdm;
+#endif
+        // BLE and WiFi time-slice the radio, which needs modem sleep
+        coex_active_ = true;
+#if CONFIG_ESP_COEX_SW_COEXIST_ENABLE
+        esp_coex_preference_set(ESP_COEX_PREFER_BALANCE);
+#endif
+        applyPowerProfile();
+#endif
+    }
+    
+    // An explicit start replaces the device's network, an automatic one keeps
+    // the old credentials until the new ones are saved
+    if (erase_credentials) {
+        clearStoredCredentials();
+    }
+    
+    // Clear event bits
+    xEventGroupClearBits(wifi_event_group_, PROVISIONING_DONE);
+    
+    esp_err_t err = wifi_prov_mgr_init(config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize provisioning manager: %s", esp_err_to_name(err));
+        releaseProvisioningRadio();
+        return false;
+    }
     
     // Set provisioning callback events
     ESP_ERROR_CHECK(esp_event_handler_register(WIFI_PROV_EVENT, 
@@ -238,11 +967,14 @@ bool WiFiManager::startProvisioning(const std::string& ap_ssid, const std::strin
                                               &WiFiManager::provisioningEventHandler, 
                                               this));
     
+    // The driver still holds the kept credentials, which are known to fail
     bool provisioned = false;
     ESP_ERROR_CHECK(wifi_prov_mgr_is_provisioned(&provisioned));
+    provisioned = provisioned && erase_credentials;
     
     if (!provisioned) {
-        ESP_LOGD(TAG, "Starting provisioning with SoftAP");
+        const char* scheme_name = scheme == ProvisioningScheme::BLE ? "BLE" : "SoftAP";
+        ESP_LOGD(TAG, "Starting provisioning with %s", scheme_name);
                
         // Start provisioning
         wifi_prov_security_t security_mode = security == 0 ? 
@@ -250,19 +982,25 @@ bool WiFiManager::startProvisioning(const std::string& ap_ssid, const std::strin
                                           
         const char* pop_str = security == 0 ? NULL : pop.c_str();
         
+        // The service key is the SoftAP password, BLE ignores it
+        const char* service_key = (scheme == ProvisioningScheme::SOFTAP && !ap_password.empty()) ?
+                                  ap_password.c_str() : NULL;
+        
         ESP_ERROR_CHECK(wifi_prov_mgr_start_provisioning(security_mode, 
                                                         pop_str, 
-                                                        ap_ssid.c_str(), 
-                                                        NULL));
+                                                        service_name.c_str(), 
+                                                        service_key));
         
         updateState(WiFiState::PROVISIONING);
         provisioning_active_ = true;
         
-        ESP_LOGD(TAG, "Provisioning started with SoftAP SSID: %s", ap_ssid.c_str());
-        if (!ap_password.empty()) {
-            ESP_LOGD(TAG, "SoftAP Password: %s", ap_password.c_str());
-        } else {
-            ESP_LOGD(TAG, "SoftAP is open (no password)");
+        ESP_LOGD(TAG, "Provisioning started with %s name: %s", scheme_name, service_name.c_str());
+        if (scheme == ProvisioningScheme::SOFTAP) {
+            if (service_key) {
+                ESP_LOGD(TAG, "SoftAP Password: %s", service_key);
+            } else {
+                ESP_LOGD(TAG, "SoftAP is open (no password)");
+            }
         }
         
         if (security != 0) {
@@ -270,116 +1008,2189 @@ bool WiFiManager::startProvisioning(const std::string& ap_ssid, const std::strin
         }
     } else {
         ESP_LOGD(TAG, "Already provisioned, connecting to WiFi");
-        wifi_prov_mgr_deinit();
+        teardownProvisioning();
         return connect();
     }
     
     return true;
 }
 
+void WiFiManager::setProvisioningScheme(ProvisioningScheme scheme) {
+    default_scheme_ = scheme;
+}
+
+WiFiManager::ProvisioningScheme WiFiManager::getProvisioningScheme() const {
+    return default_scheme_;
+}
+
 bool WiFiManager::stopProvisioning() {
+    RUN_ON_EVENT_TASK(stopProvisioning());
     if (!provisioning_active_) {
         ESP_LOGD(TAG, "Provisioning not active");
         return true;
     }
     
+    FOOTPRINT_SCOPE(stop_provisioning);
     wifi_prov_mgr_stop_provisioning();
-    wifi_prov_mgr_deinit();
-    provisioning_active_ = false;
+    teardownProvisioning();
     updateState(WiFiState::DISCONNECTED);
     
     ESP_LOGD(TAG, "Provisioning stopped");
     return true;
 }
 
-void WiFiManager::setConnectionCallback(ConnectionCallback callback, void* user_data) {
-    connection_callback_ = callback;
-    user_data_ = user_data;
-}
-
-bool WiFiManager::hasStoredCredentials() {
-    std::string ssid, password;
-    return loadCredentials(ssid, password);
+void WiFiManager::teardownProvisioning() {
+    uint32_t heap_before = esp_get_free_heap_size();
+    
+    // Frees the protocomm/HTTP server or BLE stack and the scheme state
+    wifi_prov_mgr_deinit();
+    esp_event_handler_unregister(WIFI_PROV_EVENT, ESP_EVENT_ANY_ID, 
+                                 &WiFiManager::provisioningEventHandler);
+    provisioning_active_ = false;
+    releaseProvisioningRadio();
+    
+#if CONFIG_BI_WIFI_RELEASE_BT_MEMORY
+    // The controller is idle once the scheme is gone, hand its memory to the heap
+    if (esp_bt_controller_get_status() == ESP_BT_CONTROLLER_STATUS_IDLE &&
+        esp_bt_controller_mem_release(ESP_BT_MODE_BTDM) == ESP_OK) {
+        ESP_LOGD(TAG, "Released Bluetooth controller memory");
+    }
+#endif
+    
+    uint32_t heap_after = esp_get_free_heap_size();
+    metrics_.provisioning_reclaimed_bytes = heap_after > heap_before ? heap_after - heap_before : 0;
+    ESP_LOGD(TAG, "Provisioning teardown reclaimed %" PRIu32 " bytes", 
+            metrics_.provisioning_reclaimed_bytes);
 }
 
-bool WiFiManager::clearStoredCredentials() {
-    nvs_handle_t nvs_handle;
-    esp_err_t err = nvs_open(nvs_namespace_.c_str(), NVS_READWRITE, &nvs_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error opening NVS handle: %s", esp_err_to_name(err));
-        return false;
-    }
+void WiFiManager::persistProvisionedCredentials() {
+    PendingCredentials* job = new PendingCredentials();
+    job->self = this;
+    memcpy(job->ssid, prov_ssid_, sizeof(job->ssid));
+    memcpy(job->password, prov_password_, sizeof(job->password));
     
-    err = nvs_erase_key(nvs_handle, NVS_KEY_SSID);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGE(TAG, "Error erasing SSID from NVS: %s", esp_err_to_name(err));
-        nvs_close(nvs_handle);
-        return false;
+    // A previous job still running keeps the bit clear, save this one inline
+    if (!(xEventGroupGetBits(wifi_event_group_) & PERSIST_IDLE_BIT)) {
+        ESP_LOGD(TAG, "Credentials already being persisted, saving inline");
+        savePendingCredentials(job);
+        return;
     }
     
-    err = nvs_erase_key(nvs_handle, NVS_KEY_PASSWORD);
-    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
-        ESP_LOGE(TAG, "Error erasing password from NVS: %s", esp_err_to_name(err));
-        nvs_close(nvs_handle);
-        return false;
+    // PBKDF2 and the flash write stay off the event loop while DHCP runs
+    xEventGroupClearBits(wifi_event_group_, PERSIST_IDLE_BIT);
+    if (xTaskCreate(&WiFiManager::persistTask, "wifi_persist", 4096, job, 
+                    tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create persist task, saving credentials inline");
+        xEventGroupSetBits(wifi_event_group_, PERSIST_IDLE_BIT);
+        savePendingCredentials(job);
     }
+}
+
+void WiFiManager::persistTask(void* arg) {
+    PendingCredentials* job = static_cast<PendingCredentials*>(arg);
+    EventGroupHandle_t event_group = job->self->wifi_event_group_;
+    savePendingCredentials(job);
     
-    err = nvs_commit(nvs_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error committing NVS changes: %s", esp_err_to_name(err));
-        nvs_close(nvs_handle);
-        return false;
+    // The destructor may run as soon as the bit is set, nothing of the instance is used after it
+    xEventGroupSetBits(event_group, PERSIST_IDLE_BIT);
+    vTaskDelete(NULL);
+}
+
+void WiFiManager::savePendingCredentials(PendingCredentials* job) {
+    // Derive the PMK on this task, only the NVS write goes through the event handler task
+    char key[PMK_HEX_LEN + 1] = {};
+    WiFiManager* self = job->self;
+    bool saved = self->prepareKey(job->ssid, job->password, key) &&
+                 self->runCommand([&] { return self->saveCredentials(job->ssid, key); });
+    mbedtls_platform_zeroize(key, sizeof(key));
+    if (!saved) {
+        ESP_LOGE(TAG, "Failed to persist provisioned credentials");
     }
-    
+    mbedtls_platform_zeroize(job, sizeof(*job));
+    delete job;
+}
+
+void WiFiManager::releaseProvisioningRadio() {
+    if (provisioning_scheme_ == ProvisioningScheme::SOFTAP) {
+        disableApInterface();
+        return;
+    }
+    
+    // Give the radio back to WiFi and restore the configured power profile
+    coex_active_ = false;
+#if CONFIG_ESP_COEX_SW_COEXIST_ENABLE
+    esp_coex_preference_set(ESP_COEX_PREFER_WIFI);
+#endif
+    applyPowerProfile();
+}
+#else
+bool WiFiManager::startProvisioning(const std::string&, const std::string&, uint8_t, const std::string&) {
+    ESP_LOGE(TAG, "Provisioning is disabled (CONFIG_BI_WIFI_PROVISIONING)");
+    return false;
+}
+
+bool WiFiManager::startProvisioning(ProvisioningScheme, const std::string&, const std::string&, 
+                                   uint8_t, const std::string&) {
+    ESP_LOGE(TAG, "Provisioning is disabled (CONFIG_BI_WIFI_PROVISIONING)");
+    return false;
+}
+
+bool WiFiManager::startReprovisioning(const std::string&, const std::string&, uint8_t, const std::string&) {
+    ESP_LOGE(TAG, "Provisioning is disabled (CONFIG_BI_WIFI_PROVISIONING)");
+    return false;
+}
+
+bool WiFiManager::startAutoProvisioning() {
+    ESP_LOGE(TAG, "Provisioning is disabled (CONFIG_BI_WIFI_PROVISIONING)");
+    return false;
+}
+
+void WiFiManager::setProvisioningScheme(ProvisioningScheme scheme) {
+    default_scheme_ = scheme;
+}
+
+WiFiManager::ProvisioningScheme WiFiManager::getProvisioningScheme() const {
+    return default_scheme_;
+}
+
+bool WiFiManager::stopProvisioning() {
+    return true;
+}
+#endif
+
+bool WiFiManager::addObserver(ObserverFn fn, void* ctx, uint32_t mask) {
+    RUN_ON_EVENT_TASK(addObserver(fn, ctx, mask));
+    if (!observers_.add(fn, ctx, mask)) {
+        ESP_LOGE(TAG, "Failed to register observer, %d slots in use", (int)observers_.size());
+        return false;
+    }
+    return true;
+}
+
+bool WiFiManager::removeObserver(ObserverFn fn, void* ctx) {
+    RUN_ON_EVENT_TASK(removeObserver(fn, ctx));
+    return observers_.remove(fn, ctx);
+}
+
+void WiFiManager::notifyObservers(Notification& notification) {
+    notification.state = state_;
+    observers_.notify(notification);
+}
+
+void WiFiManager::setConnectionCallback(ConnectionCallback callback, void* user_data) {
+    if (deferCommand()) {
+        runCommand([&] { setConnectionCallback(callback, user_data); return true; });
+        return;
+    }
+    connection_callback_ = callback;
+    user_data_ = user_data;
+}
+
+bool WiFiManager::startWorker(const WorkerConfig& config) {
+    if (worker_task_) {
+        ESP_LOGD(TAG, "Worker task already running");
+        return true;
+    }
+    if (!initialized_ && !init()) {
+        ESP_LOGE(TAG, "Failed to initialize WiFi manager");
+        return false;
+    }
+    
+    worker_stop_ = false;
+    xEventGroupClearBits(wifi_event_group_, WORKER_STOPPED_BIT);
+    
+    TaskHandle_t task = nullptr;
+    if (xTaskCreatePinnedToCore(&WiFiManager::workerTask, "wifi_worker", config.stack_size, 
+                                this, config.priority, &task, config.core_id) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create worker task");
+        return false;
+    }
+    worker_task_ = task;
+    
+    ESP_LOGD(TAG, "Worker task started");
+    return true;
+}
+
+void WiFiManager::stopWorker() {
+    TaskHandle_t task = worker_task_;
+    if (!task) {
+        return;
+    }
+    
+    TaskHandle_t current = xTaskGetCurrentTaskHandle();
+    if (current == task) {
+        ESP_LOGE(TAG, "Cannot stop the worker task from itself");
+        return;
+    }
+    
+    // The event loop task is the only producer, it hands over once the ring is empty
+    if (current == event_task_.load(std::memory_order_relaxed)) {
+        joinWorker();
+    } else if (!postInternalEvent(INTERNAL_WORKER_STOP, 0, portMAX_DELAY)) {
+        return;
+    }
+    
+    xEventGroupWaitBits(wifi_event_group_, WORKER_STOPPED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+    ESP_LOGD(TAG, "Worker task stopped");
+}
+
+void WiFiManager::joinWorker() {
+    TaskHandle_t task = worker_task_;
+    if (!task) {
+        return;
+    }
+    
+    // Nothing is posted while this task waits, the worker drains the ring and exits
+    worker_stop_ = true;
+    xTaskNotifyGive(task);
+    xEventGroupWaitBits(wifi_event_group_, WORKER_STOPPED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+}
+
+bool WiFiManager::isWorkerRunning() const {
+    return worker_task_ != nullptr;
+}
+
+uint32_t WiFiManager::getDroppedEventCount() const {
+    return worker_dropped_;
+}
+
+bool WiFiManager::isEventContext() const {
+    TaskHandle_t current = xTaskGetCurrentTaskHandle();
+    TaskHandle_t worker = worker_task_;
+    return worker ? current == worker : current == event_task_.load(std::memory_order_relaxed);
+}
+
+bool WiFiManager::deferCommand() const {
+    return command_queue_ && !isEventContext();
+}
+
+bool WiFiManager::submitCommand(Command& command) {
+    StaticSemaphore_t done_buffer;
+    command.done = xSemaphoreCreateBinaryStatic(&done_buffer);
+    
+    Command* pending = &command;
+    xQueueSend(command_queue_, &pending, portMAX_DELAY);
+    if (!postInternalEvent(INTERNAL_COMMAND, 0, portMAX_DELAY) && !worker_task_) {
+        // Nothing will drain the queue, the command may still be taken by a later one
+        ESP_LOGE(TAG, "Command wake-up lost, waiting for the next command");
+    }
+    
+    xSemaphoreTake(command.done, portMAX_DELAY);
+    vSemaphoreDelete(command.done);
+    return command.result;
+}
+
+void WiFiManager::drainCommands() {
+    Command* command = nullptr;
+    while (command_queue_ && xQueueReceive(command_queue_, &command, 0) == pdTRUE) {
+        command->result = command->invoke(command->fn);
+        xSemaphoreGive(command->done);
+    }
+}
+
+bool WiFiManager::postInternalEvent(int32_t event_id, uint32_t value, TickType_t timeout) {
+    InternalEvent event = {this, value};
+    esp_err_t err = esp_event_post(BI_WIFI_INTERNAL_EVENT, event_id, &event, sizeof(event), timeout);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to post internal event %" PRIi32 ": %s", event_id, esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+void WiFiManager::handleInternalEvent(int32_t event_id, const InternalEvent& event) {
+    switch (event_id) {
+        case INTERNAL_COMMAND: drainCommands(); break;
+        case INTERNAL_RECONNECT_TIMER: reconnectTimerCallback(this); break;
+        case INTERNAL_ROAM_TIMER: roamTimerCallback(this); break;
+        case INTERNAL_PROBE_TIMER: probeTimerCallback(this); break;
+        case INTERNAL_PROBE_SUCCESS: handleProbeSuccess(event.value); break;
+        case INTERNAL_PROBE_TIMEOUT: handleProbeTimeout(); break;
+        case INTERNAL_LEASE_RENEW_TIMER: leaseRenewTimerCallback(this); break;
+        case INTERNAL_NOTIFY_TIMER: handleNotifyTimer(); break;
+        default: break;
+    }
+}
+
+bool WiFiManager::isDroppableEvent(esp_event_base_t event_base, int32_t event_id) {
+    // Only WiFi events the state machine does not act on, e.g. SoftAP station logs
+    return event_base == WIFI_EVENT &&
+           event_id != WIFI_EVENT_STA_CONNECTED &&
+           event_id != WIFI_EVENT_STA_DISCONNECTED &&
+           event_id != WIFI_EVENT_SCAN_DONE;
+}
+
+bool WiFiManager::postToWorker(esp_event_base_t event_base, int32_t event_id, void* event_data) {
+    TaskHandle_t task = worker_task_;
+    if (!task || xTaskGetCurrentTaskHandle() == task) {
+        return false;
+    }
+    
+    size_t len = 0;
+    if (event_base == WIFI_EVENT) {
+        switch (event_id) {
+            case WIFI_EVENT_STA_CONNECTED: len = sizeof(wifi_event_sta_connected_t); break;
+            case WIFI_EVENT_STA_DISCONNECTED: len = sizeof(wifi_event_sta_disconnected_t); break;
+            case WIFI_EVENT_AP_STACONNECTED: len = sizeof(wifi_event_ap_staconnected_t); break;
+            case WIFI_EVENT_AP_STADISCONNECTED: len = sizeof(wifi_event_ap_stadisconnected_t); break;
+            default: break;
+        }
+    } else if (event_base == IP_EVENT) {
+        if (event_id == IP_EVENT_STA_GOT_IP) {
+            len = sizeof(ip_event_got_ip_t);
+        }
+    } else if (event_base == BI_WIFI_INTERNAL_EVENT) {
+        len = sizeof(InternalEvent);
+    }
+#if CONFIG_BI_WIFI_PROVISIONING
+    else if (event_base == WIFI_PROV_EVENT) {
+        if (event_id == WIFI_PROV_CRED_RECV) {
+            len = sizeof(wifi_sta_config_t);
+        } else if (event_id == WIFI_PROV_CRED_FAIL) {
+            len = sizeof(wifi_prov_sta_fail_reason_t);
+        }
+    }
+#endif
+    
+    uint32_t head = worker_head_.load(std::memory_order_relaxed);
+    uint32_t tail = worker_tail_.load(std::memory_order_acquire);
+    if (head - tail >= WORKER_QUEUE_LEN) {
+        if (isDroppableEvent(event_base, event_id)) {
+            worker_dropped_.fetch_add(1, std::memory_order_relaxed);
+            ESP_LOGE(TAG, "Worker queue full, dropping event %" PRIi32, event_id);
+            return true;
+        }
+        
+        // Losing a connection, IP, provisioning or internal event would stall the
+        // state machine, wait for the worker to free a slot instead
+        ESP_LOGD(TAG, "Worker queue full, waiting to queue event %" PRIi32, event_id);
+        while (head - worker_tail_.load(std::memory_order_acquire) >= WORKER_QUEUE_LEN) {
+            xEventGroupClearBits(wifi_event_group_, WORKER_SPACE_BIT);
+            worker_space_wanted_ = true;
+            if (head - worker_tail_.load(std::memory_order_acquire) < WORKER_QUEUE_LEN) {
+                break;
+            }
+            xEventGroupWaitBits(wifi_event_group_, WORKER_SPACE_BIT, pdTRUE, pdTRUE, portMAX_DELAY);
+        }
+        worker_space_wanted_ = false;
+    }
+    
+    EventMessage& msg = worker_queue_[head % WORKER_QUEUE_LEN];
+    msg.base = event_base;
+    msg.id = event_id;
+    msg.has_data = event_data && len > 0;
+    if (msg.has_data) {
+        memcpy(&msg.data, event_data, len);
+    }
+    worker_head_.store(head + 1, std::memory_order_release);
+    
+    xTaskNotifyGive(task);
+    return true;
+}
+
+void WiFiManager::signalWorkerSpace() {
+    if (worker_space_wanted_.exchange(false)) {
+        xEventGroupSetBits(wifi_event_group_, WORKER_SPACE_BIT);
+    }
+}
+
+void WiFiManager::workerTask(void* arg) {
+    WiFiManager* self = static_cast<WiFiManager*>(arg);
+    
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        
+        // Read before draining, every event was queued before the stop request
+        bool stop = self->worker_stop_;
+        
+        uint32_t tail = self->worker_tail_.load(std::memory_order_relaxed);
+        while (tail != self->worker_head_.load(std::memory_order_acquire)) {
+            EventMessage& msg = self->worker_queue_[tail % WORKER_QUEUE_LEN];
+            void* data = msg.has_data ? &msg.data : nullptr;
+#if CONFIG_BI_WIFI_PROVISIONING
+            if (msg.base == WIFI_PROV_EVENT) {
+                provisioningEventHandler(self, msg.base, msg.id, data);
+                self->worker_tail_.store(++tail, std::memory_order_release);
+            self->signalWorkerSpace();
+                continue;
+            }
+#endif
+            eventHandler(self, msg.base, msg.id, data);
+            self->worker_tail_.store(++tail, std::memory_order_release);
+            self->signalWorkerSpace();
+        }
+        
+        // Commands whose wake-up event was dropped with a full queue
+        self->drainCommands();
+        
+        if (stop) {
+            break;
+        }
+    }
+    
+    self->worker_task_ = nullptr;
+    xEventGroupSetBits(self->wifi_event_group_, WORKER_STOPPED_BIT);
+    vTaskDelete(NULL);
+}
+
+bool WiFiManager::addNetwork(const std::string& ssid, const std::string& password, uint8_t priority) {
+    if (ssid.empty() || ssid.length() > MAX_SSID_LEN) {
+        ESP_LOGE(TAG, "Invalid SSID");
+        return false;
+    }
+    
+    // Same as connect(), keep PBKDF2 off the event handler task
+    char key[PMK_HEX_LEN + 1] = {};
+    bool ok = prepareKey(ssid.c_str(), password.c_str(), key) &&
+              runCommand([&] { return storeNetwork(ssid.c_str(), key, priority); });
+    mbedtls_platform_zeroize(key, sizeof(key));
+    return ok;
+}
+
+bool WiFiManager::storeNetwork(const char* ssid, const char* key, uint8_t priority) {
+    loadNetworks();
+    
+    // Replace an entry with the same SSID, or evict the least useful one when full
+    NetworkProfile* entry = nullptr;
+    for (uint8_t i = 0; i < networks_.count; i++) {
+        if (strncmp(networks_.entries[i].ssid, ssid, sizeof(networks_.entries[i].ssid)) == 0) {
+            entry = &networks_.entries[i];
+            break;
+        }
+    }
+    if (!entry && networks_.count < MAX_NETWORKS) {
+        entry = &networks_.entries[networks_.count++];
+    }
+    if (!entry) {
+        entry = &networks_.entries[0];
+        for (uint8_t i = 1; i < networks_.count; i++) {
+            const NetworkProfile& candidate = networks_.entries[i];
+            if (candidate.priority < entry->priority ||
+                (candidate.priority == entry->priority && candidate.last_success < entry->last_success)) {
+                entry = &networks_.entries[i];
+            }
+        }
+        ESP_LOGD(TAG, "Network store full, replacing %s", entry->ssid);
+    }
+    
+    NetworkProfile profile = {};
+    strncpy(profile.ssid, ssid, sizeof(profile.ssid) - 1);
+    strncpy(profile.key, key, sizeof(profile.key) - 1);
+    profile.priority = priority;
+    if (strcmp(entry->ssid, profile.ssid) == 0) {
+        profile.static_ip = entry->static_ip;
+    }
+    *entry = profile;
+    mbedtls_platform_zeroize(&profile, sizeof(profile));
+    
+    return saveNetworks();
+}
+
+bool WiFiManager::removeNetwork(const std::string& ssid) {
+    RUN_ON_EVENT_TASK(removeNetwork(ssid));
+    loadNetworks();
+    
+    for (uint8_t i = 0; i < networks_.count; i++) {
+        if (strncmp(networks_.entries[i].ssid, ssid.c_str(), sizeof(networks_.entries[i].ssid)) == 0) {
+            networks_.entries[i] = networks_.entries[networks_.count - 1];
+            mbedtls_platform_zeroize(&networks_.entries[networks_.count - 1], sizeof(NetworkProfile));
+            networks_.count--;
+            return saveNetworks();
+        }
+    }
+    
+    ESP_LOGD(TAG, "Network %s not in store", ssid.c_str());
+    return false;
+}
+
+bool WiFiManager::clearNetworks() {
+    RUN_ON_EVENT_TASK(clearNetworks());
+    mbedtls_platform_zeroize(&networks_, sizeof(networks_));
+    networks_.version = NETWORK_STORE_VERSION;
+    networks_loaded_ = true;
+    
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(nvs_namespace_.c_str(), NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error opening NVS handle: %s", esp_err_to_name(err));
+        return false;
+    }
+    
+    err = nvs_erase_key(nvs_handle, NVS_KEY_NETWORKS);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "Error erasing network store from NVS: %s", esp_err_to_name(err));
+        nvs_close(nvs_handle);
+        return false;
+    }
+    
+    err = nvs_commit(nvs_handle);
+    nvs_close(nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error committing NVS changes: %s", esp_err_to_name(err));
+        return false;
+    }
+    
+    ESP_LOGD(TAG, "Network store cleared");
+    return true;
+}
+
+size_t WiFiManager::getNetworkCount() {
+    if (deferCommand()) {
+        size_t count = 0;
+        runCommand([&] { count = getNetworkCount(); return true; });
+        return count;
+    }
+    loadNetworks();
+    return networks_.count;
+}
+
+bool WiFiManager::hasStoredCredentials() {
+    RUN_ON_EVENT_TASK(hasStoredCredentials());
+    return loadCredentials();
+}
+
+bool WiFiManager::clearStoredCredentials() {
+    RUN_ON_EVENT_TASK(clearStoredCredentials());
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(nvs_namespace_.c_str(), NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error opening NVS handle: %s", esp_err_to_name(err));
+        return false;
+    }
+    
+    // Legacy keys are erased too in case they were never migrated
+    static const char* const credential_keys[] = {NVS_KEY_CREDENTIALS, NVS_KEY_SSID, NVS_KEY_PASSWORD};
+    for (const char* key : credential_keys) {
+        err = nvs_erase_key(nvs_handle, key);
+        if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGE(TAG, "Error erasing %s from NVS: %s", key, esp_err_to_name(err));
+            nvs_close(nvs_handle);
+            return false;
+        }
+    }
+    
+    err = nvs_erase_key(nvs_handle, NVS_KEY_FAST_CONNECT);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "Error erasing fast-connect record from NVS: %s", esp_err_to_name(err));
+        nvs_close(nvs_handle);
+        return false;
+    }
+    fast_record_valid_ = false;
+    
+    err = nvs_erase_key(nvs_handle, NVS_KEY_LEASE);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "Error erasing DHCP lease from NVS: %s", esp_err_to_name(err));
+        nvs_close(nvs_handle);
+        return false;
+    }
+    lease_record_valid_ = false;
+    
+    err = nvs_commit(nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error committing NVS changes: %s", esp_err_to_name(err));
+        nvs_close(nvs_handle);
+        return false;
+    }
+    
+    nvs_close(nvs_handle);
+    mbedtls_platform_zeroize(&creds_, sizeof(creds_));
+    creds_.loaded = true;
+    invalidateRtcContext();
+    ESP_LOGD(TAG, "WiFi credentials cleared from NVS");
+    return true;
+}
+
+WiFiManager::WiFiState WiFiManager::getState() const {
+    return state_.load();
+}
+
+bool WiFiManager::setPowerProfile(PowerProfile profile) {
+    RUN_ON_EVENT_TASK(setPowerProfile(profile));
+    power_profile_ = profile;
+    if (!initialized_) {
+        return true;
+    }
+    
+    // Listen interval is only read by the driver on the next association
+    wifi_config_t wifi_config;
+    if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) == ESP_OK) {
+        wifi_config.sta.listen_interval = listenInterval(profile);
+        esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    }
+    
+    return applyPowerProfile();
+}
+
+WiFiManager::PowerProfile WiFiManager::getPowerProfile() const {
+    if (netif_ap_) {
+        return PowerProfile::LOW_LATENCY;
+    }
+    // WIFI_PS_NONE is not allowed while BLE shares the radio
+    if (coex_active_ && power_profile_ == PowerProfile::LOW_LATENCY) {
+        return PowerProfile::BALANCED;
+    }
+    return power_profile_;
+}
+
+bool WiFiManager::applyPowerProfile() {
+    PowerProfile profile = getPowerProfile();
+    
+    wifi_ps_type_t ps_type;
+    int8_t tx_power;  // In units of 0.25 dBm
+    switch (profile) {
+        case PowerProfile::LOW_LATENCY:
+            ps_type = WIFI_PS_NONE;
+            tx_power = 80;
+            break;
+        case PowerProfile::MAX_SAVING:
+            ps_type = WIFI_PS_MAX_MODEM;
+            tx_power = 52;
+            break;
+        case PowerProfile::BALANCED:
+        default:
+            ps_type = WIFI_PS_MIN_MODEM;
+            tx_power = 80;
+            break;
+    }
+    
+    esp_err_t err = esp_wifi_set_ps(ps_type);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set power save mode: %s", esp_err_to_name(err));
+        return false;
+    }
+    
+    err = esp_wifi_set_max_tx_power(tx_power);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set TX power: %s", esp_err_to_name(err));
+        return false;
+    }
+    
+    ESP_LOGD(TAG, "Power profile %d applied", (int)profile);
+    return true;
+}
+
+uint16_t WiFiManager::listenInterval(PowerProfile profile) {
+    // In beacon intervals, only used by WIFI_PS_MAX_MODEM
+    return profile == PowerProfile::MAX_SAVING ? 10 : 3;
+}
+
+void WiFiManager::setReconnectPolicy(const ReconnectPolicy& policy) {
+    if (deferCommand()) {
+        runCommand([&] { setReconnectPolicy(policy); return true; });
+        return;
+    }
+    reconnect_policy_ = policy;
+}
+
+WiFiManager::ReconnectPolicy WiFiManager::getReconnectPolicy() const {
+    return snapshot(reconnect_policy_);
+}
+
+uint32_t WiFiManager::getReconnectAttempts() const {
+    return reconnect_attempts_;
+}
+
+WiFiManager::ReconnectAction WiFiManager::reconnectAction(uint8_t reason) {
+    switch (reason) {
+        case WIFI_REASON_AUTH_FAIL:
+        case WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT:
+        case WIFI_REASON_HANDSHAKE_TIMEOUT:
+            return ReconnectAction::AUTH_RETRY;
+        case WIFI_REASON_802_1X_AUTH_FAILED:
+        case WIFI_REASON_NO_AP_FOUND_W_COMPATIBLE_SECURITY:
+            return ReconnectAction::ABORT;
+        case WIFI_REASON_ASSOC_TOOMANY:
+        case WIFI_REASON_AP_TSF_RESET:
+            return ReconnectAction::SLOW_BACKOFF;
+        default:
+            return ReconnectAction::BACKOFF;
+    }
+}
+
+uint32_t WiFiManager::nextJitter() {
+    // xorshift32 seeded from the MAC so devices spread out differently
+    if (jitter_state_ == 0) {
+        uint8_t mac[6] = {};
+        esp_wifi_get_mac(WIFI_IF_STA, mac);
+        jitter_state_ = ((uint32_t)mac[2] << 24 | (uint32_t)mac[3] << 16 |
+                         (uint32_t)mac[4] << 8 | mac[5]) ^ ((uint32_t)mac[0] << 8 | mac[1]);
+        jitter_state_ ^= esp_random();
+        if (jitter_state_ == 0) {
+            jitter_state_ = 0x9E3779B9;
+        }
+    }
+    jitter_state_ ^= jitter_state_ << 13;
+    jitter_state_ ^= jitter_state_ >> 17;
+    jitter_state_ ^= jitter_state_ << 5;
+    return jitter_state_;
+}
+
+bool WiFiManager::scheduleReconnect(uint8_t reason) {
+    ReconnectAction action = reconnectAction(reason);
+    if (action == ReconnectAction::ABORT) {
+        ESP_LOGE(TAG, "Disconnect reason %d cannot be fixed by retrying", reason);
+        handleReconnectFailure();
+        return false;
+    }
+    
+    // A handshake timeout or a single AUTH_FAIL is often just a weak signal
+    if (action == ReconnectAction::AUTH_RETRY) {
+        uint8_t limit = reason == WIFI_REASON_AUTH_FAIL ? AUTH_FAIL_LIMIT : HANDSHAKE_RETRY_LIMIT;
+        if (++auth_failures_ >= limit) {
+            ESP_LOGE(TAG, "Authentication failed %u times in a row, reason %d", auth_failures_, reason);
+            handleReconnectFailure();
+            return false;
+        }
+    }
+    
+    if (reconnect_policy_.max_attempts != 0 && reconnect_attempts_ >= reconnect_policy_.max_attempts) {
+        ESP_LOGE(TAG, "Giving up after %" PRIu32 " reconnect attempts", reconnect_attempts_);
+        handleReconnectFailure();
+        return false;
+    }
+    
+    if (!reconnect_timer_) {
+        esp_timer_create_args_t timer_args = {};
+        timer_args.callback = &WiFiManager::postTimerEvent<INTERNAL_RECONNECT_TIMER>;
+        timer_args.arg = this;
+        timer_args.name = "wifi_reconnect";
+        if (esp_timer_create(&timer_args, &reconnect_timer_) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create reconnect timer, reconnecting now");
+            reconnect_timer_ = nullptr;
+            reconnect_attempts_++;
+            metrics_.reconnects++;
+            startAssociation();
+            return true;
+        }
+    }
+    
+    // Exponential ceiling with full jitter, overloaded APs start further out
+    uint32_t shift = std::min<uint32_t>(reconnect_attempts_, 16);
+    if (action == ReconnectAction::SLOW_BACKOFF) {
+        shift += 2;
+    }
+    uint64_t ceiling = std::min<uint64_t>((uint64_t)reconnect_policy_.base_delay_ms << shift,
+                                          reconnect_policy_.max_delay_ms);
+    uint32_t delay_ms = ceiling > 0 ? nextJitter() % (uint32_t)(ceiling + 1) : 0;
+    
+    reconnect_attempts_++;
+    metrics_.reconnects++;
+    ESP_LOGD(TAG, "Reconnect attempt %" PRIu32 " in %" PRIu32 " ms", reconnect_attempts_, delay_ms);
+    esp_timer_stop(reconnect_timer_);
+    esp_timer_start_once(reconnect_timer_, (uint64_t)delay_ms * 1000);
+    return true;
+}
+
+void WiFiManager::cancelReconnect() {
+    if (reconnect_timer_) {
+        esp_timer_stop(reconnect_timer_);
+    }
+}
+
+void WiFiManager::handleReconnectFailure() {
+    cancelReconnect();
+    reconnect_attempts_ = 0;
+    auth_failures_ = 0;
+    roam_pending_ = false;
+    roam_attempt_ = false;
+    updateState(WiFiState::ERROR);
+    xEventGroupSetBits(wifi_event_group_, WIFI_FAIL_BIT);
+    
+    if (reconnect_policy_.provision_on_failure) {
+        startAutoProvisioning();
+    }
+}
+
+void WiFiManager::reconnectTimerCallback(void* arg) {
+    WiFiManager* self = static_cast<WiFiManager*>(arg);
+    if (self->state_ != WiFiState::CONNECTING) {
+        return;
+    }
+    
+    ESP_LOGD(TAG, "Trying to reconnect...");
+    esp_err_t err = self->startAssociation();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to reconnect: %s", esp_err_to_name(err));
+    }
+}
+
+std::string WiFiManager::getSSID() const {
+    char ssid[sizeof(current_ssid_)];
+    if (getSSID(ssid, sizeof(ssid)) == 0) {
+        return "";
+    }
+    return ssid;
+}
+
+size_t WiFiManager::getSSID(char* buf, size_t len) const {
+    if (!buf || len == 0) {
+        return 0;
+    }
+    if (state_ != WiFiState::CONNECTED) {
+        buf[0] = '\0';
+        return 0;
+    }
+    
+    // Sequence lock, retry if a connect attempt rewrote the SSID meanwhile
+    size_t n;
+    uint32_t seq;
+    do {
+        seq = ssid_seq_.load(std::memory_order_acquire);
+        n = strnlen(current_ssid_, sizeof(current_ssid_) - 1);
+        n = std::min(n, len - 1);
+        memcpy(buf, current_ssid_, n);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) != 0 || seq != ssid_seq_.load(std::memory_order_relaxed));
+    buf[n] = '\0';
+    return n;
+}
+
+void WiFiManager::setCurrentSsid(const char* ssid) {
+    ssid_seq_.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    snprintf(current_ssid_, sizeof(current_ssid_), "%s", ssid);
+    ssid_seq_.fetch_add(1, std::memory_order_release);
+}
+
+std::string_view WiFiManager::getSSIDView() const {
+    if (state_ != WiFiState::CONNECTED) {
+        return std::string_view();
+    }
+    return std::string_view(current_ssid_);
+}
+
+std::string WiFiManager::getIPAddress() const {
+    char ip_addr[16];
+    if (!getIPAddress(ip_addr, sizeof(ip_addr))) {
+        return "";
+    }
+    return std::string(ip_addr);
+}
+
+bool WiFiManager::getIPAddress(char* buf, size_t len) const {
+    esp_ip4_addr_t ip = getIPv4();
+    if (!buf || len == 0 || ip.addr == 0) {
+        if (buf && len > 0) {
+            buf[0] = '\0';
+        }
+        return false;
+    }
+    
+    int n = snprintf(buf, len, IPSTR, IP2STR(&ip));
+    return n > 0 && (size_t)n < len;
+}
+
+esp_ip4_addr_t WiFiManager::getIPv4() const {
+    esp_ip4_addr_t ip = {};
+    if (state_ == WiFiState::CONNECTED) {
+        ip.addr = ip_addr_.load(std::memory_order_relaxed);
+    }
+    return ip;
+}
+
+void WiFiManager::setFastConnectEnabled(bool enabled) {
+    if (deferCommand()) {
+        runCommand([&] { setFastConnectEnabled(enabled); return true; });
+        return;
+    }
+    fast_connect_enabled_ = enabled;
+}
+
+bool WiFiManager::isFastConnectEnabled() const {
+    return fast_connect_enabled_;
+}
+
+WiFiManager::FastConnectStats WiFiManager::getFastConnectStats() const {
+    return snapshot(fast_connect_stats_);
+}
+
+void WiFiManager::setPmkStorageEnabled(bool enabled) {
+    if (deferCommand()) {
+        runCommand([&] { setPmkStorageEnabled(enabled); return true; });
+        return;
+    }
+    pmk_storage_enabled_ = enabled;
+}
+
+bool WiFiManager::isPmkStorageEnabled() const {
+    return pmk_storage_enabled_;
+}
+
+void WiFiManager::setLeaseCacheEnabled(bool enabled) {
+    if (deferCommand()) {
+        runCommand([&] { setLeaseCacheEnabled(enabled); return true; });
+        return;
+    }
+    lease_cache_enabled_ = enabled;
+    if (!enabled) {
+        restoreDhcp();
+    }
+}
+
+bool WiFiManager::isLeaseCacheEnabled() const {
+    return lease_cache_enabled_;
+}
+
+uint32_t WiFiManager::getIpAcquisitionTimeMs() const {
+    return metrics_.dhcp.last_us / 1000;
+}
+
+WiFiManager::Metrics WiFiManager::getMetrics() const {
+    return snapshot(metrics_);
+}
+
+void WiFiManager::resetMetrics() {
+    if (deferCommand()) {
+        runCommand([&] { resetMetrics(); return true; });
+        return;
+    }
+    metrics_ = {};
+}
+
+WiFiManager::Footprint WiFiManager::getFootprint() const {
+#if CONFIG_BI_WIFI_FOOTPRINT
+    return snapshot(footprint_);
+#else
+    return {};
+#endif
+}
+
+void WiFiManager::resetFootprint() {
+    if (deferCommand()) {
+        runCommand([&] { resetFootprint(); return true; });
+        return;
+    }
+#if CONFIG_BI_WIFI_FOOTPRINT
+    footprint_ = {};
+#endif
+}
+
+WiFiManager::HeapSnapshot WiFiManager::heapSnapshot() {
+    HeapSnapshot snapshot;
+    snapshot.free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    snapshot.min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    snapshot.free_internal = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    snapshot.free_dma = heap_caps_get_free_size(MALLOC_CAP_DMA);
+    snapshot.largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    return snapshot;
+}
+
+void WiFiManager::recordConnectedFootprint() {
+#if CONFIG_BI_WIFI_FOOTPRINT
+    uint32_t free_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    if (footprint_.connected_count == 0) {
+        footprint_.connected_free_first = free_heap;
+        footprint_.connected_free_min = free_heap;
+    }
+    footprint_.connected_free_min = std::min(footprint_.connected_free_min, free_heap);
+    footprint_.connected_free_last = free_heap;
+    footprint_.connected_count++;
+    
+    // The high-water mark only goes down, sampling it here also covers earlier events
+    uint32_t stack_free = uxTaskGetStackHighWaterMark(nullptr);
+    if (footprint_.event_task_stack_free == 0 || stack_free < footprint_.event_task_stack_free) {
+        footprint_.event_task_stack_free = stack_free;
+    }
+#endif
+}
+
+#if CONFIG_BI_WIFI_FOOTPRINT
+WiFiManager::FootprintScope::FootprintScope(FootprintPhase& phase) : phase_(phase) {
+    phase_.before = heapSnapshot();
+}
+
+WiFiManager::FootprintScope::~FootprintScope() {
+    phase_.after = heapSnapshot();
+    phase_.last_delta = (int32_t)phase_.before.free - (int32_t)phase_.after.free;
+    phase_.total_delta += phase_.last_delta;
+    phase_.count++;
+}
+#endif
+
+uint32_t WiFiManager::getDisconnectCount(uint8_t reason) const {
+    return metrics_.disconnect_reasons[disconnectReasonIndex(reason)];
+}
+
+size_t WiFiManager::disconnectReasonIndex(uint8_t reason) {
+    // 802.11 reasons map to themselves, ESP-specific reasons (200+) follow them
+    if (reason < 64) {
+        return reason;
+    }
+    if (reason >= 200 && reason < 200 + (Metrics::REASON_OTHER - 64)) {
+        return 64 + (reason - 200);
+    }
+    return Metrics::REASON_OTHER;
+}
+
+void WiFiManager::recordPhase(PhaseStats& stats, int64_t start_us) {
+    if (start_us == 0) {
+        return;
+    }
+    
+    recordSample(stats, (uint32_t)(esp_timer_get_time() - start_us));
+}
+
+void WiFiManager::recordSample(PhaseStats& stats, uint32_t duration_us) {
+    stats.last_us = duration_us;
+    if (stats.count == 0) {
+        stats.min_us = duration_us;
+        stats.max_us = duration_us;
+        stats.ewma_us = duration_us;
+    } else {
+        stats.min_us = std::min(stats.min_us, duration_us);
+        stats.max_us = std::max(stats.max_us, duration_us);
+        // EWMA with alpha = 1/8
+        stats.ewma_us = (uint32_t)((int64_t)stats.ewma_us + ((int64_t)duration_us - stats.ewma_us) / 8);
+    }
+    stats.count++;
+}
+
+void WiFiManager::setRoamingConfig(const RoamingConfig& config) {
+    if (deferCommand()) {
+        runCommand([&] { setRoamingConfig(config); return true; });
+        return;
+    }
+    roaming_config_ = config;
+    if (initialized_) {
+        applyRoamingConfig();
+    }
+}
+
+WiFiManager::RoamingConfig WiFiManager::getRoamingConfig() const {
+    return snapshot(roaming_config_);
+}
+
+void WiFiManager::applyRoamingConfig() {
+    if (!roam_timer_) {
+        esp_timer_create_args_t timer_args = {};
+        timer_args.callback = &WiFiManager::postTimerEvent<INTERNAL_ROAM_TIMER>;
+        timer_args.arg = this;
+        timer_args.name = "wifi_roam";
+        if (esp_timer_create(&timer_args, &roam_timer_) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create roaming timer");
+            roam_timer_ = nullptr;
+            return;
+        }
+    }
+    
+    esp_timer_stop(roam_timer_);
+    roam_rssi_ = 0;
+    if (roaming_config_.enabled && roaming_config_.sample_interval_ms > 0) {
+        esp_timer_start_periodic(roam_timer_, (uint64_t)roaming_config_.sample_interval_ms * 1000);
+    }
+}
+
+void WiFiManager::roamTimerCallback(void* arg) {
+    WiFiManager* self = static_cast<WiFiManager*>(arg);
+    if (self->state_ != WiFiState::CONNECTED || self->roam_scan_active_ || self->roam_pending_ ||
+        self->sweep_active_) {
+        self->roam_rssi_ = 0;
+        return;
+    }
+    
+    wifi_ap_record_t ap_info;
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        return;
+    }
+    
+    // Smooth the samples so a single fade does not trigger a scan
+    self->roam_rssi_ = self->roam_rssi_ == 0 ? ap_info.rssi : (3 * self->roam_rssi_ + ap_info.rssi) / 4;
+    if (self->roam_rssi_ >= self->roaming_config_.rssi_threshold) {
+        return;
+    }
+    
+    int64_t now = esp_timer_get_time();
+    if (self->last_roam_scan_us_ != 0 && 
+        now - self->last_roam_scan_us_ < (int64_t)self->roaming_config_.min_roam_interval_ms * 1000) {
+        return;
+    }
+    
+    ESP_LOGD(TAG, "RSSI %d dBm below threshold, starting roaming scan", self->roam_rssi_);
+    self->startRoamScan(ap_info);
+}
+
+void WiFiManager::startRoamScan(const wifi_ap_record_t& current) {
+    last_roam_scan_us_ = esp_timer_get_time();
+    
+    // A recent scan may already know a better AP
+    const wifi_ap_record_t* cached = bestCachedAp(current_ssid_, current.bssid);
+    if (cached && cached->rssi >= current.rssi + roaming_config_.rssi_hysteresis) {
+        ESP_LOGD(TAG, "Roaming candidate found in scan cache");
+        evaluateRoamCandidates();
+        return;
+    }
+    
+    // Only scan channels this network is known to use
+    uint16_t channels = learnedChannelMask(current_ssid_) | (1 << current.primary);
+    
+    // Nothing learned beyond the current channel, try the non-overlapping ones
+    if ((channels & (channels - 1)) == 0) {
+        channels |= (1 << 1) | (1 << 6) | (1 << 11);
+    }
+    
+    roam_scan_channels_ = channels & CHANNEL_MASK_ALL;
+    metrics_.roam_scans++;
+    
+    roam_scan_active_ = true;
+    if (!scanNextRoamChannel()) {
+        roam_scan_active_ = false;
+    }
+}
+
+bool WiFiManager::scanNextRoamChannel() {
+    while (roam_scan_channels_ != 0) {
+        uint8_t channel = __builtin_ctz(roam_scan_channels_);
+        roam_scan_channels_ &= ~(1 << channel);
+        
+        wifi_scan_config_t scan_config = makeScanConfig(channel);
+        scan_config.ssid = (uint8_t*)current_ssid_;
+        if (esp_wifi_scan_start(&scan_config, false) == ESP_OK) {
+            return true;
+        }
+        ESP_LOGD(TAG, "Roaming scan on channel %d failed", channel);
+    }
+    return false;
+}
+
+void WiFiManager::handleRoamScanDone() {
+    fetchScanResults();
+    if (scanNextRoamChannel()) {
+        return;
+    }
+    roam_scan_active_ = false;
+    evaluateRoamCandidates();
+}
+
+void WiFiManager::evaluateRoamCandidates() {
+    // Hysteresis: only move if the candidate is clearly better than the current AP
+    wifi_ap_record_t current;
+    if (state_ != WiFiState::CONNECTED || esp_wifi_sta_get_ap_info(&current) != ESP_OK) {
+        return;
+    }
+    const wifi_ap_record_t* best = bestCachedAp(current_ssid_, current.bssid);
+    if (!best || best->rssi < current.rssi + roaming_config_.rssi_hysteresis) {
+        ESP_LOGD(TAG, "No better AP found");
+        return;
+    }
+    roam_candidate_ = *best;
+    
+    ESP_LOGD(TAG, "Roaming from " MACSTR " (%d dBm) to " MACSTR " (%d dBm)",
+            MAC2STR(current.bssid), current.rssi, MAC2STR(roam_candidate_.bssid), roam_candidate_.rssi);
+    
+    wifi_config_t wifi_config;
+    if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) != ESP_OK) {
+        return;
+    }
+    memcpy(wifi_config.sta.bssid, roam_candidate_.bssid, sizeof(wifi_config.sta.bssid));
+    wifi_config.sta.bssid_set = true;
+    wifi_config.sta.channel = roam_candidate_.primary;
+    if (esp_wifi_set_config(WIFI_IF_STA, &wifi_config) != ESP_OK) {
+        return;
+    }
+    
+    // The cached lease belongs to the old AP
+    restoreDhcp();
+    
+    roam_pending_ = true;
+    roam_attempt_ = true;
+    metrics_.roams++;
+    esp_err_t err = esp_wifi_disconnect();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to leave the old AP: %s", esp_err_to_name(err));
+        roam_pending_ = false;
+        roam_attempt_ = false;
+    }
+}
+
+void WiFiManager::setScanConfig(const ScanConfig& config) {
+    if (deferCommand()) {
+        runCommand([&] { setScanConfig(config); return true; });
+        return;
+    }
+    scan_config_ = config;
+    scan_config_.channel_mask &= CHANNEL_MASK_ALL;
+}
+
+WiFiManager::ScanConfig WiFiManager::getScanConfig() const {
+    return snapshot(scan_config_);
+}
+
+bool WiFiManager::scanNetworks(bool use_cache) {
+    if (deferCommand()) {
+        // Start the sweep on the event task and wait here instead of blocking it
+        xEventGroupClearBits(wifi_event_group_, SCAN_DONE_BIT);
+        if (!runCommand([&] { return scanNetworks(use_cache); })) {
+            return false;
+        }
+        EventBits_t bits = xEventGroupWaitBits(wifi_event_group_, SCAN_DONE_BIT, pdFALSE, pdFALSE,
+                                               pdMS_TO_TICKS(SCAN_WAIT_MS));
+        return (bits & SCAN_DONE_BIT) && isScanCacheFresh();
+    }
+    if (!initialized_) {
+        ESP_LOGE(TAG, "WiFi manager not initialized");
+        return false;
+    }
+    if (use_cache && isScanCacheFresh()) {
+        metrics_.scan_cache_hits++;
+        xEventGroupSetBits(wifi_event_group_, SCAN_DONE_BIT);
+        return true;
+    }
+    
+    // Join a sweep that is already running
+    return sweep_active_ || startNetworkScan();
+}
+
+bool WiFiManager::startNetworkScan() {
+    // The sweep takes the radio from a background roaming scan
+    if (roam_scan_active_) {
+        esp_wifi_scan_stop();
+        roam_scan_active_ = false;
+        roam_scan_channels_ = 0;
+    }
+    
+    // Learned channels first, all of them if no known network shows up there
+    uint16_t channels = learnedChannelMask(nullptr);
+    bool stop_on_match = scan_config_.mode == ScanMode::FIRST_MATCH;
+    if (channels != 0) {
+        return startScanSweep(channels, stop_on_match, true);
+    }
+    return startScanSweep(CHANNEL_MASK_ALL, stop_on_match, false);
+}
+
+size_t WiFiManager::getScanResults(wifi_ap_record_t* records, size_t max_records) const {
+    if (!records) {
+        return 0;
+    }
+    
+    // The cache is merged and cleared on the event task, copy it there
+    size_t count = 0;
+    runReader([&] {
+        for (uint16_t i = 0; scan_cache_ && i < scan_cache_count_ && count < max_records; i++) {
+            if (isCacheEntryFresh(scan_cache_[i])) {
+                records[count++] = scan_cache_[i].ap;
+            }
+        }
+    });
+    std::sort(records, records + count, [](const wifi_ap_record_t& a, const wifi_ap_record_t& b) {
+        return a.rssi > b.rssi;
+    });
+    return count;
+}
+
+void WiFiManager::clearScanCache() {
+    if (deferCommand()) {
+        runCommand([&] { clearScanCache(); return true; });
+        return;
+    }
+    scan_cache_count_ = 0;
+}
+
+wifi_scan_config_t WiFiManager::makeScanConfig(uint8_t channel) const {
+    wifi_scan_config_t scan_config = {};
+    scan_config.channel = channel;
+    if (scan_config_.passive) {
+        scan_config.scan_type = WIFI_SCAN_TYPE_PASSIVE;
+        scan_config.scan_time.passive = scan_config_.passive_ms;
+    } else {
+        scan_config.scan_type = WIFI_SCAN_TYPE_ACTIVE;
+        scan_config.scan_time.active.min = scan_config_.active_min_ms;
+        scan_config.scan_time.active.max = scan_config_.active_max_ms;
+    }
+    return scan_config;
+}
+
+uint16_t WiFiManager::learnedChannelMask(const char* ssid) const {
+    if (scan_config_.channel_mask != 0) {
+        return scan_config_.channel_mask;
+    }
+    
+    // Channels the network (or any known network if ssid is null) was last seen on
+    uint16_t channels = 0;
+    if (fast_record_valid_ && (!ssid || strcmp(ssid, fast_record_.ssid) == 0)) {
+        channels |= 1 << fast_record_.channel;
+    }
+    for (uint8_t i = 0; i < networks_.count; i++) {
+        const NetworkProfile& profile = networks_.entries[i];
+        if (profile.channel != 0 && (!ssid || strcmp(ssid, profile.ssid) == 0)) {
+            channels |= 1 << profile.channel;
+        }
+    }
+    return channels & CHANNEL_MASK_ALL;
+}
+
+bool WiFiManager::startScanSweep(uint16_t channels, bool stop_on_match, bool fallback) {
+    xEventGroupClearBits(wifi_event_group_, SCAN_DONE_BIT);
+    sweep_active_ = true;
+    sweep_channels_ = channels;
+    sweep_stop_on_match_ = stop_on_match;
+    sweep_fallback_ = fallback;
+    sweep_scanned_ = false;
+    sweep_started_us_ = esp_timer_get_time();
+    
+    if (scanNextSweepChannel()) {
+        return true;
+    }
+    finishScanSweep();
+    return false;
+}
+
+bool WiFiManager::scanNextSweepChannel() {
+    if (sweep_channels_ == CHANNEL_MASK_ALL && !sweep_stop_on_match_) {
+        // One driver scan is cheaper than 13 single-channel ones
+        sweep_channels_ = 0;
+        wifi_scan_config_t scan_config = makeScanConfig(0);
+        esp_err_t err = esp_wifi_scan_start(&scan_config, false);
+        if (err == ESP_OK) {
+            return true;
+        }
+        ESP_LOGE(TAG, "Network scan failed: %s", esp_err_to_name(err));
+    }
+    
+    while (sweep_channels_ != 0) {
+        uint8_t channel = __builtin_ctz(sweep_channels_);
+        sweep_channels_ &= ~(1 << channel);
+        
+        wifi_scan_config_t scan_config = makeScanConfig(channel);
+        esp_err_t err = esp_wifi_scan_start(&scan_config, false);
+        if (err == ESP_OK) {
+            return true;
+        }
+        ESP_LOGE(TAG, "Scan on channel %d failed: %s", channel, esp_err_to_name(err));
+    }
+    
+    // Learned channels came up empty, the networks may have moved
+    if (sweep_fallback_ && !hasKnownNetworkCached()) {
+        sweep_fallback_ = false;
+        sweep_channels_ = CHANNEL_MASK_ALL;
+        return scanNextSweepChannel();
+    }
+    return false;
+}
+
+void WiFiManager::handleSweepScanDone() {
+    fetchScanResults();
+    sweep_scanned_ = true;
+    
+    if (sweep_stop_on_match_ && hasKnownNetworkCached()) {
+        sweep_channels_ = 0;
+        sweep_fallback_ = false;
+    }
+    if (!scanNextSweepChannel()) {
+        finishScanSweep();
+    }
+}
+
+void WiFiManager::finishScanSweep() {
+    sweep_active_ = false;
+    if (sweep_scanned_) {
+        recordPhase(metrics_.scan, sweep_started_us_);
+    }
+    xEventGroupSetBits(wifi_event_group_, SCAN_DONE_BIT);
+    
+    if (sweep_connect_) {
+        sweep_connect_ = false;
+        if (!selectBestNetwork()) {
+            xEventGroupSetBits(wifi_event_group_, WIFI_FAIL_BIT);
+        }
+    }
+}
+
+uint16_t WiFiManager::fetchScanResults() {
+    uint16_t count = MAX_SCAN_RECORDS;
+    std::unique_ptr<wifi_ap_record_t[]> records(new wifi_ap_record_t[MAX_SCAN_RECORDS]);
+    if (esp_wifi_scan_get_ap_records(&count, records.get()) != ESP_OK) {
+        return 0;
+    }
+    
+    if (!scan_cache_) {
+        scan_cache_.reset(new CachedAp[MAX_SCAN_RECORDS]);
+        scan_cache_count_ = 0;
+    }
+    
+    // Merge by BSSID, evicting the stalest entry when full
+    int64_t now = esp_timer_get_time();
+    for (uint16_t i = 0; i < count; i++) {
+        uint16_t slot = scan_cache_count_;
+        uint16_t stalest = 0;
+        for (uint16_t j = 0; j < scan_cache_count_; j++) {
+            if (memcmp(scan_cache_[j].ap.bssid, records[i].bssid, sizeof(records[i].bssid)) == 0) {
+                slot = j;
+                break;
+            }
+            if (scan_cache_[j].seen_at_us < scan_cache_[stalest].seen_at_us) {
+                stalest = j;
+            }
+        }
+        if (slot == MAX_SCAN_RECORDS) {
+            slot = stalest;
+        } else if (slot == scan_cache_count_) {
+            scan_cache_count_++;
+        }
+        scan_cache_[slot].ap = records[i];
+        scan_cache_[slot].seen_at_us = now;
+    }
+    scan_cache_at_us_ = now;
+    return count;
+}
+
+bool WiFiManager::isCacheEntryFresh(const CachedAp& entry) const {
+    return esp_timer_get_time() - entry.seen_at_us < (int64_t)scan_config_.cache_ttl_ms * 1000;
+}
+
+bool WiFiManager::isScanCacheFresh() const {
+    return scan_cache_ && scan_cache_count_ > 0 && scan_cache_at_us_ != 0 &&
+           esp_timer_get_time() - scan_cache_at_us_ < (int64_t)scan_config_.cache_ttl_ms * 1000;
+}
+
+bool WiFiManager::hasKnownNetworkCached() const {
+    for (uint16_t i = 0; scan_cache_ && i < scan_cache_count_; i++) {
+        const CachedAp& entry = scan_cache_[i];
+        if (!isCacheEntryFresh(entry)) {
+            continue;
+        }
+        const char* ssid = (const char*)entry.ap.ssid;
+        if (creds_.present && strcmp(ssid, creds_.ssid) == 0) {
+            return true;
+        }
+        for (uint8_t j = 0; j < networks_.count; j++) {
+            if (strcmp(ssid, networks_.entries[j].ssid) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+const wifi_ap_record_t* WiFiManager::bestCachedAp(const char* ssid, const uint8_t* exclude_bssid) const {
+    const wifi_ap_record_t* best = nullptr;
+    for (uint16_t i = 0; scan_cache_ && i < scan_cache_count_; i++) {
+        const CachedAp& entry = scan_cache_[i];
+        if (!isCacheEntryFresh(entry) || strcmp(ssid, (const char*)entry.ap.ssid) != 0) {
+            continue;
+        }
+        if (exclude_bssid && memcmp(exclude_bssid, entry.ap.bssid, sizeof(entry.ap.bssid)) == 0) {
+            continue;
+        }
+        if (!best || entry.ap.rssi > best->rssi) {
+            best = &entry.ap;
+        }
+    }
+    return best;
+}
+
+void WiFiManager::setLinkWatchdogConfig(const LinkWatchdogConfig& config) {
+    if (deferCommand()) {
+        runCommand([&] { setLinkWatchdogConfig(config); return true; });
+        return;
+    }
+    watchdog_config_ = config;
+    watchdog_config_.min_interval_ms = std::max<uint32_t>(watchdog_config_.min_interval_ms, 100);
+    watchdog_config_.max_interval_ms = std::max(watchdog_config_.max_interval_ms, watchdog_config_.min_interval_ms);
+    
+    // Settings are baked into the ping session, rebuild it on the next start
+    stopLinkWatchdog();
+    if (probe_session_) {
+        esp_ping_delete_session(probe_session_);
+        probe_session_ = nullptr;
+    }
+    
+    esp_netif_ip_info_t ip_info;
+    if (state_ == WiFiState::CONNECTED && esp_netif_get_ip_info(netif_sta_, &ip_info) == ESP_OK) {
+        startLinkWatchdog(ip_info.gw.addr);
+    }
+}
+
+WiFiManager::LinkWatchdogConfig WiFiManager::getLinkWatchdogConfig() const {
+    return snapshot(watchdog_config_);
+}
+
+void WiFiManager::startLinkWatchdog(uint32_t gateway) {
+    if (!watchdog_config_.enabled || gateway == 0) {
+        return;
+    }
+    
+    // The session (and its task) is kept across probes and only rebuilt when the gateway changes
+    if (probe_session_ && probe_gateway_ != gateway) {
+        esp_ping_delete_session(probe_session_);
+        probe_session_ = nullptr;
+    }
+    
+    if (!probe_session_) {
+        esp_ping_config_t ping_config = ESP_PING_DEFAULT_CONFIG();
+        ping_config.count = 1;
+        ping_config.timeout_ms = watchdog_config_.timeout_ms;
+        ping_config.data_size = 0;
+        ping_config.task_stack_size = 3072;
+        ping_config.interface = esp_netif_get_netif_impl_index(netif_sta_);
+        ip_addr_set_ip4_u32(&ping_config.target_addr, gateway);
+        
+        esp_ping_callbacks_t callbacks = {};
+        callbacks.cb_args = this;
+        callbacks.on_ping_success = &WiFiManager::probeSuccessCallback;
+        callbacks.on_ping_timeout = &WiFiManager::probeTimeoutCallback;
+        
+        if (esp_ping_new_session(&ping_config, &callbacks, &probe_session_) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create gateway probe session");
+            probe_session_ = nullptr;
+            return;
+        }
+        probe_gateway_ = gateway;
+    }
+    
+    if (!probe_timer_) {
+        esp_timer_create_args_t timer_args = {};
+        timer_args.callback = &WiFiManager::postTimerEvent<INTERNAL_PROBE_TIMER>;
+        timer_args.arg = this;
+        timer_args.name = "wifi_probe";
+        if (esp_timer_create(&timer_args, &probe_timer_) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create gateway probe timer");
+            probe_timer_ = nullptr;
+            return;
+        }
+    }
+    
+    probe_misses_ = 0;
+    probe_interval_ms_ = watchdog_config_.min_interval_ms;
+    esp_timer_stop(probe_timer_);
+    esp_timer_start_once(probe_timer_, (uint64_t)probe_interval_ms_ * 1000);
+}
+
+void WiFiManager::stopLinkWatchdog() {
+    if (probe_timer_) {
+        esp_timer_stop(probe_timer_);
+    }
+    if (probe_session_) {
+        esp_ping_stop(probe_session_);
+    }
+}
+
+void WiFiManager::probeTimerCallback(void* arg) {
+    WiFiManager* self = static_cast<WiFiManager*>(arg);
+    if (self->state_ != WiFiState::CONNECTED || !self->probe_session_) {
+        return;
+    }
+    esp_ping_start(self->probe_session_);
+}
+
+void WiFiManager::probeSuccessCallback(esp_ping_handle_t handle, void* arg) {
+    // Runs on the ping task, the RTT is read here and handled with the other events
+    uint32_t rtt_ms = 0;
+    esp_ping_get_profile(handle, ESP_PING_PROF_TIMEGAP, &rtt_ms, sizeof(rtt_ms));
+    static_cast<WiFiManager*>(arg)->postInternalEvent(INTERNAL_PROBE_SUCCESS, rtt_ms, 0);
+}
+
+void WiFiManager::probeTimeoutCallback(esp_ping_handle_t, void* arg) {
+    static_cast<WiFiManager*>(arg)->postInternalEvent(INTERNAL_PROBE_TIMEOUT, 0, 0);
+}
+
+void WiFiManager::handleProbeSuccess(uint32_t rtt_ms) {
+    recordSample(metrics_.probe_rtt, rtt_ms * 1000);
+    
+    // Healthy link, back off towards the slowest probe rate
+    probe_misses_ = 0;
+    probe_interval_ms_ = std::min(probe_interval_ms_ * 2, watchdog_config_.max_interval_ms);
+    if (state_ == WiFiState::CONNECTED) {
+        esp_timer_start_once(probe_timer_, (uint64_t)probe_interval_ms_ * 1000);
+    }
+}
+
+void WiFiManager::handleProbeTimeout() {
+    metrics_.probe_misses++;
+    probe_misses_++;
+    if (state_ != WiFiState::CONNECTED) {
+        return;
+    }
+    
+    if (probe_misses_ < watchdog_config_.max_misses) {
+        ESP_LOGD(TAG, "Gateway probe missed (%d/%d)", probe_misses_, watchdog_config_.max_misses);
+        probe_interval_ms_ = watchdog_config_.min_interval_ms;
+        esp_timer_start_once(probe_timer_, (uint64_t)probe_interval_ms_ * 1000);
+        return;
+    }
+    
+    esp_ip4_addr_t gateway = { probe_gateway_ };
+    ESP_LOGE(TAG, "Gateway " IPSTR " unreachable, reassociating", IP2STR(&gateway));
+    metrics_.link_failures++;
+    
+    // A cached lease may be what broke the link, get a fresh one next time
+    if (lease_applied_) {
+        lease_record_valid_ = false;
+        restoreDhcp();
+    }
+    
+    // The disconnect event goes through the reconnect scheduler
+    esp_wifi_disconnect();
+}
+
+WiFiManager::LinkEventLog WiFiManager::getLinkEvents() const {
+    return snapshot(link_events_);
+}
+
+void WiFiManager::recordLinkEvent(LinkEvent::Type type, uint8_t reason, int8_t rssi, 
+                                  const uint8_t* bssid) {
+    LinkEvent event = {};
+    event.timestamp_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    event.type = type;
+    event.reason = reason;
+    event.rssi = rssi;
+    event.channel = link_channel_;
+    memcpy(event.bssid, bssid, sizeof(event.bssid));
+    event.state = state_;
+    link_events_.push(event);
+}
+
+WiFiManager::LinkEventLog::LinkEventLog() : events_{}, head_(0), count_(0) {
+}
+
+void WiFiManager::LinkEventLog::push(const LinkEvent& event) {
+    events_[head_] = event;
+    head_ = (head_ + 1) % CAPACITY;
+    if (count_ < CAPACITY) {
+        count_++;
+    }
+}
+
+void WiFiManager::LinkEventLog::clear() {
+    head_ = 0;
+    count_ = 0;
+}
+
+size_t WiFiManager::LinkEventLog::size() const {
+    return count_;
+}
+
+const WiFiManager::LinkEvent& WiFiManager::LinkEventLog::operator[](size_t index) const {
+    return events_[(head_ + CAPACITY - count_ + index) % CAPACITY];
+}
+
+size_t WiFiManager::LinkEventLog::serialize(uint8_t* buf, size_t len) const {
+    if (!buf) {
+        return SERIALIZED_HEADER_SIZE + count_ * SERIALIZED_EVENT_SIZE;
+    }
+    if (len < SERIALIZED_HEADER_SIZE) {
+        return 0;
+    }
+    
+    size_t count = std::min(count_, (len - SERIALIZED_HEADER_SIZE) / SERIALIZED_EVENT_SIZE);
+    uint8_t* out = buf;
+    *out++ = SERIALIZED_VERSION;
+    *out++ = (uint8_t)count;
+    
+    for (size_t i = count_ - count; i < count_; i++) {
+        const LinkEvent& event = (*this)[i];
+        *out++ = (uint8_t)(event.timestamp_ms);
+        *out++ = (uint8_t)(event.timestamp_ms >> 8);
+        *out++ = (uint8_t)(event.timestamp_ms >> 16);
+        *out++ = (uint8_t)(event.timestamp_ms >> 24);
+        *out++ = (uint8_t)event.type;
+        *out++ = event.reason;
+        *out++ = (uint8_t)event.rssi;
+        *out++ = event.channel;
+        memcpy(out, event.bssid, sizeof(event.bssid));
+        out += sizeof(event.bssid);
+        *out++ = (uint8_t)event.state;
+    }
+    
+    return out - buf;
+}
+
+esp_err_t WiFiManager::startAssociation() {
+    assoc_started_at_us_ = esp_timer_get_time();
+    return esp_wifi_connect();
+}
+
+bool WiFiManager::isPassphrase(const char* password) {
+    // WPA passphrases are 8..63 characters, 64 characters is already a hex PSK
+    size_t len = strnlen(password, PMK_HEX_LEN);
+    return len >= 8 && len < PMK_HEX_LEN;
+}
+
+bool WiFiManager::derivePmk(const char* ssid, const char* passphrase, 
+                            char (&pmk_hex)[PMK_HEX_LEN + 1]) {
+    uint8_t pmk[PMK_LEN];
+    int ret = mbedtls_pkcs5_pbkdf2_hmac_ext(MBEDTLS_MD_SHA1,
+                                            (const unsigned char*)passphrase,
+                                            strlen(passphrase),
+                                            (const unsigned char*)ssid,
+                                            strnlen(ssid, MAX_SSID_LEN),
+                                            4096, PMK_LEN, pmk);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to derive PMK: %d", ret);
+        return false;
+    }
+    
+    for (size_t i = 0; i < PMK_LEN; i++) {
+        snprintf(&pmk_hex[i * 2], 3, "%02x", pmk[i]);
+    }
+    mbedtls_platform_zeroize(pmk, sizeof(pmk));
+    return true;
+}
+
+bool WiFiManager::prepareKey(const char* ssid, const char* password, 
+                             char (&key)[PMK_HEX_LEN + 1]) {
+    if (pmk_storage_enabled_ && isPassphrase(password)) {
+        return derivePmk(ssid, password, key);
+    }
+    size_t len = strnlen(password, PMK_HEX_LEN);
+    memcpy(key, password, len);
+    key[len] = '\0';
+    return true;
+}
+
+bool WiFiManager::saveCredentials(const char* ssid, const char* password) {
+    // Store the derived PMK in place of the passphrase if enabled
+    CredentialRecord record = {};
+    if (!prepareKey(ssid, password, record.key)) {
+        return false;
+    }
+    memcpy(record.ssid, ssid, strnlen(ssid, MAX_SSID_LEN));
+    
+    // New credentials for the same network keep its static address
+    if (loadCredentials() && strcmp(creds_.ssid, record.ssid) == 0) {
+        record.static_ip = creds_.static_ip;
+    }
+    return saveCredentialRecord(record);
+}
+
+bool WiFiManager::saveCredentialRecord(CredentialRecord& record) {
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(nvs_namespace_.c_str(), NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error opening NVS handle: %s", esp_err_to_name(err));
+        mbedtls_platform_zeroize(&record, sizeof(record));
+        return false;
+    }
+    
+    bool saved = writeCredentialRecord(nvs_handle, record);
+    nvs_close(nvs_handle);
+    if (saved) {
+        // Keep the credential cache in sync with what was written
+        memcpy(creds_.ssid, record.ssid, sizeof(creds_.ssid));
+        memcpy(creds_.key, record.key, sizeof(creds_.key));
+        creds_.static_ip = record.static_ip;
+        creds_.loaded = true;
+        creds_.present = true;
+        invalidateRtcContext();
+        ESP_LOGD(TAG, "WiFi credentials saved to NVS");
+    }
+    mbedtls_platform_zeroize(&record, sizeof(record));
+    return saved;
+}
+
+bool WiFiManager::writeCredentialRecord(nvs_handle_t nvs_handle, CredentialRecord& record) {
+    record.version = CREDENTIAL_VERSION;
+    record.reserved = 0;
+    record.crc = esp_rom_crc32_le(0, (const uint8_t*)&record, offsetof(CredentialRecord, crc));
+    
+    // A single blob write, NVS keeps the previous record until the new one is complete
+    esp_err_t err = nvs_set_blob(nvs_handle, NVS_KEY_CREDENTIALS, &record, sizeof(record));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error setting credentials in NVS: %s", esp_err_to_name(err));
+        return false;
+    }
+    
+    err = nvs_commit(nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error committing NVS changes: %s", esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+bool WiFiManager::loadCredentials() {
+    if (creds_.loaded) {
+        return creds_.present;
+    }
+    
+    int64_t start_us = esp_timer_get_time();
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(nvs_namespace_.c_str(), NVS_READONLY, &nvs_handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        // The namespace is created on the first save, nothing is stored yet
+        creds_.present = false;
+        creds_.loaded = true;
+        return false;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGD(TAG, "Error opening NVS handle: %s", esp_err_to_name(err));
+        return false;
+    }
+    
+    CredentialRecord record = {};
+    size_t len = sizeof(record);
+    err = nvs_get_blob(nvs_handle, NVS_KEY_CREDENTIALS, &record, &len);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        // Older firmware kept SSID and password under separate keys
+        bool found = loadLegacyCredentials(nvs_handle, record);
+        nvs_close(nvs_handle);
+        if (!found) {
+            creds_.loaded = true;
+            return false;
+        }
+        migrateLegacyCredentials(record);
+    } else {
+        nvs_close(nvs_handle);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Error getting credentials from NVS: %s", esp_err_to_name(err));
+            return false;
+        }
+        
+        // Version 1 records end before static_ip, those networks use DHCP
+        struct CredentialRecordV1 {
+            uint8_t version;
+            char ssid[MAX_SSID_LEN + 1];
+            char key[MAX_PASSWORD_LEN + 1];
+            uint8_t reserved;
+            uint32_t crc;
+        };
+        static_assert(sizeof(CredentialRecordV1) == 1 + (MAX_SSID_LEN + 1) + (MAX_PASSWORD_LEN + 1) + 1 + 4,
+                      "CredentialRecordV1 has implicit padding");
+        bool valid;
+        if (len == sizeof(CredentialRecordV1) && record.version == 1) {
+            CredentialRecordV1 legacy;
+            memcpy(&legacy, &record, sizeof(legacy));
+            valid = legacy.crc == esp_rom_crc32_le(0, (const uint8_t*)&legacy, 
+                                                   offsetof(CredentialRecordV1, crc));
+            memset(&record.static_ip, 0, sizeof(record.static_ip));
+            mbedtls_platform_zeroize(&legacy, sizeof(legacy));
+        } else {
+            valid = len == sizeof(record) && record.version == CREDENTIAL_VERSION &&
+                    record.crc == esp_rom_crc32_le(0, (const uint8_t*)&record, offsetof(CredentialRecord, crc));
+        }
+        if (!valid) {
+            ESP_LOGE(TAG, "Stored credentials are corrupted, ignoring them");
+            mbedtls_platform_zeroize(&record, sizeof(record));
+            creds_.loaded = true;
+            return false;
+        }
+    }
+    
+    record.ssid[sizeof(record.ssid) - 1] = '\0';
+    record.key[sizeof(record.key) - 1] = '\0';
+    memcpy(creds_.ssid, record.ssid, sizeof(creds_.ssid));
+    memcpy(creds_.key, record.key, sizeof(creds_.key));
+    creds_.static_ip = record.static_ip;
+    mbedtls_platform_zeroize(&record, sizeof(record));
+    creds_.loaded = true;
+    creds_.present = true;
+    
+    recordPhase(metrics_.nvs_load, start_us);
+    ESP_LOGD(TAG, "Credentials loaded from NVS in %" PRIu32 " us", metrics_.nvs_load.last_us);
+    return true;
+}
+
+bool WiFiManager::loadLegacyCredentials(nvs_handle_t nvs_handle, CredentialRecord& record) {
+    size_t ssid_len = sizeof(record.ssid);
+    esp_err_t err = nvs_get_str(nvs_handle, NVS_KEY_SSID, record.ssid, &ssid_len);
+    if (err != ESP_OK) {
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGD(TAG, "SSID not found in NVS");
+        } else {
+            ESP_LOGE(TAG, "Error getting SSID from NVS: %s", esp_err_to_name(err));
+        }
+        return false;
+    }
+    
+    size_t key_len = sizeof(record.key);
+    err = nvs_get_str(nvs_handle, NVS_KEY_PASSWORD, record.key, &key_len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error getting password from NVS: %s", esp_err_to_name(err));
+        mbedtls_platform_zeroize(&record, sizeof(record));
+        return false;
+    }
+    return true;
+}
+
+void WiFiManager::migrateLegacyCredentials(CredentialRecord& record) {
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(nvs_namespace_.c_str(), NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error opening NVS handle: %s", esp_err_to_name(err));
+        return;
+    }
+    
+    // Write the new record first so a power loss never leaves no credentials
+    if (writeCredentialRecord(nvs_handle, record)) {
+        nvs_erase_key(nvs_handle, NVS_KEY_SSID);
+        nvs_erase_key(nvs_handle, NVS_KEY_PASSWORD);
+        if (nvs_commit(nvs_handle) == ESP_OK) {
+            ESP_LOGD(TAG, "Credentials migrated to single-record layout");
+        }
+    }
+    nvs_close(nvs_handle);
+}
+
+bool WiFiManager::loadNetworks() {
+    if (networks_loaded_) {
+        return true;
+    }
+    
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(nvs_namespace_.c_str(), NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK) {
+        return false;
+    }
+    
+    size_t len = sizeof(networks_);
+    err = nvs_get_blob(nvs_handle, NVS_KEY_NETWORKS, &networks_, &len);
+    nvs_close(nvs_handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        memset(&networks_, 0, sizeof(networks_));
+        networks_.version = NETWORK_STORE_VERSION;
+        networks_loaded_ = true;
+        return true;
+    }
+    
+    // Version 1 profiles had no static_ip, widen them in place (rewritten on the next save)
+    struct NetworkProfileV1 {
+        char ssid[MAX_SSID_LEN + 1];
+        char key[PMK_HEX_LEN + 1];
+        uint8_t priority;
+        uint8_t channel;
+        uint8_t bssid[6];
+        int64_t last_success;
+    };
+    struct NetworkStoreV1 {
+        uint8_t version;
+        uint8_t count;
+        NetworkProfileV1 entries[MAX_NETWORKS];
+    };
+    if (err == ESP_OK && len == sizeof(NetworkStoreV1) && networks_.version == 1 && 
+        networks_.count <= MAX_NETWORKS) {
+        const NetworkStoreV1* legacy = reinterpret_cast<const NetworkStoreV1*>(&networks_);
+        for (int i = networks_.count - 1; i >= 0; i--) {
+            NetworkProfile profile = {};
+            memcpy(&profile, &legacy->entries[i], sizeof(NetworkProfileV1));
+            networks_.entries[i] = profile;
+            mbedtls_platform_zeroize(&profile, sizeof(profile));
+        }
+        networks_.version = NETWORK_STORE_VERSION;
+        len = sizeof(networks_);
+    }
+    if (err != ESP_OK || len != sizeof(networks_) || 
+        networks_.version != NETWORK_STORE_VERSION || networks_.count > MAX_NETWORKS) {
+        ESP_LOGE(TAG, "Invalid network store in NVS, ignoring it");
+        memset(&networks_, 0, sizeof(networks_));
+        networks_.version = NETWORK_STORE_VERSION;
+        return false;
+    }
+    
+    networks_loaded_ = true;
+    return true;
+}
+
+bool WiFiManager::saveNetworks() {
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(nvs_namespace_.c_str(), NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error opening NVS handle: %s", esp_err_to_name(err));
+        return false;
+    }
+    
+    networks_.version = NETWORK_STORE_VERSION;
+    err = nvs_set_blob(nvs_handle, NVS_KEY_NETWORKS, &networks_, sizeof(networks_));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error setting network store in NVS: %s", esp_err_to_name(err));
+        nvs_close(nvs_handle);
+        return false;
+    }
+    
+    err = nvs_commit(nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error committing NVS changes: %s", esp_err_to_name(err));
+        nvs_close(nvs_handle);
+        return false;
+    }
+    
+    nvs_close(nvs_handle);
+    ESP_LOGD(TAG, "Network store saved to NVS (%d entries)", networks_.count);
+    return true;
+}
+
+void WiFiManager::updateNetworkHistory() {
+    if (!networks_loaded_) {
+        return;
+    }
+    
+    wifi_ap_record_t ap_info;
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        return;
+    }
+    
+    for (uint8_t i = 0; i < networks_.count; i++) {
+        NetworkProfile& profile = networks_.entries[i];
+        if (strcmp(current_ssid_, profile.ssid) != 0) {
+            continue;
+        }
+        
+        // Limit flash writes to AP changes and stale timestamps
+        int64_t now = (int64_t)time(nullptr);
+        bool changed = memcmp(profile.bssid, ap_info.bssid, sizeof(profile.bssid)) != 0 ||
+                       profile.channel != ap_info.primary ||
+                       now < profile.last_success || now - profile.last_success > HISTORY_UPDATE_S;
+        if (changed) {
+            memcpy(profile.bssid, ap_info.bssid, sizeof(profile.bssid));
+            profile.channel = ap_info.primary;
+            profile.last_success = now;
+            saveNetworks();
+        }
+        return;
+    }
+}
+
+bool WiFiManager::loadFastConnectRecord(const char* ssid) {
+    if (!fast_record_valid_) {
+        nvs_handle_t nvs_handle;
+        esp_err_t err = nvs_open(nvs_namespace_.c_str(), NVS_READONLY, &nvs_handle);
+        if (err != ESP_OK) {
+            return false;
+        }
+        
+        size_t len = sizeof(fast_record_);
+        err = nvs_get_blob(nvs_handle, NVS_KEY_FAST_CONNECT, &fast_record_, &len);
+        nvs_close(nvs_handle);
+        if (err != ESP_OK || len != sizeof(fast_record_) || 
+            fast_record_.version != FAST_CONNECT_VERSION) {
+            ESP_LOGD(TAG, "No valid fast-connect record in NVS");
+            return false;
+        }
+        fast_record_.ssid[sizeof(fast_record_.ssid) - 1] = '\0';
+        fast_record_valid_ = true;
+    }
+    
+    return strncmp(ssid, fast_record_.ssid, sizeof(fast_record_.ssid)) == 0;
+}
+
+bool WiFiManager::saveFastConnectRecord() {
+    wifi_ap_record_t ap_info;
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        ESP_LOGD(TAG, "Failed to get AP info for fast-connect record");
+        return false;
+    }
+    
+    FastConnectRecord record = {};
+    record.version = FAST_CONNECT_VERSION;
+    record.channel = ap_info.primary;
+    record.authmode = (uint8_t)ap_info.authmode;
+    memcpy(record.bssid, ap_info.bssid, sizeof(record.bssid));
+    snprintf(record.ssid, sizeof(record.ssid), "%s", current_ssid_);
+    
+    // Skip the flash write if nothing changed since the last association
+    if (fast_record_valid_ && memcmp(&record, &fast_record_, sizeof(record)) == 0) {
+        return true;
+    }
+    
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(nvs_namespace_.c_str(), NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error opening NVS handle: %s", esp_err_to_name(err));
+        return false;
+    }
+    
+    err = nvs_set_blob(nvs_handle, NVS_KEY_FAST_CONNECT, &record, sizeof(record));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error setting fast-connect record in NVS: %s", esp_err_to_name(err));
+        nvs_close(nvs_handle);
+        return false;
+    }
+    
+    err = nvs_commit(nvs_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error committing NVS changes: %s", esp_err_to_name(err));
+        nvs_close(nvs_handle);
+        return false;
+    }
+    
     nvs_close(nvs_handle);
-    ESP_LOGD(TAG, "WiFi credentials cleared from NVS");
+    fast_record_ = record;
+    fast_record_valid_ = true;
+    ESP_LOGD(TAG, "Fast-connect record saved to NVS");
     return true;
 }
 
-WiFiManager::WiFiState WiFiManager::getState() const {
-    return state_;
-}
-
-std::string WiFiManager::getSSID() const {
-    if (state_ != WiFiState::CONNECTED) {
-        return "";
+void WiFiManager::fallbackToFullScan() {
+    fast_connect_pending_ = false;
+    
+    wifi_config_t wifi_config;
+    if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to get STA config for full scan fallback");
+        return;
     }
-    return current_ssid_;
+    
+    wifi_config.sta.bssid_set = false;
+    memset(wifi_config.sta.bssid, 0, sizeof(wifi_config.sta.bssid));
+    wifi_config.sta.channel = 0;
+    wifi_config.sta.threshold.authmode = WIFI_AUTH_OPEN;
+    wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    
+    // The cached lease belongs to the cached AP, let DHCP run for whatever we find
+    restoreDhcp();
+    
+    ESP_LOGD(TAG, "Directed connect failed, falling back to full scan");
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    startAssociation();
 }
 
-std::string WiFiManager::getIPAddress() const {
-    if (state_ != WiFiState::CONNECTED) {
-        return "";
+bool WiFiManager::loadLeaseRecord() {
+    if (lease_record_valid_) {
+        return true;
     }
     
-    esp_netif_ip_info_t ip_info;
-    if (esp_netif_get_ip_info(netif_sta_, &ip_info) != ESP_OK) {
-        return "";
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(nvs_namespace_.c_str(), NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK) {
+        return false;
     }
     
-    char ip_addr[16];
-    snprintf(ip_addr, sizeof(ip_addr), IPSTR, IP2STR(&ip_info.ip));
-    return std::string(ip_addr);
+    size_t len = sizeof(lease_record_);
+    err = nvs_get_blob(nvs_handle, NVS_KEY_LEASE, &lease_record_, &len);
+    nvs_close(nvs_handle);
+    if (err != ESP_OK || len != sizeof(lease_record_) || 
+        lease_record_.version != LEASE_VERSION) {
+        ESP_LOGD(TAG, "No valid DHCP lease in NVS");
+        return false;
+    }
+    
+    lease_record_valid_ = true;
+    return true;
 }
 
-bool WiFiManager::saveCredentials(const std::string& ssid, const std::string& password) {
-    nvs_handle_t nvs_handle;
-    esp_err_t err = nvs_open(nvs_namespace_.c_str(), NVS_READWRITE, &nvs_handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error opening NVS handle: %s", esp_err_to_name(err));
+bool WiFiManager::saveLeaseRecord(const esp_netif_ip_info_t& ip_info, const uint8_t* bssid) {
+    // Lease time as granted by the DHCP server
+    struct netif* lwip_netif = (struct netif*)esp_netif_get_netif_impl(netif_sta_);
+    struct dhcp* dhcp = lwip_netif ? netif_dhcp_data(lwip_netif) : nullptr;
+    if (!dhcp || dhcp->offered_t0_lease == 0) {
+        ESP_LOGD(TAG, "No DHCP lease time available, not caching lease");
         return false;
     }
     
-    err = nvs_set_str(nvs_handle, NVS_KEY_SSID, ssid.c_str());
+    LeaseRecord record = {};
+    record.version = LEASE_VERSION;
+    memcpy(record.bssid, bssid, sizeof(record.bssid));
+    record.ip = ip_info.ip.addr;
+    record.netmask = ip_info.netmask.addr;
+    record.gw = ip_info.gw.addr;
+    for (int i = 0; i < 2; i++) {
+        esp_netif_dns_info_t dns = {};
+        esp_netif_dns_type_t type = i == 0 ? ESP_NETIF_DNS_MAIN : ESP_NETIF_DNS_BACKUP;
+        if (esp_netif_get_dns_info(netif_sta_, type, &dns) == ESP_OK) {
+            record.dns[i] = dns.ip.u_addr.ip4.addr;
+        }
+    }
+    record.acquired_at = (int64_t)time(nullptr);
+    record.lease_s = dhcp->offered_t0_lease;
+    record.session = bootSession();
+    
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(nvs_namespace_.c_str(), NVS_READWRITE, &nvs_handle);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error setting SSID in NVS: %s", esp_err_to_name(err));
-        nvs_close(nvs_handle);
+        ESP_LOGE(TAG, "Error opening NVS handle: %s", esp_err_to_name(err));
         return false;
     }
     
-    err = nvs_set_str(nvs_handle, NVS_KEY_PASSWORD, password.c_str());
+    err = nvs_set_blob(nvs_handle, NVS_KEY_LEASE, &record, sizeof(record));
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error setting password in NVS: %s", esp_err_to_name(err));
+        ESP_LOGE(TAG, "Error setting DHCP lease in NVS: %s", esp_err_to_name(err));
         nvs_close(nvs_handle);
         return false;
     }
@@ -392,89 +3203,607 @@ bool WiFiManager::saveCredentials(const std::string& ssid, const std::string& pa
     }
     
     nvs_close(nvs_handle);
-    ESP_LOGD(TAG, "WiFi credentials saved to NVS");
+    lease_record_ = record;
+    lease_record_valid_ = true;
+    ESP_LOGD(TAG, "DHCP lease cached, valid for %" PRIu32 " s", record.lease_s);
     return true;
 }
 
-bool WiFiManager::loadCredentials(std::string& ssid, std::string& password) {
-    nvs_handle_t nvs_handle;
-    esp_err_t err = nvs_open(nvs_namespace_.c_str(), NVS_READONLY, &nvs_handle);
-    if (err != ESP_OK) {
-        ESP_LOGD(TAG, "Error opening NVS handle: %s", esp_err_to_name(err));
+bool WiFiManager::applyCachedLease(const uint8_t* bssid) {
+    if (!loadLeaseRecord() || memcmp(lease_record_.bssid, bssid, sizeof(lease_record_.bssid)) != 0) {
         return false;
     }
     
-    size_t ssid_len = 0;
-    err = nvs_get_str(nvs_handle, NVS_KEY_SSID, NULL, &ssid_len);
-    if (err != ESP_OK) {
-        ESP_LOGD(TAG, "SSID not found in NVS");
-        nvs_close(nvs_handle);
+    // The system time restarts after a power cycle, the elapsed time is unknown then
+    if (lease_record_.session != bootSession()) {
+        ESP_LOGD(TAG, "Cached DHCP lease is from another boot session");
         return false;
     }
     
-    char* ssid_buf = new char[ssid_len];
-    err = nvs_get_str(nvs_handle, NVS_KEY_SSID, ssid_buf, &ssid_len);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error getting SSID from NVS: %s", esp_err_to_name(err));
-        delete[] ssid_buf;
-        nvs_close(nvs_handle);
+    // Only reuse the lease until its renewal time (T1 = half the lease). A clock
+    // that went backwards (e.g. set by SNTP) leaves the elapsed time unknown.
+    int64_t now = (int64_t)time(nullptr);
+    int64_t renew_at = lease_record_.acquired_at + lease_record_.lease_s / 2 - LEASE_MARGIN_S;
+    if (now < lease_record_.acquired_at || now >= renew_at) {
+        ESP_LOGD(TAG, "Cached DHCP lease expired");
         return false;
     }
     
-    size_t pass_len = 0;
-    err = nvs_get_str(nvs_handle, NVS_KEY_PASSWORD, NULL, &pass_len);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Password not found in NVS");
-        delete[] ssid_buf;
-        nvs_close(nvs_handle);
+    esp_err_t err = esp_netif_dhcpc_stop(netif_sta_);
+    if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED) {
+        ESP_LOGE(TAG, "Failed to stop DHCP client: %s", esp_err_to_name(err));
         return false;
     }
     
-    char* pass_buf = new char[pass_len];
-    err = nvs_get_str(nvs_handle, NVS_KEY_PASSWORD, pass_buf, &pass_len);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error getting password from NVS: %s", esp_err_to_name(err));
-        delete[] ssid_buf;
-        delete[] pass_buf;
-        nvs_close(nvs_handle);
+    esp_netif_ip_info_t ip_info = {};
+    ip_info.ip.addr = lease_record_.ip;
+    ip_info.netmask.addr = lease_record_.netmask;
+    ip_info.gw.addr = lease_record_.gw;
+    if (esp_netif_set_ip_info(netif_sta_, &ip_info) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to apply cached DHCP lease");
+        esp_netif_dhcpc_start(netif_sta_);
+        return false;
+    }
+    
+    for (int i = 0; i < 2; i++) {
+        if (lease_record_.dns[i] == 0) {
+            continue;
+        }
+        esp_netif_dns_info_t dns = {};
+        dns.ip.type = ESP_IPADDR_TYPE_V4;
+        dns.ip.u_addr.ip4.addr = lease_record_.dns[i];
+        esp_netif_set_dns_info(netif_sta_, i == 0 ? ESP_NETIF_DNS_MAIN : ESP_NETIF_DNS_BACKUP, &dns);
+    }
+    
+    // Hand the address back to the DHCP client when the lease needs renewing
+    if (!lease_renew_timer_) {
+        esp_timer_create_args_t timer_args = {};
+        timer_args.callback = &WiFiManager::postTimerEvent<INTERNAL_LEASE_RENEW_TIMER>;
+        timer_args.arg = this;
+        timer_args.name = "wifi_lease";
+        if (esp_timer_create(&timer_args, &lease_renew_timer_) != ESP_OK) {
+            lease_renew_timer_ = nullptr;
+        }
+    }
+    if (lease_renew_timer_) {
+        esp_timer_stop(lease_renew_timer_);
+        esp_timer_start_once(lease_renew_timer_, (uint64_t)(renew_at - now) * 1000000ULL);
+    }
+    
+    lease_applied_ = true;
+    ESP_LOGD(TAG, "Reusing cached DHCP lease " IPSTR, IP2STR(&ip_info.ip));
+    return true;
+}
+
+void WiFiManager::restoreDhcp() {
+    if (!lease_applied_) {
+        return;
+    }
+    
+    lease_applied_ = false;
+    if (lease_renew_timer_) {
+        esp_timer_stop(lease_renew_timer_);
+    }
+    
+    esp_err_t err = esp_netif_dhcpc_start(netif_sta_);
+    if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED) {
+        ESP_LOGE(TAG, "Failed to restart DHCP client: %s", esp_err_to_name(err));
+    }
+}
+
+bool WiFiManager::applyStaticIp(const StaticIpConfig& config) {
+    if (config.ip.addr == 0) {
+        // Networks without a static address get the DHCP client back
+        if (static_ip_applied_) {
+            static_ip_applied_ = false;
+            static_ip_ = {};
+            esp_err_t err = esp_netif_dhcpc_start(netif_sta_);
+            if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED) {
+                ESP_LOGE(TAG, "Failed to restart DHCP client: %s", esp_err_to_name(err));
+            }
+        }
         return false;
     }
     
-    ssid = std::string(ssid_buf);
-    password = std::string(pass_buf);
+    // A lease cached for the previous network does not apply anymore
+    if (lease_applied_) {
+        lease_applied_ = false;
+        if (lease_renew_timer_) {
+            esp_timer_stop(lease_renew_timer_);
+        }
+    }
     
-    delete[] ssid_buf;
-    delete[] pass_buf;
-    nvs_close(nvs_handle);
+    esp_err_t err = esp_netif_dhcpc_stop(netif_sta_);
+    if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED) {
+        ESP_LOGE(TAG, "Failed to stop DHCP client: %s", esp_err_to_name(err));
+        return false;
+    }
+    
+    esp_netif_ip_info_t ip_info = {};
+    ip_info.ip = config.ip;
+    ip_info.netmask = config.netmask;
+    ip_info.gw = config.gw;
+    if (esp_netif_set_ip_info(netif_sta_, &ip_info) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to apply static IP");
+        esp_netif_dhcpc_start(netif_sta_);
+        return false;
+    }
+    
+    for (int i = 0; i < 2; i++) {
+        if (config.dns[i].addr == 0) {
+            continue;
+        }
+        esp_netif_dns_info_t dns = {};
+        dns.ip.type = ESP_IPADDR_TYPE_V4;
+        dns.ip.u_addr.ip4 = config.dns[i];
+        esp_netif_set_dns_info(netif_sta_, i == 0 ? ESP_NETIF_DNS_MAIN : ESP_NETIF_DNS_BACKUP, &dns);
+    }
+    
+    static_ip_ = config;
+    static_ip_applied_ = true;
+    ESP_LOGD(TAG, "Using static IP " IPSTR, IP2STR(&ip_info.ip));
+    return true;
+}
+
+bool WiFiManager::findStaticIp(const char* ssid, StaticIpConfig* config) {
+    if (loadCredentials() && strcmp(creds_.ssid, ssid) == 0) {
+        *config = creds_.static_ip;
+        return true;
+    }
+    if (loadNetworks()) {
+        for (uint8_t i = 0; i < networks_.count; i++) {
+            if (strcmp(networks_.entries[i].ssid, ssid) == 0) {
+                *config = networks_.entries[i].static_ip;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool WiFiManager::storeStaticIp(const char* ssid, const StaticIpConfig& config) {
+    // The network can be in both the primary record and the store, update both
+    bool found = false;
+    bool saved = true;
+    if (loadCredentials() && strcmp(creds_.ssid, ssid) == 0) {
+        CredentialRecord record = {};
+        memcpy(record.ssid, creds_.ssid, sizeof(record.ssid));
+        memcpy(record.key, creds_.key, sizeof(record.key));
+        record.static_ip = config;
+        found = true;
+        saved = saveCredentialRecord(record);
+    }
+    if (loadNetworks()) {
+        for (uint8_t i = 0; i < networks_.count; i++) {
+            if (strcmp(networks_.entries[i].ssid, ssid) == 0) {
+                networks_.entries[i].static_ip = config;
+                found = true;
+                saved = saveNetworks() && saved;
+                break;
+            }
+        }
+    }
+    
+    if (!found) {
+        ESP_LOGE(TAG, "Network %s is not stored", ssid);
+    }
+    return found && saved;
+}
+
+bool WiFiManager::setStaticIp(const std::string& ssid, const StaticIpConfig& config) {
+    RUN_ON_EVENT_TASK(setStaticIp(ssid, config));
+    if (config.ip.addr != 0 && config.netmask.addr == 0) {
+        ESP_LOGE(TAG, "Static IP needs a netmask");
+        return false;
+    }
+    return storeStaticIp(ssid.c_str(), config);
+}
+
+bool WiFiManager::getStaticIp(const std::string& ssid, StaticIpConfig* config) {
+    RUN_ON_EVENT_TASK(getStaticIp(ssid, config));
+    StaticIpConfig found = {};
+    if (!findStaticIp(ssid.c_str(), &found) || found.ip.addr == 0) {
+        return false;
+    }
+    if (config) {
+        *config = found;
+    }
+    return true;
+}
+
+bool WiFiManager::addHostEntry(const char* hostname, esp_ip4_addr_t addr) {
+    RUN_ON_EVENT_TASK(addHostEntry(hostname, addr));
+    if (!hostname || hostname[0] == '\0' || strlen(hostname) > MAX_HOSTNAME_LEN) {
+        ESP_LOGE(TAG, "Invalid hostname");
+        return false;
+    }
     
+    for (uint8_t i = 0; i < host_count_; i++) {
+        if (strcasecmp(hosts_[i].name, hostname) == 0) {
+            beginHostsWrite();
+            hosts_[i].addr = addr;
+            endHostsWrite();
+            return true;
+        }
+    }
+    if (host_count_ >= BI_WIFI_MAX_HOST_ENTRIES) {
+        ESP_LOGE(TAG, "Host table full, %d entries", BI_WIFI_MAX_HOST_ENTRIES);
+        return false;
+    }
+    
+    beginHostsWrite();
+    HostEntry& entry = hosts_[host_count_++];
+    strncpy(entry.name, hostname, sizeof(entry.name) - 1);
+    entry.name[sizeof(entry.name) - 1] = '\0';
+    entry.addr = addr;
+    endHostsWrite();
+    return true;
+}
+
+bool WiFiManager::removeHostEntry(const char* hostname) {
+    RUN_ON_EVENT_TASK(removeHostEntry(hostname));
+    for (uint8_t i = 0; i < host_count_; i++) {
+        if (strcasecmp(hosts_[i].name, hostname) == 0) {
+            beginHostsWrite();
+            hosts_[i] = hosts_[host_count_ - 1];
+            hosts_[--host_count_] = {};
+            endHostsWrite();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WiFiManager::resolveHost(const char* hostname, esp_ip4_addr_t* addr) {
+    if (!hostname || !addr) {
+        return false;
+    }
+    
+    // Sequence lock like getSSID(), copy the table and retry if it changed meanwhile
+    HostEntry hosts[BI_WIFI_MAX_HOST_ENTRIES];
+    uint8_t count;
+    uint32_t seq;
+    do {
+        seq = hosts_seq_.load(std::memory_order_acquire);
+        count = std::min<uint8_t>(host_count_, BI_WIFI_MAX_HOST_ENTRIES);
+        memcpy(hosts, hosts_, sizeof(hosts));
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) != 0 || seq != hosts_seq_.load(std::memory_order_relaxed));
+    
+    for (uint8_t i = 0; i < count; i++) {
+        hosts[i].name[MAX_HOSTNAME_LEN] = '\0';
+        if (strcasecmp(hosts[i].name, hostname) == 0) {
+            *addr = hosts[i].addr;
+            return true;
+        }
+    }
+    
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(hostname, nullptr, &hints, &result) != 0 || !result) {
+        ESP_LOGD(TAG, "Failed to resolve %s", hostname);
+        return false;
+    }
+    addr->addr = ((struct sockaddr_in*)result->ai_addr)->sin_addr.s_addr;
+    freeaddrinfo(result);
     return true;
 }
 
+void WiFiManager::beginHostsWrite() {
+    hosts_seq_.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void WiFiManager::endHostsWrite() {
+    hosts_seq_.fetch_add(1, std::memory_order_release);
+}
+
+void WiFiManager::leaseRenewTimerCallback(void* arg) {
+    WiFiManager* self = static_cast<WiFiManager*>(arg);
+    ESP_LOGD(TAG, "Cached DHCP lease reached renewal time, restarting DHCP");
+    self->restoreDhcp();
+}
+
+uint32_t WiFiManager::rtcContextCrc() {
+    return esp_rom_crc32_le(0, (const uint8_t*)&rtc_context_, offsetof(RtcContext, crc));
+}
+
+bool WiFiManager::isRtcContextValid() {
+    return rtc_context_.magic == RTC_CONTEXT_MAGIC && rtc_context_.crc == rtcContextCrc();
+}
+
+void WiFiManager::saveRtcContext() {
+    // Take the key from the driver, it holds the PMK if PMK storage is enabled
+    wifi_config_t wifi_config;
+    if (!fast_record_valid_ || esp_wifi_get_config(WIFI_IF_STA, &wifi_config) != ESP_OK) {
+        invalidateRtcContext();
+        return;
+    }
+    
+    memset(&rtc_context_, 0, sizeof(rtc_context_));
+    rtc_context_.magic = RTC_CONTEXT_MAGIC;
+    rtc_context_.fast = fast_record_;
+    rtc_context_.lease_valid = lease_cache_enabled_ && lease_record_valid_;
+    if (rtc_context_.lease_valid) {
+        rtc_context_.lease = lease_record_;
+    }
+    if (static_ip_applied_) {
+        rtc_context_.static_ip = static_ip_;
+    }
+    memcpy(rtc_context_.key, wifi_config.sta.password, sizeof(wifi_config.sta.password));
+    rtc_context_.crc = rtcContextCrc();
+}
+
+uint32_t WiFiManager::bootSession() {
+    // Checked once per boot, RTC_NOINIT memory holds random data after power-on
+    static bool checked = false;
+    if (!checked) {
+        esp_reset_reason_t reason = esp_reset_reason();
+        if (reason == ESP_RST_POWERON || reason == ESP_RST_BROWNOUT ||
+            rtc_session_.check != ~rtc_session_.id) {
+            rtc_session_.id = esp_random();
+            rtc_session_.check = ~rtc_session_.id;
+        }
+        checked = true;
+    }
+    return rtc_session_.id;
+}
+
+void WiFiManager::invalidateRtcContext() {
+    mbedtls_platform_zeroize(&rtc_context_, sizeof(rtc_context_));
+}
+
+EventBits_t WiFiManager::stateBit(WiFiState state) {
+    return (EventBits_t)1 << (STATE_BITS_SHIFT + (int)state);
+}
+
 void WiFiManager::updateState(WiFiState new_state) {
-    if (state_ != new_state) {
-        state_ = new_state;
+    // Keep the state bits in sync for waitForAny()/waitForConnected()
+    if (wifi_event_group_) {
+        EventBits_t clear = STATE_BITS_MASK & ~stateBit(new_state);
+        if (new_state != WiFiState::CONNECTED) {
+            clear |= WIFI_CONNECTED_BIT;
+        }
+        xEventGroupClearBits(wifi_event_group_, clear);
+        xEventGroupSetBits(wifi_event_group_, stateBit(new_state));
+    }
+    
+    if (state_.exchange(new_state) != new_state) {
+        reportState(new_state);
+    }
+}
+
+bool WiFiManager::isDownState(WiFiState state) {
+    return state == WiFiState::CONNECTING || state == WiFiState::DISCONNECTED;
+}
+
+void WiFiManager::reportState(WiFiState state) {
+    if (!notify_config_.enabled) {
+        deliverState(state);
+        return;
+    }
+    
+    pending_changes_++;
+    if (!isDownState(state)) {
+        // Up, provisioning and error go out right away, a drop shorter than the dwell is hidden
+        if (notify_timer_) {
+            esp_timer_stop(notify_timer_);
+        }
+        if (state == reported_state_) {
+            pending_changes_ = 0;
+            down_since_us_ = 0;
+            return;
+        }
+        deliverState(state);
+        return;
+    }
+    
+    if (down_since_us_ == 0) {
+        down_since_us_ = esp_timer_get_time();
+        down_reconnects_base_ = metrics_.reconnects;
+    }
+    
+    // Already reported down, CONNECTING <-> DISCONNECTED flapping is folded
+    if (isDownState(reported_state_)) {
+        return;
+    }
+    if (notify_config_.disconnect_dwell_ms == 0) {
+        deliverState(state);
+        return;
+    }
+    
+    if (!notify_timer_) {
+        esp_timer_create_args_t timer_args = {};
+        timer_args.callback = &WiFiManager::postTimerEvent<INTERNAL_NOTIFY_TIMER>;
+        timer_args.arg = this;
+        timer_args.name = "wifi_notify";
+        if (esp_timer_create(&timer_args, &notify_timer_) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create notify timer, reporting now");
+            notify_timer_ = nullptr;
+            deliverState(state);
+            return;
+        }
+    }
+    
+    // Fails harmlessly if the dwell already started with an earlier down state
+    esp_timer_start_once(notify_timer_, (uint64_t)notify_config_.disconnect_dwell_ms * 1000);
+}
+
+void WiFiManager::deliverState(WiFiState state) {
+    Notification notification = {};
+    notification.type = EventType::STATE_CHANGED;
+    if (notify_config_.enabled) {
+        if (down_since_us_ != 0) {
+            notification.summary.down_ms = (uint32_t)((esp_timer_get_time() - down_since_us_) / 1000);
+            notification.summary.reconnects = (uint16_t)std::min<uint32_t>(
+                metrics_.reconnects - down_reconnects_base_, UINT16_MAX);
+        }
+        notification.summary.merged = pending_changes_ > 0 ? pending_changes_ - 1 : 0;
+        notification.summary.last_reason = last_disconnect_reason_;
+        pending_changes_ = 0;
+        
+        // The outage ends when an up state is reported, a down report keeps it running
+        if (!isDownState(state)) {
+            down_since_us_ = 0;
+        }
+    }
+    
+    reported_state_ = state;
+    if (connection_callback_) {
+        connection_callback_(state, user_data_);
+    }
+    notifyObservers(notification);
+}
+
+void WiFiManager::handleNotifyTimer() {
+    WiFiState state = state_;
+    if (notify_config_.enabled && isDownState(state) && !isDownState(reported_state_)) {
+        ESP_LOGD(TAG, "Link down for %" PRIu32 " ms, reporting it", notify_config_.disconnect_dwell_ms);
+        deliverState(state);
+    }
+}
+
+void WiFiManager::setNotifyConfig(const NotifyConfig& config) {
+    if (deferCommand()) {
+        runCommand([&] { setNotifyConfig(config); return true; });
+        return;
+    }
+    
+    notify_config_ = config;
+    if (!config.enabled) {
+        if (notify_timer_) {
+            esp_timer_stop(notify_timer_);
+        }
+        down_since_us_ = 0;
+        pending_changes_ = 0;
         
-        if (connection_callback_) {
-            connection_callback_(state_, user_data_);
+        // Report the state that was being held back
+        if (state_ != reported_state_) {
+            deliverState(state_);
         }
     }
 }
 
+WiFiManager::NotifyConfig WiFiManager::getNotifyConfig() const {
+    return snapshot(notify_config_);
+}
+
 void WiFiManager::eventHandler(void* arg, esp_event_base_t event_base,
                               int32_t event_id, void* event_data) {
     WiFiManager* self = static_cast<WiFiManager*>(arg);
     
+    // Remember the event loop task, commands from it run inline
+    TaskHandle_t current = xTaskGetCurrentTaskHandle();
+    if (current != self->worker_task_) {
+        self->event_task_.store(current, std::memory_order_relaxed);
+    }
+    
+    // Stop requests are handled on the event loop task, which feeds the worker
+    if (event_base == BI_WIFI_INTERNAL_EVENT && event_id == INTERNAL_WORKER_STOP) {
+        const InternalEvent* event = (const InternalEvent*) event_data;
+        if (event && event->target == self && current != self->worker_task_) {
+            self->joinWorker();
+        }
+        return;
+    }
+    
+    // Hand the event over to the worker task if it is running
+    if (self->postToWorker(event_base, event_id, event_data)) {
+        return;
+    }
+    
+    if (event_base == BI_WIFI_INTERNAL_EVENT) {
+        const InternalEvent* event = (const InternalEvent*) event_data;
+        if (event && event->target == self) {
+            self->handleInternalEvent(event_id, *event);
+        }
+        return;
+    }
+    
     if (event_base == WIFI_EVENT) {
         if (event_id == WIFI_EVENT_STA_START) {
             ESP_LOGD(TAG, "WiFi station started");
+        } else if (event_id == WIFI_EVENT_SCAN_DONE) {
+            if (self->roam_scan_active_) {
+                self->handleRoamScanDone();
+            } else if (self->sweep_active_) {
+                self->handleSweepScanDone();
+            }
+        } else if (event_id == WIFI_EVENT_STA_CONNECTED) {
+            wifi_event_sta_connected_t* event = (wifi_event_sta_connected_t*) event_data;
+            ESP_LOGD(TAG, "WiFi associated to " MACSTR " on channel %d", 
+                    MAC2STR(event->bssid), event->channel);
+            self->recordPhase(self->metrics_.assoc, self->assoc_started_at_us_);
+            self->assoc_started_at_us_ = 0;
+            self->sta_connected_at_us_ = esp_timer_get_time();
+            
+            wifi_ap_record_t ap_info;
+            int8_t rssi = esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK ? ap_info.rssi : 0;
+            self->link_channel_ = event->channel;
+            self->roam_pending_ = false;
+            self->roam_attempt_ = false;
+            self->auth_failures_ = 0;
+            self->recordLinkEvent(LinkEvent::Type::CONNECTED, 0, rssi, event->bssid);
+            
+            // The cached lease is only valid on the AP it was obtained from
+            if (self->lease_applied_ && 
+                memcmp(event->bssid, self->lease_record_.bssid, sizeof(event->bssid)) != 0) {
+                self->restoreDhcp();
+            }
         } else if (event_id == WIFI_EVENT_STA_DISCONNECTED) {
-            ESP_LOGD(TAG, "WiFi disconnected");
+            wifi_event_sta_disconnected_t* event = (wifi_event_sta_disconnected_t*) event_data;
+            ESP_LOGD(TAG, "WiFi disconnected, reason: %d", event->reason);
+            self->last_disconnect_reason_ = event->reason;
+            self->metrics_.disconnects++;
+            self->metrics_.disconnect_reasons[disconnectReasonIndex(event->reason)]++;
+            self->recordLinkEvent(LinkEvent::Type::DISCONNECTED, event->reason, event->rssi, event->bssid);
+            self->stopLinkWatchdog();
+            self->ip_addr_.store(0, std::memory_order_relaxed);
+            
+            // Only the first disconnect after a roam decision can be the leave from the old AP
+            bool roam_pending = self->roam_pending_;
+            self->roam_pending_ = false;
+            
+            Notification notification = {};
+            notification.type = EventType::DISCONNECTED;
+            notification.disconnect.reason = event->reason;
+            notification.disconnect.rssi = event->rssi;
+            self->notifyObservers(notification);
+            
+            // The provisioning manager retries and reports WIFI_PROV_CRED_FAIL itself
+            if (self->provisioning_active_) {
+                return;
+            }
+            
+            // Roaming: our own disconnect from the old AP, join the new one
+            if (roam_pending && event->reason == WIFI_REASON_ASSOC_LEAVE) {
+                // No IP until the new AP hands one out, waiters must not see a link
+                self->updateState(WiFiState::CONNECTING);
+                self->startAssociation();
+                return;
+            }
+            
+            // Roam target did not work, let the driver pick any AP of the network
+            if (self->roam_attempt_) {
+                self->roam_attempt_ = false;
+                self->fallbackToFullScan();
+                return;
+            }
+            
+            // Cached BSSID/channel did not work, retry once with a full scan
+            if (self->fast_connect_pending_ && self->state_ == WiFiState::CONNECTING &&
+                event->reason != WIFI_REASON_ASSOC_LEAVE) {
+                self->fast_connect_stats_.fallbacks++;
+                self->fallbackToFullScan();
+                return;
+            }
             
             // Retry connection if we were connected before
             if (self->state_ == WiFiState::CONNECTED || self->state_ == WiFiState::CONNECTING) {
-                ESP_LOGD(TAG, "Trying to reconnect...");
-                esp_wifi_connect();
-                self->updateState(WiFiState::CONNECTING);
+                if (self->scheduleReconnect(event->reason)) {
+                    self->updateState(WiFiState::CONNECTING);
+                }
             } else {
                 self->updateState(WiFiState::DISCONNECTED);
                 xEventGroupSetBits(self->wifi_event_group_, WIFI_FAIL_BIT);
@@ -492,30 +3821,88 @@ void WiFiManager::eventHandler(void* arg, esp_event_base_t event_base,
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGD(TAG, "WiFi connected with IP Address:" IPSTR, 
                 IP2STR(&event->ip_info.ip));
+        self->ip_addr_.store(event->ip_info.ip.addr, std::memory_order_relaxed);
+        self->recordConnectedFootprint();
+        
+        if (self->sta_connected_at_us_ != 0) {
+            self->recordPhase(self->metrics_.dhcp, self->sta_connected_at_us_);
+            self->sta_connected_at_us_ = 0;
+            ESP_LOGD(TAG, "IP acquired in %" PRIu32 " ms", self->getIpAcquisitionTimeMs());
+        }
+        
+        // Cache a freshly obtained DHCP lease for the next connection
+        if (self->lease_cache_enabled_ && !self->lease_applied_ && !self->static_ip_applied_) {
+            wifi_ap_record_t ap_info;
+            if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK) {
+                self->saveLeaseRecord(event->ip_info, ap_info.bssid);
+            }
+        }
+        
+        self->cancelReconnect();
+        self->reconnect_attempts_ = 0;
+        
+        if (self->fast_connect_pending_) {
+            self->fast_connect_pending_ = false;
+            self->fast_connect_stats_.hits++;
+        }
+        if (self->fast_connect_enabled_) {
+            self->saveFastConnectRecord();
+            self->saveRtcContext();
+        }
+        self->updateNetworkHistory();
         
         self->updateState(WiFiState::CONNECTED);
         xEventGroupSetBits(self->wifi_event_group_, WIFI_CONNECTED_BIT);
+        self->startLinkWatchdog(event->ip_info.gw.addr);
+        
+        Notification notification = {};
+        notification.type = EventType::GOT_IP;
+        notification.ip_info = event->ip_info;
+        self->notifyObservers(notification);
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_LOST_IP) {
+        ESP_LOGD(TAG, "WiFi lost IP address");
+        self->ip_addr_.store(0, std::memory_order_relaxed);
+        
+        Notification notification = {};
+        notification.type = EventType::LOST_IP;
+        self->notifyObservers(notification);
     }
 }
 
+#if CONFIG_BI_WIFI_PROVISIONING
 void WiFiManager::provisioningEventHandler(void* arg, esp_event_base_t event_base,
                                           int32_t event_id, void* event_data) {
     WiFiManager* self = static_cast<WiFiManager*>(arg);
     
+    // Hand the event over to the worker task if it is running
+    if (self->postToWorker(event_base, event_id, event_data)) {
+        return;
+    }
+    
     if (event_base == WIFI_PROV_EVENT) {
         switch (event_id) {
             case WIFI_PROV_START:
                 ESP_LOGD(self->TAG, "Provisioning started");
+                self->recordPhase(self->metrics_.provisioning_start, self->prov_started_at_us_);
+                self->prov_phase_at_us_ = esp_timer_get_time();
                 break;
             case WIFI_PROV_CRED_RECV: {
+                self->recordPhase(self->metrics_.provisioning_creds, self->prov_phase_at_us_);
+                self->prov_phase_at_us_ = esp_timer_get_time();
+                
+                // Full-length SSIDs and passwords are not NUL-terminated
                 wifi_sta_config_t* wifi_sta_cfg = (wifi_sta_config_t*)event_data;
+                memcpy(self->prov_ssid_, wifi_sta_cfg->ssid, MAX_SSID_LEN);
+                self->prov_ssid_[MAX_SSID_LEN] = '\0';
+                memcpy(self->prov_password_, wifi_sta_cfg->password, MAX_PASSWORD_LEN);
+                self->prov_password_[MAX_PASSWORD_LEN] = '\0';
                 ESP_LOGD(self->TAG, "Received WiFi credentials:");
-                ESP_LOGD(self->TAG, "SSID: %s", (const char*)wifi_sta_cfg->ssid);
-                ESP_LOGD(self->TAG, "Password: %s", (const char*)wifi_sta_cfg->password);
+                ESP_LOGD(self->TAG, "SSID: %s", self->prov_ssid_);
+                ESP_LOGD(self->TAG, "Password: %s", self->prov_password_);
                 
-                // Save credentials to NVS
-                self->saveCredentials((const char*)wifi_sta_cfg->ssid, 
-                                     (const char*)wifi_sta_cfg->password);
+                // The manager is already associating with this config, keep it as-is
+                self->setCurrentSsid(self->prov_ssid_);
+                self->assoc_started_at_us_ = esp_timer_get_time();
                 break;
             }
             case WIFI_PROV_CRED_FAIL: {
@@ -525,29 +3912,38 @@ void WiFiManager::provisioningEventHandler(void* arg, esp_event_base_t event_bas
             }
             case WIFI_PROV_CRED_SUCCESS:
                 ESP_LOGD(self->TAG, "Provisioning successful");
+                self->persistProvisionedCredentials();
                 break;
             case WIFI_PROV_END:
                 {
                 ESP_LOGD(self->TAG, "Provisioning ended");
+                self->recordPhase(self->metrics_.provisioning_end, self->prov_phase_at_us_);
+                self->prov_phase_at_us_ = 0;
                 
-                // Deinitialize provisioning
-                wifi_prov_mgr_deinit();
-                self->provisioning_active_ = false;
+                // Release everything provisioning used and drop back to STA only
+                self->teardownProvisioning();
                 
-                // Connect with the new credentials
                 xEventGroupSetBits(self->wifi_event_group_, PROVISIONING_DONE);
                 
-                std::string ssid, password;
-                if (self->loadCredentials(ssid, password)) {
-                    self->connect(ssid, password, false);
+                // The link the manager tested is normally up already, nothing to redo
+                if (self->state_ == WiFiState::CONNECTED) {
+                    ESP_LOGD(self->TAG, "Already connected with the provisioned credentials");
+                } else if (self->prov_ssid_[0] != '\0') {
+                    // WIFI_PROV_CRED_SUCCESS already handed them to the persist task
+                    self->connectInternal(self->prov_ssid_, self->prov_password_, false);
+                } else if (self->loadCredentials()) {
+                    self->connectInternal(self->creds_.ssid, self->creds_.key, false);
                 } else {
                     self->updateState(WiFiState::ERROR);
                     ESP_LOGE(self->TAG, "Failed to load credentials after provisioning");
                 }
+                mbedtls_platform_zeroize(self->prov_ssid_, sizeof(self->prov_ssid_));
+                mbedtls_platform_zeroize(self->prov_password_, sizeof(self->prov_password_));
                 break;
                 }
             default:
                 break;
         }
     }
-}
\ No newline at end of file
+}
+#endif
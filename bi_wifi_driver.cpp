@@ -0,0 +1,257 @@
+/**
+ * bi_wifi_driver.cpp
+ * Reference-counted WiFi driver core shared by the STA, SoftAP and ESP-NOW roles
+ */
+
+#include "bi_wifi_driver.hpp"
+#include "esp_event.h"
+#include "esp_log.h"
+
+WiFiDriver& WiFiDriver::instance() {
+    static WiFiDriver driver;
+    return driver;
+}
+
+WiFiDriver::WiFiDriver()
+    : mutex_(nullptr),
+      refs_{},
+      started_(false),
+      owns_driver_(false),
+      base_mode_(WIFI_MODE_NULL),
+      netif_sta_(nullptr),
+      netif_ap_(nullptr),
+      owns_netif_sta_(false),
+      owns_netif_ap_(false) {
+    mutex_ = xSemaphoreCreateMutexStatic(&mutex_buffer_);
+}
+
+bool WiFiDriver::acquire(Role role) {
+    wifi_init_config_t config = WIFI_INIT_CONFIG_DEFAULT();
+    return acquire(role, config);
+}
+
+bool WiFiDriver::acquire(Role role, const wifi_init_config_t& config) {
+    size_t index = static_cast<size_t>(role);
+    if (index >= static_cast<size_t>(Role::COUNT)) {
+        return false;
+    }
+
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+
+    // The SoftAP has a single configuration, so it has a single owner
+    if ((role == Role::AP && refs_[index] > 0) || refs_[index] == UINT8_MAX) {
+        ESP_LOGE(TAG, "Role %u is already held", (unsigned)index);
+        xSemaphoreGive(mutex_);
+        return false;
+    }
+
+    if (!started_) {
+        prepareStack();
+    }
+
+    refs_[index]++;
+    bool ok = (refs_[index] > 1 || createNetif(role)) &&
+              (started_ ? applyMode() : startCore(config));
+    if (!ok) {
+        refs_[index]--;
+        if (refs_[index] == 0) {
+            destroyNetif(role);
+        }
+    }
+
+    xSemaphoreGive(mutex_);
+    return ok;
+}
+
+void WiFiDriver::release(Role role) {
+    size_t index = static_cast<size_t>(role);
+    if (index >= static_cast<size_t>(Role::COUNT)) {
+        return;
+    }
+
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+
+    if (refs_[index] == 0) {
+        ESP_LOGE(TAG, "Role %u released without a reference", (unsigned)index);
+        xSemaphoreGive(mutex_);
+        return;
+    }
+
+    refs_[index]--;
+
+    bool held = false;
+    for (uint8_t refs : refs_) {
+        held = held || refs > 0;
+    }
+
+    // Leave the interface before its netif goes away
+    if (held) {
+        applyMode();
+    } else {
+        stopCore();
+    }
+    if (refs_[index] == 0) {
+        destroyNetif(role);
+    }
+
+    xSemaphoreGive(mutex_);
+}
+
+uint8_t WiFiDriver::getRefCount(Role role) const {
+    size_t index = static_cast<size_t>(role);
+    if (index >= static_cast<size_t>(Role::COUNT)) {
+        return 0;
+    }
+
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    uint8_t refs = refs_[index];
+    xSemaphoreGive(mutex_);
+    return refs;
+}
+
+bool WiFiDriver::isStarted() const {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    bool started = started_;
+    xSemaphoreGive(mutex_);
+    return started;
+}
+
+esp_netif_t* WiFiDriver::getStaNetif() const {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    esp_netif_t* netif = netif_sta_;
+    xSemaphoreGive(mutex_);
+    return netif;
+}
+
+esp_netif_t* WiFiDriver::getApNetif() const {
+    xSemaphoreTake(mutex_, portMAX_DELAY);
+    esp_netif_t* netif = netif_ap_;
+    xSemaphoreGive(mutex_);
+    return netif;
+}
+
+void WiFiDriver::prepareStack() {
+    // Both may already have been done by the application or another component
+    esp_err_t err = esp_netif_init();
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to init esp_netif: %s", esp_err_to_name(err));
+    }
+
+    err = esp_event_loop_create_default();
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to create default event loop: %s", esp_err_to_name(err));
+    }
+}
+
+bool WiFiDriver::startCore(const wifi_init_config_t& config) {
+    // esp_wifi_get_mode() only succeeds once the driver is initialized
+    wifi_mode_t mode = WIFI_MODE_NULL;
+    if (esp_wifi_get_mode(&mode) == ESP_OK) {
+        ESP_LOGD(TAG, "Reusing the WiFi driver initialized by another component");
+        owns_driver_ = false;
+        base_mode_ = mode;
+    } else {
+        esp_err_t err = esp_wifi_init(&config);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to init WiFi driver: %s", esp_err_to_name(err));
+            return false;
+        }
+        owns_driver_ = true;
+        base_mode_ = WIFI_MODE_NULL;
+    }
+    started_ = true;
+
+    if (!applyMode()) {
+        stopCore();
+        return false;
+    }
+
+    // Returns ESP_OK as well when the other component already started it
+    esp_err_t err = esp_wifi_start();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start WiFi driver: %s", esp_err_to_name(err));
+        stopCore();
+        return false;
+    }
+
+    ESP_LOGD(TAG, "WiFi driver started");
+    return true;
+}
+
+void WiFiDriver::stopCore() {
+    if (!started_) {
+        return;
+    }
+    started_ = false;
+
+    if (!owns_driver_) {
+        // Give the other component its mode back
+        esp_wifi_set_mode(base_mode_);
+        return;
+    }
+
+    esp_wifi_stop();
+    esp_wifi_deinit();
+    ESP_LOGD(TAG, "WiFi driver stopped");
+}
+
+bool WiFiDriver::createNetif(Role role) {
+    if (role == Role::ESPNOW) {
+        return true;
+    }
+
+    bool sta = (role == Role::STA);
+    esp_netif_t*& netif = sta ? netif_sta_ : netif_ap_;
+    bool& owned = sta ? owns_netif_sta_ : owns_netif_ap_;
+
+    // A second default netif for the same interface would fail, reuse it instead
+    netif = esp_netif_get_handle_from_ifkey(sta ? "WIFI_STA_DEF" : "WIFI_AP_DEF");
+    owned = (netif == nullptr);
+    if (owned) {
+        netif = sta ? esp_netif_create_default_wifi_sta() : esp_netif_create_default_wifi_ap();
+    }
+    if (netif == nullptr) {
+        ESP_LOGE(TAG, "Failed to create default %s netif", sta ? "STA" : "AP");
+        owned = false;
+        return false;
+    }
+    return true;
+}
+
+void WiFiDriver::destroyNetif(Role role) {
+    if (role == Role::ESPNOW) {
+        return;
+    }
+
+    bool sta = (role == Role::STA);
+    esp_netif_t*& netif = sta ? netif_sta_ : netif_ap_;
+    bool& owned = sta ? owns_netif_sta_ : owns_netif_ap_;
+
+    if (netif && owned) {
+        esp_netif_destroy_default_wifi(netif);
+    }
+    netif = nullptr;
+    owned = false;
+}
+
+bool WiFiDriver::applyMode() {
+    int mode = base_mode_;
+    if (refs_[static_cast<size_t>(Role::STA)] > 0 || refs_[static_cast<size_t>(Role::ESPNOW)] > 0) {
+        mode |= WIFI_MODE_STA;
+    }
+    if (refs_[static_cast<size_t>(Role::AP)] > 0) {
+        mode |= WIFI_MODE_AP;
+    }
+
+    wifi_mode_t current = WIFI_MODE_NULL;
+    if (esp_wifi_get_mode(&current) == ESP_OK && current == static_cast<wifi_mode_t>(mode)) {
+        return true;
+    }
+
+    esp_err_t err = esp_wifi_set_mode(static_cast<wifi_mode_t>(mode));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set WiFi mode %d: %s", mode, esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,143 @@
+/**
+ * bi_wifi_espnow.cpp
+ * ESP-NOW side channel on the shared WiFi driver core
+ */
+
+#include "bi_wifi_espnow.hpp"
+#include <cstring>
+#include "esp_log.h"
+#include "esp_mac.h"
+
+std::atomic<EspNowChannel*> EspNowChannel::active_{nullptr};
+
+EspNowChannel::EspNowChannel()
+    : callback_(nullptr),
+      user_data_(nullptr),
+      running_(false),
+      send_failures_(0) {
+}
+
+EspNowChannel::~EspNowChannel() {
+    end();
+}
+
+bool EspNowChannel::begin(ReceiveCallback callback, void* user_data) {
+    if (running_) {
+        ESP_LOGE(TAG, "ESP-NOW already running");
+        return false;
+    }
+
+    EspNowChannel* expected = nullptr;
+    if (!active_.compare_exchange_strong(expected, this)) {
+        ESP_LOGE(TAG, "ESP-NOW is in use by another channel");
+        return false;
+    }
+
+    WiFiDriver& driver = WiFiDriver::instance();
+    if (!driver.acquire(WiFiDriver::Role::ESPNOW)) {
+        active_ = nullptr;
+        return false;
+    }
+
+    esp_err_t err = esp_now_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to init ESP-NOW: %s", esp_err_to_name(err));
+        driver.release(WiFiDriver::Role::ESPNOW);
+        active_ = nullptr;
+        return false;
+    }
+
+    callback_ = callback;
+    user_data_ = user_data;
+    send_failures_ = 0;
+    esp_now_register_send_cb(&EspNowChannel::sendCallback);
+    esp_now_register_recv_cb(&EspNowChannel::receiveCallback);
+
+    running_ = true;
+    ESP_LOGD(TAG, "ESP-NOW started");
+    return true;
+}
+
+void EspNowChannel::end() {
+    if (!running_) {
+        return;
+    }
+
+    esp_now_unregister_recv_cb();
+    esp_now_unregister_send_cb();
+    esp_now_deinit();
+    WiFiDriver::instance().release(WiFiDriver::Role::ESPNOW);
+
+    running_ = false;
+    callback_ = nullptr;
+    user_data_ = nullptr;
+    active_ = nullptr;
+    ESP_LOGD(TAG, "ESP-NOW stopped");
+}
+
+bool EspNowChannel::isRunning() const {
+    return running_;
+}
+
+bool EspNowChannel::addPeer(const uint8_t* mac, const uint8_t* lmk) {
+    if (!running_ || !mac) {
+        return false;
+    }
+
+    esp_now_peer_info_t peer = {};
+    memcpy(peer.peer_addr, mac, ESP_NOW_ETH_ALEN);
+    peer.channel = 0;  // Current station channel
+    peer.ifidx = WIFI_IF_STA;
+    peer.encrypt = (lmk != nullptr);
+    if (lmk) {
+        memcpy(peer.lmk, lmk, ESP_NOW_KEY_LEN);
+    }
+
+    esp_err_t err = esp_now_is_peer_exist(mac) ? esp_now_mod_peer(&peer) : esp_now_add_peer(&peer);
+    memset(&peer, 0, sizeof(peer));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to add peer " MACSTR ": %s", MAC2STR(mac), esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+bool EspNowChannel::removePeer(const uint8_t* mac) {
+    if (!running_ || !mac) {
+        return false;
+    }
+    return esp_now_del_peer(mac) == ESP_OK;
+}
+
+bool EspNowChannel::send(const uint8_t* mac, const uint8_t* data, size_t len) {
+    if (!running_ || !data || len == 0 || len > ESP_NOW_MAX_DATA_LEN) {
+        ESP_LOGE(TAG, "Invalid frame of %d bytes", (int)len);
+        return false;
+    }
+
+    esp_err_t err = esp_now_send(mac, data, len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send frame: %s", esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+
+uint32_t EspNowChannel::getSendFailures() const {
+    return send_failures_;
+}
+
+void EspNowChannel::receiveCallback(const esp_now_recv_info_t* info, const uint8_t* data, int len) {
+    EspNowChannel* self = active_;
+    if (self && self->callback_ && info && len > 0) {
+        self->callback_(info->src_addr, data, (size_t)len, self->user_data_);
+    }
+}
+
+void EspNowChannel::sendCallback(const uint8_t* mac, esp_now_send_status_t status) {
+    EspNowChannel* self = active_;
+    (void)mac;
+    if (self && status != ESP_NOW_SEND_SUCCESS) {
+        self->send_failures_++;
+    }
+}
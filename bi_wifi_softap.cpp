@@ -0,0 +1,142 @@
+/**
+ * bi_wifi_softap.cpp
+ * SoftAP service on the shared WiFi driver core
+ */
+
+#include "bi_wifi_softap.hpp"
+#include <cstring>
+#include "esp_log.h"
+#include "esp_mac.h"
+
+SoftApService::SoftApService()
+    : running_(false),
+      station_count_(0),
+      connected_handler_(nullptr),
+      disconnected_handler_(nullptr) {
+}
+
+SoftApService::~SoftApService() {
+    stop();
+}
+
+bool SoftApService::start(const std::string& ssid, const std::string& password, uint8_t channel,
+                          uint8_t max_connections, bool hidden) {
+    if (running_) {
+        ESP_LOGE(TAG, "SoftAP already running");
+        return false;
+    }
+    if (ssid.empty() || ssid.length() > sizeof(wifi_ap_config_t::ssid)) {
+        ESP_LOGE(TAG, "Invalid SSID length: %d", (int)ssid.length());
+        return false;
+    }
+    if (!password.empty() && (password.length() < 8 || password.length() >= sizeof(wifi_ap_config_t::password))) {
+        ESP_LOGE(TAG, "Invalid password length: %d", (int)password.length());
+        return false;
+    }
+    if (channel > 13 || max_connections == 0 || max_connections > MAX_CONNECTIONS) {
+        ESP_LOGE(TAG, "Invalid channel %u or station limit %u", channel, max_connections);
+        return false;
+    }
+
+    WiFiDriver& driver = WiFiDriver::instance();
+    if (!driver.acquire(WiFiDriver::Role::AP)) {
+        ESP_LOGE(TAG, "AP interface not available");
+        return false;
+    }
+
+    if (channel == 0) {
+        wifi_ap_record_t ap_info;
+        channel = (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK) ? ap_info.primary : 1;
+    }
+
+    wifi_config_t config = {};
+    memcpy(config.ap.ssid, ssid.data(), ssid.length());
+    config.ap.ssid_len = ssid.length();
+    memcpy(config.ap.password, password.data(), password.length());
+    config.ap.authmode = password.empty() ? WIFI_AUTH_OPEN : WIFI_AUTH_WPA2_PSK;
+    config.ap.channel = channel;
+    config.ap.max_connection = max_connections;
+    config.ap.ssid_hidden = hidden ? 1 : 0;
+
+    esp_err_t err = esp_wifi_set_config(WIFI_IF_AP, &config);
+    memset(&config, 0, sizeof(config));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set SoftAP config: %s", esp_err_to_name(err));
+        driver.release(WiFiDriver::Role::AP);
+        return false;
+    }
+
+    station_count_ = 0;
+    err = esp_event_handler_instance_register(WIFI_EVENT,
+                                              WIFI_EVENT_AP_STACONNECTED,
+                                              &SoftApService::eventHandler,
+                                              this,
+                                              &connected_handler_);
+    if (err == ESP_OK) {
+        err = esp_event_handler_instance_register(WIFI_EVENT,
+                                                  WIFI_EVENT_AP_STADISCONNECTED,
+                                                  &SoftApService::eventHandler,
+                                                  this,
+                                                  &disconnected_handler_);
+        if (err != ESP_OK) {
+            esp_event_handler_instance_unregister(WIFI_EVENT, WIFI_EVENT_AP_STACONNECTED, connected_handler_);
+        }
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register station handlers: %s", esp_err_to_name(err));
+        connected_handler_ = nullptr;
+        disconnected_handler_ = nullptr;
+        driver.release(WiFiDriver::Role::AP);
+        return false;
+    }
+
+    running_ = true;
+    ESP_LOGD(TAG, "SoftAP %s started on channel %u", ssid.c_str(), channel);
+    return true;
+}
+
+void SoftApService::stop() {
+    if (!running_) {
+        return;
+    }
+
+    esp_event_handler_instance_unregister(WIFI_EVENT, WIFI_EVENT_AP_STACONNECTED, connected_handler_);
+    esp_event_handler_instance_unregister(WIFI_EVENT, WIFI_EVENT_AP_STADISCONNECTED, disconnected_handler_);
+    connected_handler_ = nullptr;
+    disconnected_handler_ = nullptr;
+
+    WiFiDriver::instance().release(WiFiDriver::Role::AP);
+    running_ = false;
+    station_count_ = 0;
+    ESP_LOGD(TAG, "SoftAP stopped");
+}
+
+bool SoftApService::isRunning() const {
+    return running_;
+}
+
+uint8_t SoftApService::getStationCount() const {
+    return station_count_;
+}
+
+esp_netif_t* SoftApService::getNetif() const {
+    return running_ ? WiFiDriver::instance().getApNetif() : nullptr;
+}
+
+void SoftApService::eventHandler(void* arg, esp_event_base_t event_base,
+                                 int32_t event_id, void* event_data) {
+    SoftApService* self = static_cast<SoftApService*>(arg);
+    (void)event_base;
+
+    if (event_id == WIFI_EVENT_AP_STACONNECTED) {
+        wifi_event_ap_staconnected_t* event = static_cast<wifi_event_ap_staconnected_t*>(event_data);
+        self->station_count_++;
+        ESP_LOGD(TAG, "Station " MACSTR " joined, aid %u", MAC2STR(event->mac), event->aid);
+    } else if (event_id == WIFI_EVENT_AP_STADISCONNECTED) {
+        wifi_event_ap_stadisconnected_t* event = static_cast<wifi_event_ap_stadisconnected_t*>(event_data);
+        if (self->station_count_ > 0) {
+            self->station_count_--;
+        }
+        ESP_LOGD(TAG, "Station " MACSTR " left, aid %u", MAC2STR(event->mac), event->aid);
+    }
+}
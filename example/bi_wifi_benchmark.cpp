@@ -0,0 +1,399 @@
+/**
+ * bi_wifi_benchmark.cpp
+ * Banco de pruebas de bi_wifi en el dispositivo para ESP32-C3
+ *
+ * Recorre, en este orden, arranque en frío, reconexión en caliente,
+ * reanudación tras deep sleep y arranque del provisioning. El arranque en
+ * frío y el deep sleep necesitan reiniciar el chip, así que el progreso se
+ * guarda en memoria RTC que sobrevive a esp_restart(). Al final mide el
+ * rendimiento TCP y UDP contra un servidor iperf con cada perfil de energía.
+ *
+ * Los resultados salen por la consola como líneas "BENCH {json}", una por
+ * escenario, para que el banco de pruebas del CI compare compilaciones.
+ * Servidor: iperf -s -p 5001 (TCP) e iperf -s -u -p 5001 (UDP).
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <algorithm>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_app_desc.h"
+#include "esp_log.h"
+#include "esp_wifi.h"
+#include "lwip/sockets.h"
+
+#include "bi_wifi.hpp"
+
+static const char *TAG = "bi_wifi_bench";
+
+// Parámetros del banco de pruebas, se pueden redefinir al compilar
+#ifndef BENCH_ITERATIONS
+#define BENCH_ITERATIONS 10
+#endif
+#ifndef BENCH_SERVER_IP
+#define BENCH_SERVER_IP "192.168.1.100"
+#endif
+#ifndef BENCH_SERVER_PORT
+#define BENCH_SERVER_PORT 5001
+#endif
+#ifndef BENCH_THROUGHPUT_SECONDS
+#define BENCH_THROUGHPUT_SECONDS 10
+#endif
+#ifndef BENCH_SLEEP_US
+#define BENCH_SLEEP_US 2000000
+#endif
+#ifndef BENCH_CONNECT_TIMEOUT_MS
+#define BENCH_CONNECT_TIMEOUT_MS 30000
+#endif
+
+// Con BENCH_WIFI_SSID definido, el primer arranque guarda estas credenciales
+// en NVS; si no, se usan las que ya estén provisionadas
+
+enum BenchScenario : uint32_t {
+    SCENARIO_COLD_BOOT,
+    SCENARIO_WARM_RECONNECT,
+    SCENARIO_DEEP_SLEEP,
+    SCENARIO_PROVISIONING,
+    SCENARIO_COUNT
+};
+
+// Fases del banco de pruebas, los escenarios van primero
+static const uint32_t PHASE_THROUGHPUT = SCENARIO_COUNT;
+static const uint32_t PHASE_DONE = SCENARIO_COUNT + 1;
+
+static const char* const SCENARIO_NAMES[SCENARIO_COUNT] = {
+    "cold_boot", "warm_reconnect", "deep_sleep_resume", "provisioning_start"
+};
+
+// Muestras de un escenario
+struct ScenarioResult {
+    uint32_t time_to_ip_ms[BENCH_ITERATIONS];  // Hasta la IP (o hasta WIFI_PROV_START)
+    uint32_t radio_on_ms[BENCH_ITERATIONS];    // Desde el arranque de la radio hasta la IP
+    uint32_t count;
+    uint32_t failures;
+    uint32_t heap_min_free;                    // Mínimo de heap libre visto
+};
+
+// Estado del banco de pruebas, sobrevive a esp_restart() y al deep sleep
+struct BenchState {
+    uint32_t magic;
+    uint32_t phase;
+    ScenarioResult results[SCENARIO_COUNT];
+};
+
+static const uint32_t BENCH_MAGIC = 0xBE7C4001;
+static RTC_NOINIT_ATTR BenchState s_bench;
+
+// Buffer de envío de las pruebas de rendimiento, fuera de la pila
+static uint8_t s_tx_buf[1460];
+
+static void resetBenchState() {
+    memset(&s_bench, 0, sizeof(s_bench));
+    s_bench.magic = BENCH_MAGIC;
+    s_bench.phase = SCENARIO_COLD_BOOT;
+    for (ScenarioResult& result : s_bench.results) {
+        result.heap_min_free = UINT32_MAX;
+    }
+}
+
+static uint32_t elapsedMs(int64_t since_us) {
+    return (uint32_t)((esp_timer_get_time() - since_us) / 1000);
+}
+
+static void recordSample(BenchScenario scenario, bool ok, uint32_t time_to_ip_ms, uint32_t radio_on_ms) {
+    ScenarioResult& result = s_bench.results[scenario];
+    if (!ok) {
+        result.failures++;
+    } else if (result.count < BENCH_ITERATIONS) {
+        result.time_to_ip_ms[result.count] = time_to_ip_ms;
+        result.radio_on_ms[result.count] = radio_on_ms;
+        result.count++;
+    }
+    result.heap_min_free = std::min<uint32_t>(result.heap_min_free, esp_get_minimum_free_heap_size());
+    ESP_LOGI(TAG, "%s %" PRIu32 "/%d: %s, %" PRIu32 " ms", SCENARIO_NAMES[scenario],
+             result.count + result.failures, BENCH_ITERATIONS, ok ? "ok" : "fallo", time_to_ip_ms);
+}
+
+static bool scenarioDone(BenchScenario scenario) {
+    const ScenarioResult& result = s_bench.results[scenario];
+    return result.count + result.failures >= BENCH_ITERATIONS;
+}
+
+static uint32_t percentile(const uint32_t* samples, uint32_t count, uint32_t pct) {
+    if (count == 0) {
+        return 0;
+    }
+    uint32_t sorted[BENCH_ITERATIONS];
+    memcpy(sorted, samples, count * sizeof(uint32_t));
+    std::sort(sorted, sorted + count);
+    return sorted[(count - 1) * pct / 100];
+}
+
+static void printScenario(BenchScenario scenario) {
+    const ScenarioResult& r = s_bench.results[scenario];
+    printf("BENCH {\"scenario\":\"%s\",\"samples\":%" PRIu32 ",\"failures\":%" PRIu32
+           ",\"time_to_ip_ms\":{\"p50\":%" PRIu32 ",\"p90\":%" PRIu32 ",\"max\":%" PRIu32 "}"
+           ",\"radio_on_ms\":{\"p50\":%" PRIu32 ",\"p90\":%" PRIu32 ",\"max\":%" PRIu32 "}"
+           ",\"heap_min_free\":%" PRIu32 "}\n",
+           SCENARIO_NAMES[scenario], r.count, r.failures,
+           percentile(r.time_to_ip_ms, r.count, 50), percentile(r.time_to_ip_ms, r.count, 90),
+           percentile(r.time_to_ip_ms, r.count, 100),
+           percentile(r.radio_on_ms, r.count, 50), percentile(r.radio_on_ms, r.count, 90),
+           percentile(r.radio_on_ms, r.count, 100),
+           r.heap_min_free == UINT32_MAX ? 0 : r.heap_min_free);
+}
+
+static void printPhase(const char* name, const WiFiManager::PhaseStats& stats) {
+    printf("\"%s\":{\"count\":%" PRIu32 ",\"last_us\":%" PRIu32 ",\"min_us\":%" PRIu32
+           ",\"max_us\":%" PRIu32 ",\"ewma_us\":%" PRIu32 "},",
+           name, stats.count, stats.last_us, stats.min_us, stats.max_us, stats.ewma_us);
+}
+
+// Mismos nombres de campo que WiFiManager::Metrics para que el CI los compare directamente
+static void printMetrics(const WiFiManager& wifi) {
+    WiFiManager::Metrics m = wifi.getMetrics();
+    printf("BENCH {\"scenario\":\"metrics\",");
+    printPhase("init", m.init);
+    printPhase("nvs_load", m.nvs_load);
+    printPhase("scan", m.scan);
+    printPhase("assoc", m.assoc);
+    printPhase("dhcp", m.dhcp);
+    printPhase("provisioning_start", m.provisioning_start);
+    printPhase("provisioning_creds", m.provisioning_creds);
+    printPhase("provisioning_end", m.provisioning_end);
+    printPhase("probe_rtt", m.probe_rtt);
+    printf("\"provisioning_reclaimed_bytes\":%" PRIu32 ",\"reconnects\":%" PRIu32
+           ",\"roam_scans\":%" PRIu32 ",\"roams\":%" PRIu32 ",\"scan_cache_hits\":%" PRIu32
+           ",\"probe_misses\":%" PRIu32 ",\"link_failures\":%" PRIu32 ",\"disconnects\":%" PRIu32 "}\n",
+           m.provisioning_reclaimed_bytes, m.reconnects, m.roam_scans, m.roams, m.scan_cache_hits,
+           m.probe_misses, m.link_failures, m.disconnects);
+}
+
+static void printFootprintPhase(const char* name, const WiFiManager::FootprintPhase& phase) {
+    printf("\"%s\":{\"count\":%" PRIu32 ",\"last_delta\":%" PRIi32 ",\"total_delta\":%" PRIi32
+           ",\"free_internal\":%" PRIu32 ",\"free_dma\":%" PRIu32 ",\"largest_block\":%" PRIu32 "},",
+           name, phase.count, phase.last_delta, phase.total_delta,
+           phase.after.free_internal, phase.after.free_dma, phase.after.largest_block);
+}
+
+// Solo tiene datos con CONFIG_BI_WIFI_FOOTPRINT activado
+static void printFootprint(const WiFiManager& wifi) {
+    WiFiManager::Footprint f = wifi.getFootprint();
+    printf("BENCH {\"scenario\":\"footprint\",");
+    printFootprintPhase("init", f.init);
+    printFootprintPhase("connect", f.connect);
+    printFootprintPhase("start_provisioning", f.start_provisioning);
+    printFootprintPhase("stop_provisioning", f.stop_provisioning);
+    printf("\"connected_count\":%" PRIu32 ",\"connected_free_first\":%" PRIu32
+           ",\"connected_free_last\":%" PRIu32 ",\"connected_free_min\":%" PRIu32
+           ",\"event_task_stack_free\":%" PRIu32 "}\n",
+           f.connected_count, f.connected_free_first, f.connected_free_last, f.connected_free_min,
+           f.event_task_stack_free);
+}
+
+static void printBuild() {
+    const esp_app_desc_t* app = esp_app_get_description();
+    printf("BENCH {\"scenario\":\"build\",\"project\":\"%s\",\"version\":\"%s\",\"idf\":\"%s\""
+           ",\"date\":\"%s %s\",\"iterations\":%d}\n",
+           app->project_name, app->version, app->idf_ver, app->date, app->time, BENCH_ITERATIONS);
+}
+
+static bool waitConnected(WiFiManager& wifi) {
+    return wifi.waitForConnected(pdMS_TO_TICKS(BENCH_CONNECT_TIMEOUT_MS));
+}
+
+static int currentRssi() {
+    wifi_ap_record_t ap_info;
+    return esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK ? ap_info.rssi : 0;
+}
+
+// Envía datos durante BENCH_THROUGHPUT_SECONDS y devuelve los kbit/s enviados
+static uint32_t runThroughput(int type) {
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BENCH_SERVER_PORT);
+    inet_pton(AF_INET, BENCH_SERVER_IP, &addr.sin_addr);
+
+    int sock = socket(AF_INET, type, type == SOCK_STREAM ? IPPROTO_TCP : IPPROTO_UDP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "No se pudo crear el socket: %d", errno);
+        return 0;
+    }
+    if (type == SOCK_STREAM && connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        ESP_LOGE(TAG, "No se pudo conectar con %s:%d: %d", BENCH_SERVER_IP, BENCH_SERVER_PORT, errno);
+        close(sock);
+        return 0;
+    }
+
+    // En UDP solo se mide lo enviado, sin informe del servidor
+    uint64_t bytes = 0;
+    int64_t start = esp_timer_get_time();
+    int64_t end = start + (int64_t)BENCH_THROUGHPUT_SECONDS * 1000000;
+    while (esp_timer_get_time() < end) {
+        int sent = type == SOCK_STREAM
+            ? send(sock, s_tx_buf, sizeof(s_tx_buf), 0)
+            : sendto(sock, s_tx_buf, sizeof(s_tx_buf), 0, (struct sockaddr*)&addr, sizeof(addr));
+        if (sent > 0) {
+            bytes += sent;
+        } else if (type == SOCK_STREAM) {
+            ESP_LOGE(TAG, "Envío TCP interrumpido: %d", errno);
+            break;
+        } else {
+            // Sin buffers libres en lwIP, dejar que se vacíe la cola
+            vTaskDelay(1);
+        }
+    }
+    int64_t duration_us = esp_timer_get_time() - start;
+    close(sock);
+
+    return duration_us > 0 ? (uint32_t)(bytes * 8 * 1000 / duration_us) : 0;
+}
+
+static void runThroughputSuite(WiFiManager& wifi) {
+    static const struct {
+        WiFiManager::PowerProfile profile;
+        const char* name;
+    } profiles[] = {
+        {WiFiManager::PowerProfile::LOW_LATENCY, "low_latency"},
+        {WiFiManager::PowerProfile::BALANCED, "balanced"},
+        {WiFiManager::PowerProfile::MAX_SAVING, "max_saving"},
+    };
+
+    for (const auto& entry : profiles) {
+        if (!wifi.setPowerProfile(entry.profile)) {
+            ESP_LOGE(TAG, "No se pudo aplicar el perfil %s", entry.name);
+            continue;
+        }
+        uint32_t tcp_kbps = runThroughput(SOCK_STREAM);
+        uint32_t udp_kbps = runThroughput(SOCK_DGRAM);
+        printf("BENCH {\"scenario\":\"throughput\",\"power_profile\":\"%s\",\"tcp_tx_kbps\":%" PRIu32
+               ",\"udp_tx_kbps\":%" PRIu32 ",\"rssi\":%d}\n",
+               entry.name, tcp_kbps, udp_kbps, currentRssi());
+    }
+    wifi.setPowerProfile(WiFiManager::PowerProfile::BALANCED);
+}
+
+void bi_wifi_benchmark(void) {
+    // Un encendido o un estado corrupto empiezan el banco de pruebas de cero
+    bool fresh = esp_reset_reason() == ESP_RST_POWERON || s_bench.magic != BENCH_MAGIC ||
+                 s_bench.phase > PHASE_DONE;
+    if (fresh) {
+        resetBenchState();
+    }
+    if (s_bench.phase == PHASE_DONE) {
+        ESP_LOGI(TAG, "Banco de pruebas terminado, reinicia con un encendido para repetirlo");
+        return;
+    }
+
+    int64_t radio_start_us = esp_timer_get_time();
+    WiFiManager wifi("wifi");
+    if (!wifi.init()) {
+        ESP_LOGE(TAG, "Error al inicializar WiFi Manager");
+        return;
+    }
+
+#ifdef BENCH_WIFI_SSID
+    // Arranque de preparación: guardar las credenciales y no medirlo
+    if (fresh) {
+        wifi.connect(BENCH_WIFI_SSID, BENCH_WIFI_PASSWORD, true);
+        waitConnected(wifi);
+        esp_restart();
+    }
+#endif
+
+    if (s_bench.phase == SCENARIO_COLD_BOOT) {
+        // El tiempo hasta la IP cuenta desde el arranque de la aplicación
+        wifi.connect();
+        if (wifi.getState() == WiFiManager::WiFiState::PROVISIONING) {
+            ESP_LOGE(TAG, "No hay credenciales guardadas, define BENCH_WIFI_SSID o provisiona antes");
+            return;
+        }
+        bool ok = waitConnected(wifi);
+        recordSample(SCENARIO_COLD_BOOT, ok, elapsedMs(0), elapsedMs(radio_start_us));
+        if (!scenarioDone(SCENARIO_COLD_BOOT)) {
+            esp_restart();
+        }
+        s_bench.phase = SCENARIO_WARM_RECONNECT;
+    }
+
+    if (s_bench.phase == SCENARIO_WARM_RECONNECT) {
+        if (wifi.getState() != WiFiManager::WiFiState::CONNECTED) {
+            wifi.connect();
+            waitConnected(wifi);
+        }
+        while (!scenarioDone(SCENARIO_WARM_RECONNECT)) {
+            wifi.disconnect();
+            int64_t start_us = esp_timer_get_time();
+            wifi.connect();
+            bool ok = waitConnected(wifi);
+            recordSample(SCENARIO_WARM_RECONNECT, ok, elapsedMs(start_us), elapsedMs(start_us));
+        }
+        s_bench.phase = SCENARIO_DEEP_SLEEP;
+    }
+
+    if (s_bench.phase == SCENARIO_DEEP_SLEEP) {
+        if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER) {
+            // Al despertar, el tiempo cuenta desde el arranque tras el deep sleep
+            bool ok = wifi.resumeFromSleep() && waitConnected(wifi);
+            recordSample(SCENARIO_DEEP_SLEEP, ok, elapsedMs(0), elapsedMs(radio_start_us));
+        } else if (wifi.getState() != WiFiManager::WiFiState::CONNECTED) {
+            // Primera entrada: hace falta una conexión para guardar el contexto RTC
+            wifi.connect();
+            waitConnected(wifi);
+        }
+        if (!scenarioDone(SCENARIO_DEEP_SLEEP)) {
+            esp_sleep_enable_timer_wakeup(BENCH_SLEEP_US);
+            esp_deep_sleep_start();
+        }
+        s_bench.phase = SCENARIO_PROVISIONING;
+    }
+
+    if (s_bench.phase == SCENARIO_PROVISIONING) {
+        // Sin móvil no se pueden recibir credenciales, se mide hasta WIFI_PROV_START.
+        // Las credenciales guardadas se conservan para la fase de throughput
+        while (!scenarioDone(SCENARIO_PROVISIONING)) {
+            uint32_t started = wifi.getMetrics().provisioning_start.count;
+            int64_t start_us = esp_timer_get_time();
+            bool ok = wifi.startReprovisioning("PROV_BENCH");
+            while (ok && wifi.getMetrics().provisioning_start.count == started) {
+                if (elapsedMs(start_us) > BENCH_CONNECT_TIMEOUT_MS) {
+                    ok = false;
+                    break;
+                }
+                vTaskDelay(pdMS_TO_TICKS(10));
+            }
+            uint32_t start_ms = elapsedMs(start_us);
+            wifi.stopProvisioning();
+            recordSample(SCENARIO_PROVISIONING, ok, start_ms, start_ms);
+        }
+        s_bench.phase = PHASE_THROUGHPUT;
+    }
+
+    if (s_bench.phase == PHASE_THROUGHPUT) {
+        if (wifi.getState() != WiFiManager::WiFiState::CONNECTED) {
+            wifi.connect();
+            waitConnected(wifi);
+        }
+        printBuild();
+        for (uint32_t i = 0; i < SCENARIO_COUNT; i++) {
+            printScenario((BenchScenario)i);
+        }
+        runThroughputSuite(wifi);
+        printMetrics(wifi);
+        printFootprint(wifi);
+        s_bench.phase = PHASE_DONE;
+    }
+
+    ESP_LOGI(TAG, "Banco de pruebas terminado");
+    while (1) {
+        vTaskDelay(1000 / portTICK_PERIOD_MS);
+    }
+}
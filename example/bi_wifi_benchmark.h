@@ -0,0 +1,6 @@
+#ifndef BI_WIFI_BENCHMARK_H
+#define BI_WIFI_BENCHMARK_H
+
+void bi_wifi_benchmark(void);
+
+#endif /* BI_WIFI_BENCHMARK_H */
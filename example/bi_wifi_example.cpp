@@ -4,13 +4,17 @@
  */
 
 #include <stdio.h>
+#include <inttypes.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
+#include "esp_mac.h"
 
 #include "bi_wifi.hpp"
+#include "bi_wifi_softap.hpp"
+#include "bi_wifi_espnow.hpp"
 
 static const char *TAG = "bi_wifi_example";
 
@@ -33,6 +37,7 @@ void onWiFiStateChanged(WiFiManager::WiFiState state, void* data) {
                 ESP_LOGI(TAG, "Conectado a la red: %s", wifi->getSSID().c_str());
                 ESP_LOGI(TAG, "Dirección IP: %s", wifi->getIPAddress().c_str());
             }
+            ESP_LOGI(TAG, "Heap libre: %" PRIu32 " bytes", esp_get_free_heap_size());
             break;
         }
         case WiFiManager::WiFiState::PROVISIONING:
@@ -43,21 +48,71 @@ void onWiFiStateChanged(WiFiManager::WiFiState state, void* data) {
             break;
     }
 }
+// Observador sin reservas de memoria, solo recibe los eventos de su máscara
+void onWiFiEvent(const WiFiManager::Notification& notification, void*) {
+    if (notification.type == WiFiManager::EventType::GOT_IP) {
+        ESP_LOGI(TAG, "IP obtenida: " IPSTR, IP2STR(&notification.ip_info.ip));
+    } else if (notification.type == WiFiManager::EventType::DISCONNECTED) {
+        ESP_LOGI(TAG, "Desconectado, motivo: %d", notification.disconnect.reason);
+    }
+}
+
+// Tramas ESP-NOW recibidas, se ejecuta en la tarea del driver WiFi
+void onEspNowFrame(const uint8_t* mac, const uint8_t*, size_t len, void*) {
+    ESP_LOGI(TAG, "ESP-NOW de " MACSTR ": %d bytes", MAC2STR(mac), (int)len);
+}
+
 void bi_wifi_example(void) {
     ESP_LOGI(TAG, "Iniciando aplicación...");
     
     // Crear instancia de WiFiManager
+    // Con poca memoria o para cargas masivas se elige el perfil de buffers del driver:
+    // WiFiManager wifi_manager("wifi", WiFiManager::DriverProfile::LOW_MEMORY);
     WiFiManager wifi_manager("wifi");
     
     // Inicializar el gestor WiFi
+    uint32_t heap_before = esp_get_free_heap_size();
     if (!wifi_manager.init()) {
         ESP_LOGE(TAG, "Error al inicializar WiFi Manager");
         return;
     }
     
+    // En modo STA ya no se crea el netif AP ni su servidor DHCP hasta que
+    // arranca el provisioning, la diferencia con el modo APSTA se ve aquí
+    uint32_t heap_after = esp_get_free_heap_size();
+    ESP_LOGI(TAG, "Heap usado por init (solo STA): %" PRIu32 " bytes, libre: %" PRIu32 " bytes",
+             heap_before - heap_after, heap_after);
+    
     // Configurar callback para cambios de estado
     wifi_manager.setConnectionCallback(onWiFiStateChanged, &wifi_manager);
     
+    // Agrupar los cambios de estado: cortes de menos de 3 s no llegan al callback
+    // wifi_manager.setNotifyConfig({true, 3000});
+    
+    // Registrar un observador para IP y desconexiones (admite varios a la vez)
+    wifi_manager.addObserver(onWiFiEvent, nullptr,
+                             WiFiManager::eventMask(WiFiManager::EventType::GOT_IP) |
+                             WiFiManager::eventMask(WiFiManager::EventType::DISCONNECTED));
+    
+    // IP fija para una red ya guardada (sin DHCP) y nombres resueltos sin consultar DNS
+    // WiFiManager::StaticIpConfig static_ip = {};
+    // static_ip.ip.addr = ESP_IP4TOADDR(192, 168, 1, 50);
+    // static_ip.netmask.addr = ESP_IP4TOADDR(255, 255, 255, 0);
+    // static_ip.gw.addr = ESP_IP4TOADDR(192, 168, 1, 1);
+    // static_ip.dns[0].addr = ESP_IP4TOADDR(192, 168, 1, 1);
+    // wifi_manager.setStaticIp("MI_SSID", static_ip);
+    // esp_ip4_addr_t broker = {ESP_IP4TOADDR(192, 168, 1, 10)};
+    // wifi_manager.addHostEntry("broker.local", broker);
+
+    // SoftAP propio y canal ESP-NOW junto a la conexión STA, comparten el driver WiFi
+    // SoftApService soft_ap;
+    // soft_ap.start("ESP32-C3_AP", "clave_del_ap", 0, 4);
+    // EspNowChannel espnow;
+    // espnow.begin(onEspNowFrame, nullptr);
+    // static const uint8_t peer[ESP_NOW_ETH_ALEN] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    // espnow.addPeer(peer);
+    // espnow.send(peer, (const uint8_t*)"hola", 4);
+
     // Método 1: Conectar usando credenciales almacenadas o iniciar provisioning
     wifi_manager.connect();
     
@@ -67,6 +122,20 @@ void bi_wifi_example(void) {
     // Método 3: Iniciar directamente el modo de provisioning
     // wifi_manager.startProvisioning("ESP32-C3_DEVICE", 1, "12345678");
     
+    // Método 3b: Provisioning por BLE, el móvil no pierde su propia WiFi
+    // wifi_manager.startProvisioning(WiFiManager::ProvisioningScheme::BLE, "PROV_ESP32", "", 1, "12345678");
+    
+    // Método 4: Conectar y esperar el resultado sin sondear getState()
+    // uint8_t reason = 0;
+    // if (wifi_manager.connectSync(pdMS_TO_TICKS(30000), &reason) != WiFiManager::ConnectResult::CONNECTED) {
+    //     ESP_LOGE(TAG, "No se pudo conectar, motivo: %d", reason);
+    // }
+    
+    // Bloquear hasta obtener IP, sin consumo de CPU
+    if (wifi_manager.waitForConnected(pdMS_TO_TICKS(30000))) {
+        ESP_LOGI(TAG, "Conexión establecida");
+    }
+    
     // Loop principal
     while (1) {
         // Tu código principal aquí
@@ -0,0 +1,148 @@
+/**
+ * bi_wifi_driver.hpp
+ * Shared WiFi driver core for ESP-IDF
+ *
+ * Brings up esp_netif, the default event loop and the WiFi driver once for
+ * every role that uses the radio (WiFiManager as STA client, SoftApService,
+ * EspNowChannel) and keeps them running while any role holds a reference.
+ */
+
+#ifndef BI_WIFI_DRIVER_HPP
+#define BI_WIFI_DRIVER_HPP
+
+#include <stdint.h>
+
+#include "esp_wifi.h"
+#include "esp_netif.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+/**
+ * Reference-counted WiFi driver core
+ *
+ * The WiFi mode follows the roles that are held: STA for the STA client and
+ * ESP-NOW, AP for the SoftAP, APSTA for both. A default event loop or WiFi
+ * driver that another component already started is reused and left running
+ * when the last role is released. All methods can be called from any task.
+ */
+class WiFiDriver {
+public:
+    enum class Role : uint8_t {
+        STA,     // Station interface with its netif, used by WiFiManager
+        AP,      // SoftAP interface with its netif, one holder at a time
+        ESPNOW,  // ESP-NOW on the station interface, no netif
+        COUNT
+    };
+
+    /**
+     * Get the driver core shared by all roles
+     * @return Driver core
+     */
+    static WiFiDriver& instance();
+
+    /**
+     * Take a reference on a role, starting the driver on the first one
+     * @param role Role to hold
+     * @param config Driver init settings, only used when this call starts the driver
+     * @return true if the role is held
+     */
+    bool acquire(Role role, const wifi_init_config_t& config);
+
+    /**
+     * Take a reference on a role with the default driver settings
+     * @param role Role to hold
+     * @return true if the role is held
+     */
+    bool acquire(Role role);
+
+    /**
+     * Drop a reference taken with acquire(), stopping the driver with the last one
+     * @param role Role to release
+     */
+    void release(Role role);
+
+    /**
+     * Get the number of references held on a role
+     * @param role Role to query
+     * @return Reference count
+     */
+    uint8_t getRefCount(Role role) const;
+
+    /**
+     * Check if the WiFi driver is running
+     * @return true if started by this core or by another component
+     */
+    bool isStarted() const;
+
+    /**
+     * Get the station netif, valid while the STA role is held
+     * @return Netif handle or nullptr
+     */
+    esp_netif_t* getStaNetif() const;
+
+    /**
+     * Get the SoftAP netif, valid while the AP role is held
+     * @return Netif handle or nullptr
+     */
+    esp_netif_t* getApNetif() const;
+
+    WiFiDriver(const WiFiDriver&) = delete;
+    WiFiDriver& operator=(const WiFiDriver&) = delete;
+
+private:
+    static constexpr const char* TAG = "WiFiDriver";
+
+    WiFiDriver();
+
+    /**
+     * Init esp_netif and create the default event loop unless already done
+     */
+    void prepareStack();
+
+    /**
+     * Init and start the WiFi driver, or adopt the one already running
+     * @param config Driver init settings
+     * @return true if the driver is running
+     */
+    bool startCore(const wifi_init_config_t& config);
+
+    /**
+     * Stop and deinit the driver if this core initialized it
+     */
+    void stopCore();
+
+    /**
+     * Create the netif of a role, or reuse the default one if it already exists
+     * @param role Role that got its first reference
+     * @return true on success
+     */
+    bool createNetif(Role role);
+
+    /**
+     * Destroy the netif of a role if this core created it
+     * @param role Role that lost its last reference
+     */
+    void destroyNetif(Role role);
+
+    /**
+     * Set the WiFi mode needed by the roles currently held
+     * @return true on success
+     */
+    bool applyMode();
+
+    // Guards the fields below, taken by acquire(), release() and the getters
+    StaticSemaphore_t mutex_buffer_;
+    SemaphoreHandle_t mutex_;
+
+    uint8_t refs_[static_cast<size_t>(Role::COUNT)];
+    bool started_;
+    bool owns_driver_;       // false when the driver was initialized by another component
+    wifi_mode_t base_mode_;  // Mode set by that component, kept while the roles run
+
+    esp_netif_t* netif_sta_;
+    esp_netif_t* netif_ap_;
+    bool owns_netif_sta_;
+    bool owns_netif_ap_;
+};
+
+#endif // BI_WIFI_DRIVER_HPP
@@ -0,0 +1,422 @@
+/**
+ * bench_main.cpp
+ * Host benchmark of the WiFiManager event handling against the ESP-IDF fake
+ *
+ * Drives the state machine through disconnect storms, DHCP flaps, scan
+ * sweeps, brief outages and provisioning sessions and reports, per event type, the
+ * handler latency and the heap allocations and NVS writes it caused, and
+ * the state notifications the brief outages cause with and without
+ * coalescing. A SoftAP and an ESP-NOW channel are then started next to
+ * the station to check the shared driver core.
+ *
+ * Usage: bi_wifi_bench [iterations]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include "bi_wifi.hpp"
+#include "bi_wifi_driver.hpp"
+#include "bi_wifi_espnow.hpp"
+#include "bi_wifi_softap.hpp"
+#include "fake_idf.h"
+
+// Allocation counting, every operator new in the process goes through here
+
+static size_t g_allocs = 0;
+
+void* operator new(size_t size) {
+    g_allocs++;
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+namespace {
+
+/**
+ * Samples of one event type
+ */
+struct EventStats {
+    const char* name;
+    std::vector<uint64_t> ns;
+    size_t allocs;
+    uint32_t nvs_writes;
+};
+
+enum Event {
+    EV_DISCONNECTED,
+    EV_RECONNECT_TIMER,
+    EV_STA_CONNECTED,
+    EV_GOT_IP,
+    EV_LOST_IP,
+    EV_PROV_START,
+    EV_PROV_CRED_RECV,
+    EV_PROV_CRED_SUCCESS,
+    EV_PROV_END,
+    EV_SCAN_SWEEP,
+    EV_COUNT
+};
+
+EventStats g_stats[EV_COUNT] = {
+    {"STA_DISCONNECTED", {}, 0, 0},
+    {"reconnect timer", {}, 0, 0},
+    {"STA_CONNECTED", {}, 0, 0},
+    {"GOT_IP", {}, 0, 0},
+    {"LOST_IP", {}, 0, 0},
+    {"PROV_START", {}, 0, 0},
+    {"PROV_CRED_RECV", {}, 0, 0},
+    {"PROV_CRED_SUCCESS", {}, 0, 0},
+    {"PROV_END", {}, 0, 0},
+    {"scan sweep", {}, 0, 0},
+};
+
+const char BENCH_SSID[] = "bench_ap";
+const char BENCH_PASSWORD[] = "bench_password";
+const uint8_t BENCH_BSSID[6] = {0x10, 0x20, 0x30, 0x40, 0x50, 0x60};
+
+uint32_t g_notifications = 0;
+uint32_t g_state_notifications = 0;
+
+void onNotification(const WiFiManager::Notification& notification, void*) {
+    g_notifications++;
+    if (notification.type == WiFiManager::EventType::STATE_CHANGED) {
+        g_state_notifications++;
+    }
+}
+
+/**
+ * Time one step and charge its allocations and NVS writes to an event type
+ */
+template<typename F>
+void measure(Event event, F&& step) {
+    EventStats& stats = g_stats[event];
+    size_t allocs_before = g_allocs;
+    uint32_t nvs_before = fake_idf_counters().nvs_writes;
+
+    auto start = std::chrono::steady_clock::now();
+    step();
+    auto end = std::chrono::steady_clock::now();
+
+    stats.allocs += g_allocs - allocs_before;
+    stats.nvs_writes += fake_idf_counters().nvs_writes - nvs_before;
+    stats.ns.push_back((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+void dispatch(Event event, esp_event_base_t base, int32_t id, void* data) {
+    measure(event, [&] { fake_idf_dispatch(base, id, data); });
+
+    // Events queued by the handlers are not part of the measured step
+    fake_idf_run_events();
+}
+
+wifi_ap_record_t benchAp() {
+    wifi_ap_record_t ap = {};
+    memcpy(ap.bssid, BENCH_BSSID, sizeof(ap.bssid));
+    memcpy(ap.ssid, BENCH_SSID, sizeof(BENCH_SSID));
+    ap.primary = 6;
+    ap.rssi = -55;
+    ap.authmode = WIFI_AUTH_WPA2_PSK;
+    return ap;
+}
+
+void staConnected() {
+    wifi_ap_record_t ap = benchAp();
+    fake_idf_set_associated(&ap);
+
+    wifi_event_sta_connected_t event = {};
+    memcpy(event.ssid, BENCH_SSID, sizeof(BENCH_SSID) - 1);
+    event.ssid_len = sizeof(BENCH_SSID) - 1;
+    memcpy(event.bssid, BENCH_BSSID, sizeof(event.bssid));
+    event.channel = ap.primary;
+    event.authmode = ap.authmode;
+    dispatch(EV_STA_CONNECTED, WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &event);
+}
+
+void gotIp() {
+    ip_event_got_ip_t event = {};
+    event.ip_info.ip.addr = 0x6401A8C0;       // 192.168.1.100
+    event.ip_info.gw.addr = 0x0101A8C0;       // 192.168.1.1
+    event.ip_info.netmask.addr = 0x00FFFFFF;  // 255.255.255.0
+    dispatch(EV_GOT_IP, IP_EVENT, IP_EVENT_STA_GOT_IP, &event);
+}
+
+void staDisconnected(uint8_t reason) {
+    fake_idf_set_associated(nullptr);
+
+    wifi_event_sta_disconnected_t event = {};
+    memcpy(event.ssid, BENCH_SSID, sizeof(BENCH_SSID) - 1);
+    event.ssid_len = sizeof(BENCH_SSID) - 1;
+    memcpy(event.bssid, BENCH_BSSID, sizeof(event.bssid));
+    event.reason = reason;
+    event.rssi = -80;
+    dispatch(EV_DISCONNECTED, WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &event);
+}
+
+// Beacon loss, backoff, reassociation and DHCP, over and over
+void disconnectStorm(WiFiManager& wifi, int iterations) {
+    wifi.connect(BENCH_SSID, BENCH_PASSWORD, true);
+    fake_idf_run_events();
+    staConnected();
+    gotIp();
+
+    WiFiManager::ReconnectPolicy policy = wifi.getReconnectPolicy();
+    for (int i = 0; i < iterations; i++) {
+        staDisconnected(WIFI_REASON_BEACON_TIMEOUT);
+        // The timer only posts an event, the retry runs when it is dispatched
+        measure(EV_RECONNECT_TIMER, [&] {
+            fake_idf_advance_time((int64_t)policy.max_delay_ms * 1000);
+            fake_idf_run_events();
+        });
+        staConnected();
+        gotIp();
+    }
+    wifi.disconnect();
+    fake_idf_run_events();
+}
+
+// Lease lost and renewed while the association stays up
+void dhcpFlap(WiFiManager& wifi, int iterations) {
+    wifi.connect(BENCH_SSID, BENCH_PASSWORD, true);
+    fake_idf_run_events();
+    staConnected();
+    gotIp();
+
+    for (int i = 0; i < iterations; i++) {
+        dispatch(EV_LOST_IP, IP_EVENT, IP_EVENT_STA_LOST_IP, nullptr);
+        gotIp();
+    }
+    wifi.disconnect();
+    fake_idf_run_events();
+}
+
+// Outages shorter than the notify dwell, returns the state notifications they caused
+uint32_t briefOutages(WiFiManager& wifi, int iterations) {
+    WiFiManager::ReconnectPolicy saved = wifi.getReconnectPolicy();
+    WiFiManager::ReconnectPolicy policy = saved;
+    policy.max_delay_ms = 1000;
+    wifi.setReconnectPolicy(policy);
+
+    wifi.connect(BENCH_SSID, BENCH_PASSWORD, true);
+    fake_idf_run_events();
+    staConnected();
+    gotIp();
+
+    uint32_t before = g_state_notifications;
+    for (int i = 0; i < iterations; i++) {
+        staDisconnected(WIFI_REASON_BEACON_TIMEOUT);
+        fake_idf_advance_time((int64_t)policy.max_delay_ms * 1000);
+        fake_idf_run_events();
+        staConnected();
+        gotIp();
+    }
+    uint32_t notifications = g_state_notifications - before;
+
+    wifi.disconnect();
+    fake_idf_run_events();
+    wifi.setReconnectPolicy(saved);
+    return notifications;
+}
+
+// Uncached scans from the app task, each one a chain of SCAN_DONE events on the loop
+void scanSweeps(WiFiManager& wifi, int iterations) {
+    for (int i = 0; i < iterations; i++) {
+        measure(EV_SCAN_SWEEP, [&] { wifi.scanNetworks(false); });
+    }
+}
+
+// Full SoftAP provisioning session ending in a connection
+void provisioningFlow(WiFiManager& wifi, int iterations) {
+#if CONFIG_BI_WIFI_PROVISIONING
+    for (int i = 0; i < iterations; i++) {
+        wifi.startProvisioning(WiFiManager::ProvisioningScheme::SOFTAP, "PROV_BENCH", "", 1, "abcd1234");
+        fake_idf_run_events();
+        dispatch(EV_PROV_START, WIFI_PROV_EVENT, WIFI_PROV_START, nullptr);
+
+        wifi_sta_config_t creds = {};
+        memcpy(creds.ssid, BENCH_SSID, sizeof(BENCH_SSID) - 1);
+        memcpy(creds.password, BENCH_PASSWORD, sizeof(BENCH_PASSWORD) - 1);
+        dispatch(EV_PROV_CRED_RECV, WIFI_PROV_EVENT, WIFI_PROV_CRED_RECV, &creds);
+
+        staConnected();
+        gotIp();
+        dispatch(EV_PROV_CRED_SUCCESS, WIFI_PROV_EVENT, WIFI_PROV_CRED_SUCCESS, nullptr);
+        dispatch(EV_PROV_END, WIFI_PROV_EVENT, WIFI_PROV_END, nullptr);
+
+        wifi.disconnect();
+        fake_idf_run_events();
+    }
+#else
+    (void)wifi;
+    (void)iterations;
+#endif
+}
+
+// connectSync() on the multi-network store right after a failed attempt
+WiFiManager::ConnectResult connectSyncAfterFailure(WiFiManager& wifi) {
+    wifi.addNetwork(BENCH_SSID, BENCH_PASSWORD);
+    wifi.connect(BENCH_SSID, BENCH_PASSWORD, false);
+    fake_idf_run_events();
+    wifi.disconnect();
+    fake_idf_run_events();
+    staDisconnected(WIFI_REASON_NO_AP_FOUND);  // Sets WIFI_FAIL_BIT
+
+    // Age the scan cache so connect() starts a sweep instead of picking from it
+    fake_idf_advance_time((int64_t)wifi.getScanConfig().cache_ttl_ms * 1000);
+    fake_idf_run_events();
+
+    // The sweep is still running when connectSync() looks at the bits, so TIMEOUT
+    fake_idf_hold_scans(true);
+    WiFiManager::ConnectResult result = wifi.connectSync(0);
+    fake_idf_hold_scans(false);
+    fake_idf_run_events();
+    staConnected();
+    gotIp();
+
+    wifi.disconnect();
+    fake_idf_run_events();
+    wifi.removeNetwork(BENCH_SSID);
+    return result;
+}
+
+uint64_t percentile(const std::vector<uint64_t>& sorted, int pct) {
+    size_t index = (sorted.size() - 1) * (size_t)pct / 100;
+    return sorted[index];
+}
+
+void report() {
+    printf("%-18s %8s %9s %9s %9s %9s %10s %10s\n",
+           "event", "count", "mean ns", "p50 ns", "p99 ns", "max ns", "allocs/ev", "nvs/ev");
+    for (EventStats& stats : g_stats) {
+        if (stats.ns.empty()) {
+            continue;
+        }
+        std::sort(stats.ns.begin(), stats.ns.end());
+        uint64_t total = 0;
+        for (uint64_t ns : stats.ns) {
+            total += ns;
+        }
+        double count = (double)stats.ns.size();
+        printf("%-18s %8zu %9.0f %9llu %9llu %9llu %10.2f %10.2f\n",
+               stats.name, stats.ns.size(), total / count,
+               (unsigned long long)percentile(stats.ns, 50),
+               (unsigned long long)percentile(stats.ns, 99),
+               (unsigned long long)stats.ns.back(),
+               stats.allocs / count, stats.nvs_writes / count);
+    }
+}
+
+/**
+ * Run a SoftAP and an ESP-NOW channel next to the station, then release them
+ */
+void sideRoles() {
+    static const uint8_t peer[6] = {0x24, 0x0a, 0xc4, 0xaa, 0xbb, 0xcc};
+    static const uint8_t frame[] = "bench";
+    uint32_t received = 0;
+
+    SoftApService softap;
+    EspNowChannel espnow;
+    bool softap_ok = softap.start("bench_softap", "bench_password");
+    bool espnow_ok = espnow.begin([](const uint8_t*, const uint8_t*, size_t, void* user_data) {
+        (*static_cast<uint32_t*>(user_data))++;
+    }, &received);
+
+    wifi_mode_t mode = WIFI_MODE_NULL;
+    esp_wifi_get_mode(&mode);
+    bool sent = espnow_ok && espnow.addPeer(peer) && espnow.send(peer, frame, sizeof(frame));
+    fake_idf_espnow_receive(peer, frame, sizeof(frame));
+
+    printf("side roles: softap %s, espnow %s, mode %s, frame %s, %" PRIu32 " received, %" PRIu32
+           " send failures\n", softap_ok ? "running" : "failed", espnow_ok ? "running" : "failed",
+           mode == WIFI_MODE_APSTA ? "APSTA" : "not APSTA", sent ? "sent" : "not sent",
+           received, espnow.getSendFailures());
+
+    espnow.end();
+    softap.stop();
+    printf("roles after release: AP %u, ESPNOW %u, STA %u\n",
+           WiFiDriver::instance().getRefCount(WiFiDriver::Role::AP),
+           WiFiDriver::instance().getRefCount(WiFiDriver::Role::ESPNOW),
+           WiFiDriver::instance().getRefCount(WiFiDriver::Role::STA));
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    fake_idf_reset();
+    wifi_ap_record_t ap = benchAp();
+    fake_idf_set_scan_results(&ap, 1);
+
+    {
+        WiFiManager wifi("bench");
+        if (!wifi.init()) {
+            fprintf(stderr, "init failed\n");
+            return 1;
+        }
+        fake_idf_run_events();
+        wifi.addObserver(onNotification);
+
+        disconnectStorm(wifi, iterations);
+        dhcpFlap(wifi, iterations);
+        scanSweeps(wifi, iterations / 10 > 0 ? iterations / 10 : 1);
+        provisioningFlow(wifi, iterations / 10 > 0 ? iterations / 10 : 1);
+
+        uint32_t plain = briefOutages(wifi, iterations);
+        wifi.setNotifyConfig({true, 3000});
+        uint32_t coalesced = briefOutages(wifi, iterations);
+        wifi.setNotifyConfig({false, 0});
+
+        const FakeIdfCounters& counters = fake_idf_counters();
+        report();
+        printf("\nesp_wifi_connect %" PRIu32 ", set_config %" PRIu32 ", scans %" PRIu32
+               ", nvs writes %" PRIu32 ", commits %" PRIu32 ", timers started %" PRIu32
+               ", notifications %" PRIu32 "\n",
+               counters.wifi_connect, counters.wifi_set_config, counters.scans,
+               counters.nvs_writes, counters.nvs_commits, counters.timer_starts, g_notifications);
+        printf("state notifications for %d outages under 1 s: %" PRIu32 " plain, %" PRIu32
+               " with a 3 s dwell\n", iterations, plain, coalesced);
+
+        WiFiManager::ConnectResult result = connectSyncAfterFailure(wifi);
+        printf("connectSync after a failure: %s\n",
+               result == WiFiManager::ConnectResult::TIMEOUT ? "attempt pending" :
+               result == WiFiManager::ConnectResult::FAILED ? "stale failure" : "unexpected result");
+
+        sideRoles();
+    }
+
+    // The manager held the only role, its destructor stops the driver
+    printf("driver core after teardown: %s\n", WiFiDriver::instance().isStarted() ? "running" : "stopped");
+    return 0;
+}
@@ -0,0 +1,1149 @@
+/**
+ * fake_idf.cpp
+ * In-process fake of the ESP-IDF APIs used by bi_wifi, for host builds
+ *
+ * Only the behaviour WiFiManager depends on is modelled. Crypto and the
+ * radio are not: PBKDF2 returns a deterministic pattern and scans return
+ * whatever fake_idf_set_scan_results() was given.
+ */
+
+#include "fake_idf.h"
+
+#include <cstring>
+#include <deque>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "esp_bt.h"
+#include "esp_coexist.h"
+#include "esp_heap_caps.h"
+#include "esp_netif.h"
+#include "esp_now.h"
+#include "esp_rom_crc.h"
+#include "esp_sleep.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "lwip/dhcp.h"
+#include "mbedtls/pkcs5.h"
+#include "mbedtls/platform_util.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "ping/ping_sock.h"
+#include "wifi_provisioning/manager.h"
+#include "wifi_provisioning/scheme_ble.h"
+#include "wifi_provisioning/scheme_softap.h"
+
+esp_event_base_t WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t IP_EVENT = "IP_EVENT";
+esp_event_base_t WIFI_PROV_EVENT = "WIFI_PROV_EVENT";
+const wifi_prov_scheme_t wifi_prov_scheme_softap = {};
+const wifi_prov_scheme_t wifi_prov_scheme_ble = {};
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void* arg;
+    bool active;
+    int64_t expiry_us;
+    uint64_t period_us;
+};
+
+struct esp_netif_obj {
+    esp_netif_ip_info_t ip_info;
+    esp_netif_dns_info_t dns[3];
+    bool dhcpc_started;
+    struct dhcp dhcp;
+    struct netif lwip;
+};
+
+namespace {
+
+struct Handler {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t fn;
+    void* arg;
+};
+
+struct QueuedEvent {
+    esp_event_base_t base;
+    int32_t id;
+    std::vector<uint8_t> data;
+};
+
+constexpr uint16_t MAX_FAKE_APS = 32;
+
+struct FakeState {
+    FakeIdfCounters counters;
+    int64_t now_us;
+    std::vector<Handler> handlers;
+    size_t dispatch_depth;
+    std::deque<QueuedEvent> queue;
+    std::vector<esp_timer*> timers;
+
+    std::map<std::string, std::vector<uint8_t>> nvs;
+    std::vector<std::string> nvs_handles;
+
+    wifi_config_t sta_config;
+    wifi_mode_t mode;
+    bool wifi_initialized;
+    bool associated;
+    wifi_ap_record_t ap;
+    wifi_ap_record_t scan_aps[MAX_FAKE_APS];
+    uint16_t scan_ap_count;
+    wifi_ap_record_t scan_results[MAX_FAKE_APS];
+    uint16_t scan_result_count;
+    bool scans_held;
+    bool scan_done_pending;
+
+    esp_netif_obj netif_sta;
+    esp_netif_obj netif_ap;
+    bool espnow_initialized;
+    esp_now_recv_cb_t espnow_recv_cb;
+    esp_now_send_cb_t espnow_send_cb;
+    std::vector<esp_now_peer_info_t> espnow_peers;
+    bool bt_released;
+    uint32_t random_state;
+};
+
+FakeState& state() {
+    static FakeState s;
+    return s;
+}
+
+void resetNetif(esp_netif_obj& netif) {
+    memset(&netif, 0, sizeof(netif));
+    netif.dhcpc_started = true;
+    netif.lwip.d = &netif.dhcp;
+}
+
+} // namespace
+
+// Control interface
+
+void fake_idf_reset() {
+    FakeState& s = state();
+    for (esp_timer* timer : s.timers) {
+        delete timer;
+    }
+    s.timers.clear();
+    s.handlers.clear();
+    s.dispatch_depth = 0;
+    s.queue.clear();
+    s.nvs.clear();
+    s.nvs_handles.clear();
+    s.counters = {};
+    s.now_us = 1000000;
+    memset(&s.sta_config, 0, sizeof(s.sta_config));
+    s.mode = WIFI_MODE_NULL;
+    s.wifi_initialized = false;
+    s.associated = false;
+    memset(&s.ap, 0, sizeof(s.ap));
+    s.scan_ap_count = 0;
+    s.scan_result_count = 0;
+    s.scans_held = false;
+    s.scan_done_pending = false;
+    resetNetif(s.netif_sta);
+    resetNetif(s.netif_ap);
+    s.espnow_initialized = false;
+    s.espnow_recv_cb = nullptr;
+    s.espnow_send_cb = nullptr;
+    s.espnow_peers.clear();
+    s.bt_released = false;
+    s.random_state = 0x12345678;
+}
+
+void fake_idf_post(esp_event_base_t base, int32_t id, const void* data, size_t len) {
+    QueuedEvent event;
+    event.base = base;
+    event.id = id;
+    if (data && len > 0) {
+        event.data.assign((const uint8_t*)data, (const uint8_t*)data + len);
+    }
+    state().queue.push_back(std::move(event));
+}
+
+void fake_idf_dispatch(esp_event_base_t base, int32_t id, void* data) {
+    FakeState& s = state();
+
+    // Handlers may (un)register others while running, iterate by index and compact afterwards
+    s.dispatch_depth++;
+    size_t count = s.handlers.size();
+    for (size_t i = 0; i < count; i++) {
+        Handler handler = s.handlers[i];
+        if (handler.fn && handler.base == base && (handler.id == ESP_EVENT_ANY_ID || handler.id == id)) {
+            handler.fn(handler.arg, base, id, data);
+        }
+    }
+    s.dispatch_depth--;
+
+    if (s.dispatch_depth == 0) {
+        size_t out = 0;
+        for (size_t i = 0; i < s.handlers.size(); i++) {
+            if (s.handlers[i].fn) {
+                s.handlers[out++] = s.handlers[i];
+            }
+        }
+        s.handlers.resize(out);
+    }
+}
+
+size_t fake_idf_run_events() {
+    FakeState& s = state();
+    size_t dispatched = 0;
+    while (!s.queue.empty()) {
+        QueuedEvent event = std::move(s.queue.front());
+        s.queue.pop_front();
+        fake_idf_dispatch(event.base, event.id, event.data.empty() ? nullptr : event.data.data());
+        dispatched++;
+    }
+    return dispatched;
+}
+
+void fake_idf_advance_time(int64_t us) {
+    FakeState& s = state();
+    int64_t target = s.now_us + us;
+
+    while (true) {
+        esp_timer* next = nullptr;
+        for (esp_timer* timer : s.timers) {
+            if (timer->active && timer->expiry_us <= target &&
+                (!next || timer->expiry_us < next->expiry_us)) {
+                next = timer;
+            }
+        }
+        if (!next) {
+            break;
+        }
+
+        s.now_us = next->expiry_us;
+        if (next->period_us > 0) {
+            next->expiry_us += next->period_us;
+        } else {
+            next->active = false;
+        }
+        next->callback(next->arg);
+    }
+    s.now_us = target;
+}
+
+void fake_idf_set_scan_results(const wifi_ap_record_t* records, uint16_t count) {
+    FakeState& s = state();
+    s.scan_ap_count = count < MAX_FAKE_APS ? count : MAX_FAKE_APS;
+    memcpy(s.scan_aps, records, s.scan_ap_count * sizeof(wifi_ap_record_t));
+}
+
+void fake_idf_hold_scans(bool hold) {
+    FakeState& s = state();
+    s.scans_held = hold;
+    if (!hold && s.scan_done_pending) {
+        s.scan_done_pending = false;
+        wifi_event_sta_scan_done_t event = {};
+        event.number = (uint8_t)s.scan_result_count;
+        fake_idf_post(WIFI_EVENT, WIFI_EVENT_SCAN_DONE, &event, sizeof(event));
+    }
+}
+
+void fake_idf_set_associated(const wifi_ap_record_t* ap) {
+    FakeState& s = state();
+    s.associated = ap != nullptr;
+    if (ap) {
+        s.ap = *ap;
+    }
+}
+
+void fake_idf_espnow_receive(const uint8_t* mac, const uint8_t* data, size_t len) {
+    FakeState& s = state();
+    if (!s.espnow_initialized || !s.espnow_recv_cb) {
+        return;
+    }
+    uint8_t src[ESP_NOW_ETH_ALEN];
+    memcpy(src, mac, sizeof(src));
+    esp_now_recv_info_t info = {};
+    info.src_addr = src;
+    s.espnow_recv_cb(&info, data, (int)len);
+}
+
+const FakeIdfCounters& fake_idf_counters() {
+    return state().counters;
+}
+
+// esp_err / esp_system / esp_sleep
+
+const char* esp_err_to_name(esp_err_t err) {
+    return err == ESP_OK ? "ESP_OK" : "ESP_FAIL";
+}
+
+uint32_t esp_get_free_heap_size(void) {
+    return 200 * 1024;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void) {
+    return 200 * 1024;
+}
+
+size_t heap_caps_get_free_size(uint32_t) {
+    return 200 * 1024;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t) {
+    return 200 * 1024;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t) {
+    return 100 * 1024;
+}
+
+esp_reset_reason_t esp_reset_reason(void) {
+    return ESP_RST_POWERON;
+}
+
+uint32_t esp_random(void) {
+    uint32_t& x = state().random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+void esp_restart(void) {
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void) {
+    return ESP_SLEEP_WAKEUP_UNDEFINED;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len) {
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+// Event loop
+
+esp_err_t esp_event_loop_create_default(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t base, int32_t id,
+                                     esp_event_handler_t fn, void* arg) {
+    state().handlers.push_back({base, id, fn, arg});
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_register(esp_event_base_t base, int32_t id, esp_event_handler_t fn,
+                                              void* arg, esp_event_handler_instance_t* instance) {
+    FakeState& s = state();
+    s.handlers.push_back({base, id, fn, arg});
+    if (instance) {
+        *instance = (esp_event_handler_instance_t)(uintptr_t)s.handlers.size();
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_unregister(esp_event_base_t base, int32_t id, esp_event_handler_t fn) {
+    for (Handler& handler : state().handlers) {
+        if (handler.base == base && handler.id == id && handler.fn == fn) {
+            handler.fn = nullptr;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_unregister(esp_event_base_t, int32_t, esp_event_handler_instance_t instance) {
+    FakeState& s = state();
+    size_t index = (size_t)(uintptr_t)instance;
+    if (index == 0 || index > s.handlers.size()) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s.handlers[index - 1].fn = nullptr;
+    return ESP_OK;
+}
+
+esp_err_t esp_event_post(esp_event_base_t base, int32_t id, const void* data, size_t len, TickType_t) {
+    fake_idf_post(base, id, data, len);
+    return ESP_OK;
+}
+
+// FreeRTOS: no scheduler and tasks cannot be created. Handlers run on a fake
+// event loop task, everything else on the app task. A semaphore take from the
+// app task runs the queued events, which is where the giver would run.
+
+namespace {
+struct FakeEventGroup {
+    EventBits_t bits;
+};
+struct FakeQueue {
+    size_t item_size;
+    size_t capacity;
+    std::deque<std::vector<uint8_t>> items;
+};
+struct FakeSemaphore {
+    bool given;
+    bool is_static;
+};
+static_assert(sizeof(FakeSemaphore) <= sizeof(StaticSemaphore_t), "StaticSemaphore_t too small");
+int app_task;
+int loop_task;
+} // namespace
+
+EventGroupHandle_t xEventGroupCreate(void) {
+    return new FakeEventGroup{0};
+}
+
+void vEventGroupDelete(EventGroupHandle_t group) {
+    delete static_cast<FakeEventGroup*>(group);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    FakeEventGroup* g = static_cast<FakeEventGroup*>(group);
+    g->bits |= bits;
+    return g->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    FakeEventGroup* g = static_cast<FakeEventGroup*>(group);
+    EventBits_t before = g->bits;
+    g->bits &= ~bits;
+    return before;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    return static_cast<FakeEventGroup*>(group)->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t) {
+    FakeEventGroup* g = static_cast<FakeEventGroup*>(group);
+    auto satisfiedBy = [&](EventBits_t value) {
+        return wait_for_all ? (value & bits) == bits : (value & bits) != 0;
+    };
+    // Waiting on the app task lets the pending events run, like xSemaphoreTake()
+    if (!satisfiedBy(g->bits) && state().dispatch_depth == 0) {
+        fake_idf_run_events();
+    }
+    EventBits_t current = g->bits;
+    bool satisfied = satisfiedBy(current);
+    if (satisfied && clear_on_exit) {
+        g->bits &= ~bits;
+    }
+    return current;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t,
+                                   TaskHandle_t*, BaseType_t) {
+    return pdFAIL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*) {
+    return pdFAIL;
+}
+
+void vTaskDelete(TaskHandle_t) {
+}
+
+void vTaskDelay(TickType_t ticks) {
+    fake_idf_advance_time((int64_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(state().now_us / 1000 / portTICK_PERIOD_MS);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return state().dispatch_depth > 0 ? (TaskHandle_t)&loop_task : (TaskHandle_t)&app_task;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    return new FakeQueue{item_size, length, {}};
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t) {
+    FakeQueue* q = static_cast<FakeQueue*>(queue);
+    if (q->items.size() >= q->capacity) {
+        return pdFAIL;
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(item);
+    q->items.emplace_back(bytes, bytes + q->item_size);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t) {
+    FakeQueue* q = static_cast<FakeQueue*>(queue);
+    if (q->items.empty()) {
+        return pdFAIL;
+    }
+    memcpy(item, q->items.front().data(), q->item_size);
+    q->items.pop_front();
+    return pdPASS;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    delete static_cast<FakeQueue*>(queue);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return new FakeSemaphore{false, false};
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t* buffer) {
+    return new (buffer) FakeSemaphore{false, true};
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t* buffer) {
+    return new (buffer) FakeSemaphore{true, true};
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t) {
+    FakeSemaphore* sem = static_cast<FakeSemaphore*>(semaphore);
+    if (!sem->given && state().dispatch_depth == 0) {
+        fake_idf_run_events();
+    }
+    if (!sem->given) {
+        return pdFAIL;
+    }
+    sem->given = false;
+    return pdPASS;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    static_cast<FakeSemaphore*>(semaphore)->given = true;
+    return pdPASS;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    FakeSemaphore* sem = static_cast<FakeSemaphore*>(semaphore);
+    if (!sem->is_static) {
+        delete sem;
+    }
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) {
+    return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t) {
+    return pdPASS;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t) {
+    return 0;
+}
+
+// esp_timer on the virtual clock
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out) {
+    esp_timer* timer = new esp_timer{args->callback, args->arg, false, 0, 0};
+    state().timers.push_back(timer);
+    *out = timer;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    if (timer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    state().counters.timer_starts++;
+    timer->active = true;
+    timer->expiry_us = state().now_us + (int64_t)timeout_us;
+    timer->period_us = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    if (timer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    state().counters.timer_starts++;
+    timer->active = true;
+    timer->expiry_us = state().now_us + (int64_t)period_us;
+    timer->period_us = period_us;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if (!timer->active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->active = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    std::vector<esp_timer*>& timers = state().timers;
+    for (size_t i = 0; i < timers.size(); i++) {
+        if (timers[i] == timer) {
+            timers.erase(timers.begin() + i);
+            break;
+        }
+    }
+    delete timer;
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) {
+    return timer->active;
+}
+
+int64_t esp_timer_get_time(void) {
+    return state().now_us;
+}
+
+// NVS kept in a map, keyed by namespace and key
+
+esp_err_t nvs_flash_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    state().nvs.clear();
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t, nvs_handle_t* out) {
+    FakeState& s = state();
+    s.nvs_handles.push_back(name);
+    *out = (nvs_handle_t)s.nvs_handles.size();
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t) {
+}
+
+namespace {
+std::string nvsKey(nvs_handle_t handle, const char* key) {
+    const std::vector<std::string>& handles = state().nvs_handles;
+    std::string ns = handle > 0 && handle <= handles.size() ? handles[handle - 1] : "";
+    return ns + "/" + key;
+}
+
+esp_err_t nvsGet(nvs_handle_t handle, const char* key, void* out, size_t* len) {
+    FakeState& s = state();
+    auto it = s.nvs.find(nvsKey(handle, key));
+    if (it == s.nvs.end()) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (!out) {
+        *len = it->second.size();
+        return ESP_OK;
+    }
+    if (*len < it->second.size()) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(out, it->second.data(), it->second.size());
+    *len = it->second.size();
+    return ESP_OK;
+}
+} // namespace
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t len) {
+    FakeState& s = state();
+    s.counters.nvs_writes++;
+    s.nvs[nvsKey(handle, key)].assign((const uint8_t*)value, (const uint8_t*)value + len);
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out, size_t* len) {
+    return nvsGet(handle, key, out, len);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value) {
+    return nvs_set_blob(handle, key, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char* key, char* out, size_t* len) {
+    return nvsGet(handle, key, out, len);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) {
+    FakeState& s = state();
+    s.counters.nvs_writes++;
+    return s.nvs.erase(nvsKey(handle, key)) > 0 ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_commit(nvs_handle_t) {
+    state().counters.nvs_commits++;
+    return ESP_OK;
+}
+
+// esp_netif
+
+esp_err_t esp_netif_init(void) {
+    return ESP_OK;
+}
+
+esp_netif_t* esp_netif_create_default_wifi_sta(void) {
+    return &state().netif_sta;
+}
+
+esp_netif_t* esp_netif_create_default_wifi_ap(void) {
+    return &state().netif_ap;
+}
+
+esp_netif_t* esp_netif_get_handle_from_ifkey(const char*) {
+    return nullptr;
+}
+
+void esp_netif_destroy_default_wifi(void*) {
+}
+
+void esp_netif_destroy(esp_netif_t*) {
+}
+
+esp_err_t esp_netif_get_ip_info(esp_netif_t* netif, esp_netif_ip_info_t* ip_info) {
+    *ip_info = netif->ip_info;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_set_ip_info(esp_netif_t* netif, const esp_netif_ip_info_t* ip_info) {
+    netif->ip_info = *ip_info;
+
+    // Like lwIP, a static address counts as obtained once DHCP is stopped
+    if (!netif->dhcpc_started && netif == &state().netif_sta && ip_info->ip.addr != 0) {
+        ip_event_got_ip_t event = {};
+        event.esp_netif = netif;
+        event.ip_info = *ip_info;
+        fake_idf_post(IP_EVENT, IP_EVENT_STA_GOT_IP, &event, sizeof(event));
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcpc_stop(esp_netif_t* netif) {
+    if (!netif->dhcpc_started) {
+        return ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED;
+    }
+    netif->dhcpc_started = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcpc_start(esp_netif_t* netif) {
+    if (netif->dhcpc_started) {
+        return ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED;
+    }
+    netif->dhcpc_started = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_set_dns_info(esp_netif_t* netif, esp_netif_dns_type_t type, esp_netif_dns_info_t* dns) {
+    netif->dns[type] = *dns;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_get_dns_info(esp_netif_t* netif, esp_netif_dns_type_t type, esp_netif_dns_info_t* dns) {
+    *dns = netif->dns[type];
+    return ESP_OK;
+}
+
+int esp_netif_get_netif_impl_index(esp_netif_t* netif) {
+    return netif == &state().netif_sta ? 1 : 2;
+}
+
+void* esp_netif_get_netif_impl(esp_netif_t* netif) {
+    return &netif->lwip;
+}
+
+esp_err_t esp_netif_str_to_ip4(const char*, esp_ip4_addr_t* out) {
+    out->addr = 0;
+    return ESP_OK;
+}
+
+// esp_wifi driver
+
+esp_err_t esp_wifi_init(const wifi_init_config_t*) {
+    state().wifi_initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_deinit(void) {
+    state().wifi_initialized = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode) {
+    state().mode = mode;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_mode(wifi_mode_t* mode) {
+    if (!state().wifi_initialized) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    *mode = state().mode;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void) {
+    fake_idf_post(WIFI_EVENT, WIFI_EVENT_STA_START, nullptr, 0);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_stop(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect(void) {
+    state().counters.wifi_connect++;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_disconnect(void) {
+    FakeState& s = state();
+    s.counters.wifi_disconnect++;
+    if (s.associated) {
+        s.associated = false;
+        wifi_event_sta_disconnected_t event = {};
+        memcpy(event.bssid, s.ap.bssid, sizeof(event.bssid));
+        event.reason = WIFI_REASON_ASSOC_LEAVE;
+        fake_idf_post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &event, sizeof(event));
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t* config) {
+    FakeState& s = state();
+    s.counters.wifi_set_config++;
+    if (interface == WIFI_IF_STA) {
+        s.sta_config = *config;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t* config) {
+    if (interface != WIFI_IF_STA) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *config = state().sta_config;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_mac(wifi_interface_t, uint8_t* mac) {
+    static const uint8_t fake_mac[6] = {0x24, 0x0a, 0xc4, 0x12, 0x34, 0x56};
+    memcpy(mac, fake_mac, sizeof(fake_mac));
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_ps(wifi_ps_type_t* type) {
+    *type = WIFI_PS_MIN_MODEM;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_max_tx_power(int8_t) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_max_tx_power(int8_t* power) {
+    *power = 80;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t* ap) {
+    FakeState& s = state();
+    if (!s.associated) {
+        return ESP_ERR_WIFI_NOT_CONNECT;
+    }
+    *ap = s.ap;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_rssi(int* rssi) {
+    FakeState& s = state();
+    if (!s.associated) {
+        return ESP_ERR_WIFI_NOT_CONNECT;
+    }
+    *rssi = s.ap.rssi;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t* config, bool) {
+    FakeState& s = state();
+    s.counters.scans++;
+
+    s.scan_result_count = 0;
+    for (uint16_t i = 0; i < s.scan_ap_count; i++) {
+        const wifi_ap_record_t& ap = s.scan_aps[i];
+        if (config && config->channel != 0 && config->channel != ap.primary) {
+            continue;
+        }
+        if (config && config->ssid && strcmp((const char*)config->ssid, (const char*)ap.ssid) != 0) {
+            continue;
+        }
+        s.scan_results[s.scan_result_count++] = ap;
+    }
+
+    if (s.scans_held) {
+        s.scan_done_pending = true;
+        return ESP_OK;
+    }
+    wifi_event_sta_scan_done_t event = {};
+    event.number = (uint8_t)s.scan_result_count;
+    fake_idf_post(WIFI_EVENT, WIFI_EVENT_SCAN_DONE, &event, sizeof(event));
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_stop(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_get_ap_num(uint16_t* count) {
+    *count = state().scan_result_count;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_get_ap_records(uint16_t* count, wifi_ap_record_t* records) {
+    FakeState& s = state();
+    uint16_t n = *count < s.scan_result_count ? *count : s.scan_result_count;
+    memcpy(records, s.scan_results, n * sizeof(wifi_ap_record_t));
+    *count = n;
+    s.scan_result_count = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_clear_ap_list(void) {
+    state().scan_result_count = 0;
+    return ESP_OK;
+}
+
+// ESP-NOW on top of the fake driver, every frame to a known peer is acknowledged
+
+namespace {
+
+std::vector<esp_now_peer_info_t>::iterator findPeer(const uint8_t* mac) {
+    std::vector<esp_now_peer_info_t>& peers = state().espnow_peers;
+    for (auto it = peers.begin(); it != peers.end(); ++it) {
+        if (memcmp(it->peer_addr, mac, ESP_NOW_ETH_ALEN) == 0) {
+            return it;
+        }
+    }
+    return peers.end();
+}
+
+} // namespace
+
+esp_err_t esp_now_init(void) {
+    FakeState& s = state();
+    if (!s.wifi_initialized) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    s.espnow_initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_deinit(void) {
+    FakeState& s = state();
+    s.espnow_initialized = false;
+    s.espnow_recv_cb = nullptr;
+    s.espnow_send_cb = nullptr;
+    s.espnow_peers.clear();
+    return ESP_OK;
+}
+
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t cb) {
+    FakeState& s = state();
+    if (!s.espnow_initialized) {
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    }
+    s.espnow_recv_cb = cb;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_unregister_recv_cb(void) {
+    state().espnow_recv_cb = nullptr;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t cb) {
+    FakeState& s = state();
+    if (!s.espnow_initialized) {
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    }
+    s.espnow_send_cb = cb;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_unregister_send_cb(void) {
+    state().espnow_send_cb = nullptr;
+    return ESP_OK;
+}
+
+esp_err_t esp_now_send(const uint8_t* mac, const uint8_t* data, size_t len) {
+    FakeState& s = state();
+    if (!s.espnow_initialized) {
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    }
+    if (!data || len == 0 || len > ESP_NOW_MAX_DATA_LEN) {
+        return ESP_ERR_ESPNOW_ARG;
+    }
+    if (mac ? findPeer(mac) == s.espnow_peers.end() : s.espnow_peers.empty()) {
+        return ESP_ERR_ESPNOW_NOT_FOUND;
+    }
+    s.counters.espnow_sends++;
+
+    // The driver reports the result per peer
+    if (s.espnow_send_cb) {
+        if (mac) {
+            s.espnow_send_cb(mac, ESP_NOW_SEND_SUCCESS);
+        } else {
+            for (const esp_now_peer_info_t& peer : s.espnow_peers) {
+                s.espnow_send_cb(peer.peer_addr, ESP_NOW_SEND_SUCCESS);
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t* peer) {
+    FakeState& s = state();
+    if (!s.espnow_initialized) {
+        return ESP_ERR_ESPNOW_NOT_INIT;
+    }
+    if (findPeer(peer->peer_addr) != s.espnow_peers.end()) {
+        return ESP_ERR_ESPNOW_EXIST;
+    }
+    if (s.espnow_peers.size() >= ESP_NOW_MAX_TOTAL_PEER_NUM) {
+        return ESP_ERR_ESPNOW_FULL;
+    }
+    s.espnow_peers.push_back(*peer);
+    return ESP_OK;
+}
+
+esp_err_t esp_now_del_peer(const uint8_t* mac) {
+    FakeState& s = state();
+    auto it = findPeer(mac);
+    if (it == s.espnow_peers.end()) {
+        return ESP_ERR_ESPNOW_NOT_FOUND;
+    }
+    s.espnow_peers.erase(it);
+    return ESP_OK;
+}
+
+esp_err_t esp_now_mod_peer(const esp_now_peer_info_t* peer) {
+    FakeState& s = state();
+    auto it = findPeer(peer->peer_addr);
+    if (it == s.espnow_peers.end()) {
+        return ESP_ERR_ESPNOW_NOT_FOUND;
+    }
+    *it = *peer;
+    return ESP_OK;
+}
+
+bool esp_now_is_peer_exist(const uint8_t* mac) {
+    return findPeer(mac) != state().espnow_peers.end();
+}
+
+// Ping sessions never send anything, replies are not simulated
+
+namespace {
+struct FakePingSession {
+    esp_ping_callbacks_t callbacks;
+};
+} // namespace
+
+esp_err_t esp_ping_new_session(const esp_ping_config_t*, const esp_ping_callbacks_t* callbacks,
+                               esp_ping_handle_t* out) {
+    *out = new FakePingSession{*callbacks};
+    return ESP_OK;
+}
+
+esp_err_t esp_ping_delete_session(esp_ping_handle_t session) {
+    delete static_cast<FakePingSession*>(session);
+    return ESP_OK;
+}
+
+esp_err_t esp_ping_start(esp_ping_handle_t) {
+    return ESP_OK;
+}
+
+esp_err_t esp_ping_stop(esp_ping_handle_t) {
+    return ESP_OK;
+}
+
+esp_err_t esp_ping_get_profile(esp_ping_handle_t, esp_ping_profile_t, void* data, uint32_t size) {
+    memset(data, 0, size);
+    return ESP_OK;
+}
+
+// Provisioning manager, the caller injects the WIFI_PROV_EVENT sequence
+
+esp_err_t wifi_prov_mgr_init(wifi_prov_mgr_config_t) {
+    return ESP_OK;
+}
+
+void wifi_prov_mgr_deinit(void) {
+}
+
+esp_err_t wifi_prov_mgr_is_provisioned(bool* provisioned) {
+    *provisioned = false;
+    return ESP_OK;
+}
+
+esp_err_t wifi_prov_mgr_start_provisioning(wifi_prov_security_t, const void*, const char*, const char*) {
+    return ESP_OK;
+}
+
+void wifi_prov_mgr_stop_provisioning(void) {
+}
+
+esp_err_t wifi_prov_mgr_reset_provisioning(void) {
+    return ESP_OK;
+}
+
+esp_err_t wifi_prov_mgr_disable_auto_stop(uint32_t) {
+    return ESP_OK;
+}
+
+esp_err_t wifi_prov_scheme_ble_set_service_uuid(uint8_t*) {
+    return ESP_OK;
+}
+
+// Bluetooth controller and coexistence
+
+esp_bt_controller_status_t esp_bt_controller_get_status(void) {
+    return ESP_BT_CONTROLLER_STATUS_IDLE;
+}
+
+esp_err_t esp_bt_controller_mem_release(esp_bt_mode_t) {
+    FakeState& s = state();
+    if (s.bt_released) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s.bt_released = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_coex_preference_set(esp_coex_prefer_t) {
+    return ESP_OK;
+}
+
+// mbedtls: not real crypto, only a deterministic stand-in with the same shape
+
+int mbedtls_pkcs5_pbkdf2_hmac_ext(mbedtls_md_type_t, const unsigned char* password, size_t password_len,
+                                  const unsigned char* salt, size_t salt_len, unsigned int iterations,
+                                  uint32_t key_len, unsigned char* output) {
+    for (uint32_t i = 0; i < key_len; i++) {
+        unsigned char p = password_len ? password[i % password_len] : 0;
+        unsigned char s = salt_len ? salt[i % salt_len] : 0;
+        output[i] = (unsigned char)(p ^ (s << 1) ^ i ^ iterations);
+    }
+    return 0;
+}
+
+void mbedtls_platform_zeroize(void* buf, size_t len) {
+    volatile unsigned char* p = (volatile unsigned char*)buf;
+    while (len--) {
+        *p++ = 0;
+    }
+}
@@ -0,0 +1,5 @@
+// Host fake of the ESP-IDF esp_attr.h header, only what bi_wifi uses
+#pragma once
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define IRAM_ATTR
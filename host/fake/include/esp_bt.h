@@ -0,0 +1,7 @@
+// Host fake of the ESP-IDF esp_bt.h header, only what bi_wifi uses
+#pragma once
+#include "esp_err.h"
+typedef enum { ESP_BT_MODE_IDLE, ESP_BT_MODE_BLE, ESP_BT_MODE_CLASSIC_BT, ESP_BT_MODE_BTDM } esp_bt_mode_t;
+typedef enum { ESP_BT_CONTROLLER_STATUS_IDLE, ESP_BT_CONTROLLER_STATUS_INITED, ESP_BT_CONTROLLER_STATUS_ENABLED } esp_bt_controller_status_t;
+esp_bt_controller_status_t esp_bt_controller_get_status(void);
+esp_err_t esp_bt_controller_mem_release(esp_bt_mode_t);
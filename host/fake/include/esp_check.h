@@ -0,0 +1,3 @@
+// Host fake of the ESP-IDF esp_check.h header, only what bi_wifi uses
+#pragma once
+#include "esp_err.h"
@@ -0,0 +1,36 @@
+// Host fake of the ESP-IDF esp_err.h header, only what bi_wifi uses
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERR_INVALID_CRC 0x109
+#define ESP_ERR_NOT_SUPPORTED 0x106
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+#define ESP_ERR_NVS_NO_FREE_PAGES 0x110d
+#define ESP_ERR_NVS_NEW_VERSION_FOUND 0x1110
+#define ESP_ERR_NVS_INVALID_LENGTH 0x110c
+#define ESP_ERR_WIFI_NOT_INIT 0x3001
+#define ESP_ERR_WIFI_NOT_CONNECT 0x300f
+const char* esp_err_to_name(esp_err_t);
+#define ESP_ERROR_CHECK(x) do { esp_err_t e_ = (x); (void)e_; } while (0)
+#define ESP_ERROR_CHECK_WITHOUT_ABORT(x) (x)
+#define BIT0 1u
+#define BIT1 2u
+#define BIT2 4u
+#define BIT3 8u
+#define BIT4 16u
+#define BIT5 32u
+#define BIT6 64u
+#define BIT7 128u
+#define ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED 0x5004
+#define ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED 0x5003
+#include <inttypes.h>
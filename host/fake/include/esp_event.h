@@ -0,0 +1,20 @@
+// Host fake of the ESP-IDF esp_event.h header, only what bi_wifi uses
+#pragma once
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+typedef const char* esp_event_base_t;
+typedef void (*esp_event_handler_t)(void*, esp_event_base_t, int32_t, void*);
+typedef void* esp_event_handler_instance_t;
+#define ESP_EVENT_ANY_ID -1
+#define ESP_EVENT_DEFINE_BASE(id) esp_event_base_t const id = #id
+extern esp_event_base_t WIFI_EVENT, IP_EVENT;
+esp_err_t esp_event_loop_create_default(void);
+esp_err_t esp_event_handler_instance_register(esp_event_base_t, int32_t, esp_event_handler_t, void*, esp_event_handler_instance_t*);
+esp_err_t esp_event_handler_instance_unregister(esp_event_base_t, int32_t, esp_event_handler_instance_t);
+esp_err_t esp_event_handler_register(esp_event_base_t, int32_t, esp_event_handler_t, void*);
+esp_err_t esp_event_handler_unregister(esp_event_base_t, int32_t, esp_event_handler_t);
+esp_err_t esp_event_post(esp_event_base_t, int32_t, const void*, size_t, TickType_t);
@@ -0,0 +1,10 @@
+// Host fake of the ESP-IDF esp_heap_caps.h header, only what bi_wifi uses
+#pragma once
+#include "esp_err.h"
+#define MALLOC_CAP_8BIT (1<<2)
+#define MALLOC_CAP_DMA (1<<3)
+#define MALLOC_CAP_INTERNAL (1<<11)
+#define MALLOC_CAP_DEFAULT (1<<12)
+size_t heap_caps_get_free_size(uint32_t);
+size_t heap_caps_get_minimum_free_size(uint32_t);
+size_t heap_caps_get_largest_free_block(uint32_t);
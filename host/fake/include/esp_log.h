@@ -0,0 +1,17 @@
+// Host fake of the ESP-IDF esp_log.h header, only what bi_wifi uses
+#pragma once
+#include "esp_err.h"
+#include <stdio.h>
+
+// Logging would dominate the measurements, build with -DFAKE_IDF_LOG=1 to see it
+#if FAKE_IDF_LOG
+#define FAKE_IDF_LOG_PRINT(level, tag, fmt, ...) printf(level " (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#else
+#define FAKE_IDF_LOG_PRINT(level, tag, fmt, ...) do { if (0) printf(fmt, ##__VA_ARGS__); } while (0)
+#endif
+
+#define ESP_LOGE(tag, fmt, ...) FAKE_IDF_LOG_PRINT("E", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) FAKE_IDF_LOG_PRINT("W", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) FAKE_IDF_LOG_PRINT("I", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) FAKE_IDF_LOG_PRINT("D", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) FAKE_IDF_LOG_PRINT("V", tag, fmt, ##__VA_ARGS__)
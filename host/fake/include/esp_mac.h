@@ -0,0 +1,7 @@
+// Host fake of the ESP-IDF esp_mac.h header, only what bi_wifi uses
+#pragma once
+#include "esp_err.h"
+#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
+#define MAC2STR(a) (a)[0],(a)[1],(a)[2],(a)[3],(a)[4],(a)[5]
+typedef enum { ESP_MAC_WIFI_STA } esp_mac_type_t;
+esp_err_t esp_read_mac(uint8_t*, esp_mac_type_t);
@@ -0,0 +1,29 @@
+// Host fake of the ESP-IDF esp_netif.h header, only what bi_wifi uses
+#pragma once
+#include "esp_err.h"
+#include <stdio.h>
+typedef struct { uint32_t addr; } esp_ip4_addr_t;
+typedef struct { esp_ip4_addr_t ip, netmask, gw; } esp_netif_ip_info_t;
+typedef struct esp_netif_obj esp_netif_t;
+typedef enum { ESP_NETIF_DNS_MAIN, ESP_NETIF_DNS_BACKUP, ESP_NETIF_DNS_FALLBACK } esp_netif_dns_type_t;
+#define ESP_IPADDR_TYPE_V4 0
+typedef struct { union { esp_ip4_addr_t ip4; } u_addr; uint8_t type; } esp_ip_addr_t;
+typedef struct { esp_ip_addr_t ip; } esp_netif_dns_info_t;
+#define IPSTR "%d.%d.%d.%d"
+#define IP2STR(a) (int)((a)->addr & 0xff),(int)(((a)->addr>>8)&0xff),(int)(((a)->addr>>16)&0xff),(int)(((a)->addr>>24)&0xff)
+#define ESP_IP4TOADDR(a,b,c,d) ((uint32_t)(a)|((uint32_t)(b)<<8)|((uint32_t)(c)<<16)|((uint32_t)(d)<<24))
+esp_err_t esp_netif_init(void);
+esp_netif_t* esp_netif_create_default_wifi_sta(void);
+esp_netif_t* esp_netif_create_default_wifi_ap(void);
+esp_netif_t* esp_netif_get_handle_from_ifkey(const char*);
+void esp_netif_destroy_default_wifi(void*);
+void esp_netif_destroy(esp_netif_t*);
+esp_err_t esp_netif_get_ip_info(esp_netif_t*, esp_netif_ip_info_t*);
+esp_err_t esp_netif_set_ip_info(esp_netif_t*, const esp_netif_ip_info_t*);
+esp_err_t esp_netif_dhcpc_stop(esp_netif_t*);
+esp_err_t esp_netif_dhcpc_start(esp_netif_t*);
+esp_err_t esp_netif_set_dns_info(esp_netif_t*, esp_netif_dns_type_t, esp_netif_dns_info_t*);
+esp_err_t esp_netif_get_dns_info(esp_netif_t*, esp_netif_dns_type_t, esp_netif_dns_info_t*);
+int esp_netif_get_netif_impl_index(esp_netif_t*);
+esp_err_t esp_netif_str_to_ip4(const char*, esp_ip4_addr_t*);
+void* esp_netif_get_netif_impl(esp_netif_t*);
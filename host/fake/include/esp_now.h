@@ -0,0 +1,29 @@
+// Host fake of the ESP-IDF esp_now.h header, only what bi_wifi uses
+#pragma once
+#include "esp_err.h"
+#include "esp_wifi.h"
+#define ESP_ERR_ESPNOW_NOT_INIT 0x3065
+#define ESP_ERR_ESPNOW_ARG 0x3066
+#define ESP_ERR_ESPNOW_FULL 0x3068
+#define ESP_ERR_ESPNOW_NOT_FOUND 0x3069
+#define ESP_ERR_ESPNOW_EXIST 0x306b
+#define ESP_NOW_ETH_ALEN 6
+#define ESP_NOW_KEY_LEN 16
+#define ESP_NOW_MAX_DATA_LEN 250
+#define ESP_NOW_MAX_TOTAL_PEER_NUM 20
+typedef enum { ESP_NOW_SEND_SUCCESS = 0, ESP_NOW_SEND_FAIL } esp_now_send_status_t;
+typedef struct { uint8_t peer_addr[ESP_NOW_ETH_ALEN]; uint8_t lmk[ESP_NOW_KEY_LEN]; uint8_t channel; wifi_interface_t ifidx; bool encrypt; void* priv; } esp_now_peer_info_t;
+typedef struct { uint8_t* src_addr; uint8_t* des_addr; void* rx_ctrl; } esp_now_recv_info_t;
+typedef void (*esp_now_recv_cb_t)(const esp_now_recv_info_t*, const uint8_t*, int);
+typedef void (*esp_now_send_cb_t)(const uint8_t*, esp_now_send_status_t);
+esp_err_t esp_now_init(void);
+esp_err_t esp_now_deinit(void);
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t);
+esp_err_t esp_now_unregister_recv_cb(void);
+esp_err_t esp_now_register_send_cb(esp_now_send_cb_t);
+esp_err_t esp_now_unregister_send_cb(void);
+esp_err_t esp_now_send(const uint8_t*, const uint8_t*, size_t);
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t*);
+esp_err_t esp_now_del_peer(const uint8_t*);
+esp_err_t esp_now_mod_peer(const esp_now_peer_info_t*);
+bool esp_now_is_peer_exist(const uint8_t*);
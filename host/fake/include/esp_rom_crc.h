@@ -0,0 +1,4 @@
+// Host fake of the ESP-IDF esp_rom_crc.h header, only what bi_wifi uses
+#pragma once
+#include <stdint.h>
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len);
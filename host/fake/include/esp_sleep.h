@@ -0,0 +1,7 @@
+// Host fake of the ESP-IDF esp_sleep.h header, only what bi_wifi uses
+#pragma once
+#include "esp_err.h"
+typedef enum { ESP_SLEEP_WAKEUP_UNDEFINED, ESP_SLEEP_WAKEUP_TIMER, ESP_SLEEP_WAKEUP_GPIO } esp_sleep_wakeup_cause_t;
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void);
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t);
+void esp_deep_sleep_start(void);
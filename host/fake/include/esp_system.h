@@ -0,0 +1,9 @@
+// Host fake of the ESP-IDF esp_system.h header, only what bi_wifi uses
+#pragma once
+#include "esp_err.h"
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+uint32_t esp_random(void);
+void esp_restart(void);
+typedef enum { ESP_RST_UNKNOWN, ESP_RST_POWERON, ESP_RST_EXT, ESP_RST_SW, ESP_RST_PANIC, ESP_RST_DEEPSLEEP, ESP_RST_BROWNOUT } esp_reset_reason_t;
+esp_reset_reason_t esp_reset_reason(void);
@@ -0,0 +1,80 @@
+// Host fake of the ESP-IDF esp_wifi.h header, only what bi_wifi uses
+#pragma once
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+typedef enum { WIFI_MODE_NULL, WIFI_MODE_STA, WIFI_MODE_AP, WIFI_MODE_APSTA } wifi_mode_t;
+typedef enum { WIFI_IF_STA, WIFI_IF_AP } wifi_interface_t;
+typedef enum { WIFI_AUTH_OPEN, WIFI_AUTH_WEP, WIFI_AUTH_WPA_PSK, WIFI_AUTH_WPA2_PSK, WIFI_AUTH_WPA_WPA2_PSK, WIFI_AUTH_WPA2_ENTERPRISE, WIFI_AUTH_WPA3_PSK, WIFI_AUTH_WPA2_WPA3_PSK, WIFI_AUTH_MAX } wifi_auth_mode_t;
+typedef enum { WIFI_PS_NONE, WIFI_PS_MIN_MODEM, WIFI_PS_MAX_MODEM } wifi_ps_type_t;
+typedef enum { WIFI_FAST_SCAN, WIFI_ALL_CHANNEL_SCAN } wifi_scan_method_t;
+typedef enum { WIFI_CONNECT_AP_BY_SIGNAL, WIFI_CONNECT_AP_BY_SECURITY } wifi_sort_method_t;
+typedef enum { WIFI_SCAN_TYPE_ACTIVE, WIFI_SCAN_TYPE_PASSIVE } wifi_scan_type_t;
+typedef enum { WIFI_SECOND_CHAN_NONE } wifi_second_chan_t;
+typedef enum { WIFI_BW_HT20=1, WIFI_BW_HT40 } wifi_bandwidth_t;
+typedef struct { int8_t rssi; wifi_auth_mode_t authmode; } wifi_scan_threshold_t;
+typedef struct { uint32_t min, max; } wifi_active_scan_time_t;
+typedef struct { wifi_active_scan_time_t active; uint32_t passive; } wifi_scan_time_t;
+typedef struct { uint8_t* ssid; uint8_t* bssid; uint8_t channel; bool show_hidden; wifi_scan_type_t scan_type; wifi_scan_time_t scan_time; uint8_t home_chan_dwell_time; } wifi_scan_config_t;
+typedef struct { bool capable; bool required; } wifi_pmf_config_t;
+typedef struct {
+  uint8_t ssid[32]; uint8_t password[64]; wifi_scan_method_t scan_method; bool bssid_set; uint8_t bssid[6]; uint8_t channel;
+  uint16_t listen_interval; wifi_sort_method_t sort_method; wifi_scan_threshold_t threshold; wifi_pmf_config_t pmf_cfg;
+  uint32_t rm_enabled:1; uint32_t btm_enabled:1; uint32_t mbo_enabled:1; uint32_t ft_enabled:1; uint32_t owe_enabled:1; uint32_t transition_disable:1; uint32_t reserved:26;
+  uint8_t failure_retry_cnt;
+} wifi_sta_config_t;
+typedef struct { uint8_t ssid[32]; uint8_t password[64]; uint8_t ssid_len; uint8_t channel; wifi_auth_mode_t authmode; uint8_t ssid_hidden; uint8_t max_connection; uint16_t beacon_interval; } wifi_ap_config_t;
+typedef union { wifi_ap_config_t ap; wifi_sta_config_t sta; } wifi_config_t;
+typedef struct { uint8_t bssid[6]; uint8_t ssid[33]; uint8_t primary; wifi_second_chan_t second; int8_t rssi; wifi_auth_mode_t authmode;
+  uint32_t phy_11b:1; uint32_t phy_11g:1; uint32_t phy_11n:1; uint32_t phy_lr:1; uint32_t wps:1; uint32_t ftm_responder:1; uint32_t ftm_initiator:1; uint32_t reserved:25; } wifi_ap_record_t;
+typedef struct { int static_rx_buf_num, dynamic_rx_buf_num, tx_buf_type, static_tx_buf_num, dynamic_tx_buf_num, cache_tx_buf_num, csi_enable, ampdu_rx_enable, ampdu_tx_enable, amsdu_tx_enable, nvs_enable, nano_enable, rx_ba_win, wifi_task_core_id, beacon_max_len, mgmt_sbuf_num; uint64_t feature_caps; bool sta_disconnected_pm; int espnow_max_encrypt_num; int magic; int tx_ba_win; } wifi_init_config_t;
+#define WIFI_INIT_CONFIG_DEFAULT() { 10, 32, 1, 0, 32, 0, 0, 1, 1, 0, 1, 0, 6, 0, 752, 32, 0, true, 7, 0x1F2F3F4F, 6 }
+typedef enum { WIFI_EVENT_WIFI_READY, WIFI_EVENT_SCAN_DONE, WIFI_EVENT_STA_START, WIFI_EVENT_STA_STOP, WIFI_EVENT_STA_CONNECTED, WIFI_EVENT_STA_DISCONNECTED, WIFI_EVENT_STA_AUTHMODE_CHANGE, WIFI_EVENT_STA_BSS_RSSI_LOW=12, WIFI_EVENT_AP_START, WIFI_EVENT_AP_STOP, WIFI_EVENT_AP_STACONNECTED, WIFI_EVENT_AP_STADISCONNECTED } wifi_event_t;
+typedef enum { IP_EVENT_STA_GOT_IP, IP_EVENT_STA_LOST_IP, IP_EVENT_AP_STAIPASSIGNED } ip_event_t;
+typedef struct { uint8_t ssid[32]; uint8_t ssid_len; uint8_t bssid[6]; uint8_t channel; wifi_auth_mode_t authmode; uint16_t aid; } wifi_event_sta_connected_t;
+typedef struct { uint8_t ssid[32]; uint8_t ssid_len; uint8_t bssid[6]; uint8_t reason; int8_t rssi; } wifi_event_sta_disconnected_t;
+typedef struct { uint8_t mac[6]; uint8_t aid; bool is_mesh_child; } wifi_event_ap_staconnected_t;
+typedef struct { uint8_t mac[6]; uint8_t aid; bool is_mesh_child; uint8_t reason; } wifi_event_ap_stadisconnected_t;
+typedef struct { uint32_t status; uint8_t number; uint8_t scan_id; } wifi_event_sta_scan_done_t;
+typedef struct { int32_t rssi; } wifi_event_bss_rssi_low_t;
+typedef struct { esp_netif_t* esp_netif; esp_netif_ip_info_t ip_info; bool ip_changed; } ip_event_got_ip_t;
+typedef enum {
+ WIFI_REASON_UNSPECIFIED=1, WIFI_REASON_AUTH_EXPIRE=2, WIFI_REASON_AUTH_LEAVE=3, WIFI_REASON_ASSOC_EXPIRE=4, WIFI_REASON_ASSOC_TOOMANY=5,
+ WIFI_REASON_NOT_AUTHED=6, WIFI_REASON_NOT_ASSOCED=7, WIFI_REASON_ASSOC_LEAVE=8, WIFI_REASON_ASSOC_NOT_AUTHED=9,
+ WIFI_REASON_802_1X_AUTH_FAILED=23, WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT=15, WIFI_REASON_BEACON_TIMEOUT=200, WIFI_REASON_NO_AP_FOUND=201,
+ WIFI_REASON_AUTH_FAIL=202, WIFI_REASON_ASSOC_FAIL=203, WIFI_REASON_HANDSHAKE_TIMEOUT=204, WIFI_REASON_CONNECTION_FAIL=205,
+ WIFI_REASON_AP_TSF_RESET=206, WIFI_REASON_ROAMING=207, WIFI_REASON_NO_AP_FOUND_W_COMPATIBLE_SECURITY=210, WIFI_REASON_NO_AP_FOUND_IN_AUTHMODE_THRESHOLD=211, WIFI_REASON_NO_AP_FOUND_IN_RSSI_THRESHOLD=212
+} wifi_err_reason_t;
+typedef enum { WIFI_PHY_MODE_LR, WIFI_PHY_MODE_11B, WIFI_PHY_MODE_11G, WIFI_PHY_MODE_HT20 } wifi_phy_mode_t;
+#define WIFI_PROTOCOL_11B 1
+#define WIFI_PROTOCOL_11G 2
+#define WIFI_PROTOCOL_11N 4
+#define WIFI_PROTOCOL_LR 8
+esp_err_t esp_wifi_init(const wifi_init_config_t*);
+esp_err_t esp_wifi_deinit(void);
+esp_err_t esp_wifi_set_mode(wifi_mode_t);
+esp_err_t esp_wifi_get_mode(wifi_mode_t*);
+esp_err_t esp_wifi_start(void);
+esp_err_t esp_wifi_stop(void);
+esp_err_t esp_wifi_connect(void);
+esp_err_t esp_wifi_disconnect(void);
+esp_err_t esp_wifi_set_config(wifi_interface_t, wifi_config_t*);
+esp_err_t esp_wifi_get_config(wifi_interface_t, wifi_config_t*);
+esp_err_t esp_wifi_get_mac(wifi_interface_t, uint8_t*);
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t);
+esp_err_t esp_wifi_get_ps(wifi_ps_type_t*);
+esp_err_t esp_wifi_set_max_tx_power(int8_t);
+esp_err_t esp_wifi_get_max_tx_power(int8_t*);
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t*);
+esp_err_t esp_wifi_sta_get_rssi(int*);
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t*, bool);
+esp_err_t esp_wifi_scan_stop(void);
+esp_err_t esp_wifi_scan_get_ap_num(uint16_t*);
+esp_err_t esp_wifi_scan_get_ap_records(uint16_t*, wifi_ap_record_t*);
+esp_err_t esp_wifi_clear_ap_list(void);
+esp_err_t esp_wifi_set_rssi_threshold(int32_t);
+esp_err_t esp_wifi_get_protocol(wifi_interface_t, uint8_t*);
+esp_err_t esp_wifi_set_protocol(wifi_interface_t, uint8_t);
+esp_err_t esp_wifi_set_bandwidth(wifi_interface_t, wifi_bandwidth_t);
+esp_err_t esp_wifi_sta_get_negotiated_phymode(wifi_phy_mode_t*);
+esp_err_t esp_wifi_set_channel(uint8_t, wifi_second_chan_t);
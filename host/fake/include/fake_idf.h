@@ -0,0 +1,110 @@
+/**
+ * fake_idf.h
+ * Control interface of the in-process ESP-IDF fake used by the host build
+ * 
+ * The fake is single-threaded: events are queued by the fake driver and
+ * dispatched when the caller drains the queue, and timers fire when the
+ * virtual clock is advanced. Nothing blocks, a semaphore take outside a
+ * handler drains the event queue instead.
+ */
+
+#ifndef FAKE_IDF_H
+#define FAKE_IDF_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "esp_event.h"
+#include "esp_wifi.h"
+
+/**
+ * Calls made into the fake, for per-event cost reporting
+ */
+struct FakeIdfCounters {
+    uint32_t wifi_connect;     // esp_wifi_connect()
+    uint32_t wifi_disconnect;  // esp_wifi_disconnect()
+    uint32_t wifi_set_config;  // esp_wifi_set_config()
+    uint32_t scans;            // esp_wifi_scan_start()
+    uint32_t nvs_writes;       // nvs_set_blob/nvs_set_str/nvs_erase_key
+    uint32_t nvs_commits;      // nvs_commit()
+    uint32_t timer_starts;     // esp_timer_start_once/periodic()
+    uint32_t espnow_sends;     // esp_now_send() calls that were queued
+};
+
+/**
+ * Drop all fake state: NVS contents, queued events, handlers, timers and counters
+ */
+void fake_idf_reset();
+
+/**
+ * Queue an event as the driver would post it
+ * 
+ * @param base Event base
+ * @param id Event id
+ * @param data Payload, copied
+ * @param len Payload size
+ */
+void fake_idf_post(esp_event_base_t base, int32_t id, const void* data, size_t len);
+
+/**
+ * Call the registered handlers for an event right away
+ * 
+ * @param base Event base
+ * @param id Event id
+ * @param data Payload passed to the handlers as-is
+ */
+void fake_idf_dispatch(esp_event_base_t base, int32_t id, void* data);
+
+/**
+ * Dispatch queued events until the queue is empty
+ * 
+ * @return Number of events dispatched
+ */
+size_t fake_idf_run_events();
+
+/**
+ * Advance the virtual clock, firing due timers in order
+ * 
+ * @param us Microseconds to advance
+ */
+void fake_idf_advance_time(int64_t us);
+
+/**
+ * Set the access points returned by the next scans
+ * 
+ * @param records Access points
+ * @param count Number of records, at most 32
+ */
+void fake_idf_set_scan_results(const wifi_ap_record_t* records, uint16_t count);
+
+/**
+ * Keep the scans running, SCAN_DONE is posted once they are released
+ * 
+ * @param hold true to hold, false to post the SCAN_DONE of a held scan
+ */
+void fake_idf_hold_scans(bool hold);
+
+/**
+ * Set the AP reported by esp_wifi_sta_get_ap_info()
+ * 
+ * @param ap AP the station is associated with, or nullptr if not associated
+ */
+void fake_idf_set_associated(const wifi_ap_record_t* ap);
+
+/**
+ * Deliver an ESP-NOW frame to the registered receive callback
+ * 
+ * @param mac Sender address
+ * @param data Payload
+ * @param len Payload size
+ */
+void fake_idf_espnow_receive(const uint8_t* mac, const uint8_t* data, size_t len);
+
+/**
+ * Get the call counters
+ * 
+ * @return Counters since the last reset
+ */
+const FakeIdfCounters& fake_idf_counters();
+
+#endif // FAKE_IDF_H
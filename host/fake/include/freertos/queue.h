@@ -0,0 +1,8 @@
+// Host fake of the ESP-IDF freertos/queue.h header, only what bi_wifi uses
+#pragma once
+#include "FreeRTOS.h"
+typedef void* QueueHandle_t;
+QueueHandle_t xQueueCreate(UBaseType_t, UBaseType_t);
+BaseType_t xQueueSend(QueueHandle_t, const void*, TickType_t);
+BaseType_t xQueueReceive(QueueHandle_t, void*, TickType_t);
+void vQueueDelete(QueueHandle_t);
@@ -0,0 +1,15 @@
+// Host fake of the ESP-IDF freertos/semphr.h header, only what bi_wifi uses
+#pragma once
+#include "FreeRTOS.h"
+typedef void* SemaphoreHandle_t;
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+typedef struct { void* pad[4]; } StaticSemaphore_t;
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t*);
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t*);
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t);
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t, TickType_t);
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t);
+void vSemaphoreDelete(SemaphoreHandle_t);
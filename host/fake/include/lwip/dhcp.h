@@ -0,0 +1,6 @@
+// Host fake of the ESP-IDF lwip/dhcp.h header, only what bi_wifi uses
+#pragma once
+#include <stdint.h>
+struct dhcp { uint32_t offered_t0_lease; uint32_t offered_t1_renew; };
+struct netif { struct dhcp* d; };
+#define netif_dhcp_data(n) ((n)->d)
@@ -0,0 +1,7 @@
+// Host fake of the ESP-IDF lwip/ip_addr.h header, only what bi_wifi uses
+#pragma once
+#include <stdint.h>
+typedef struct { uint32_t addr; } ip4_addr_t;
+typedef struct { union { ip4_addr_t ip4; } u_addr; uint8_t type; } ip_addr_t;
+#define IPADDR_TYPE_V4 0
+#define ip_addr_set_ip4_u32(a, v) do { (a)->u_addr.ip4.addr = (v); (a)->type = IPADDR_TYPE_V4; } while (0)
@@ -0,0 +1,6 @@
+// Host fake of the ESP-IDF mbedtls/pkcs5.h header, only what bi_wifi uses
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+typedef enum { MBEDTLS_MD_NONE, MBEDTLS_MD_SHA1 } mbedtls_md_type_t;
+int mbedtls_pkcs5_pbkdf2_hmac_ext(mbedtls_md_type_t, const unsigned char*, size_t, const unsigned char*, size_t, unsigned int, uint32_t, unsigned char*);
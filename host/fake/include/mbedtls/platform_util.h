@@ -0,0 +1,4 @@
+// Host fake of the ESP-IDF mbedtls/platform_util.h header, only what bi_wifi uses
+#pragma once
+#include <stddef.h>
+void mbedtls_platform_zeroize(void*, size_t);
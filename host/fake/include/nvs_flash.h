@@ -0,0 +1,5 @@
+// Host fake of the ESP-IDF nvs_flash.h header, only what bi_wifi uses
+#pragma once
+#include "esp_err.h"
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
@@ -0,0 +1,15 @@
+// Host fake of the ESP-IDF ping/ping_sock.h header, only what bi_wifi uses
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+#include "lwip/ip_addr.h"
+typedef void* esp_ping_handle_t;
+typedef struct { void* cb_args; void (*on_ping_success)(esp_ping_handle_t, void*); void (*on_ping_timeout)(esp_ping_handle_t, void*); void (*on_ping_end)(esp_ping_handle_t, void*); } esp_ping_callbacks_t;
+typedef struct { uint32_t count; uint32_t interval_ms; uint32_t timeout_ms; uint32_t data_size; int tos; int ttl; ip_addr_t target_addr; uint32_t task_stack_size; uint32_t task_prio; uint32_t interface; } esp_ping_config_t;
+#define ESP_PING_DEFAULT_CONFIG() { 5, 1000, 1000, 64, 0, 64, {}, 2048, 2, 0 }
+typedef enum { ESP_PING_PROF_SEQNO, ESP_PING_PROF_TIMEGAP } esp_ping_profile_t;
+esp_err_t esp_ping_new_session(const esp_ping_config_t*, const esp_ping_callbacks_t*, esp_ping_handle_t*);
+esp_err_t esp_ping_delete_session(esp_ping_handle_t);
+esp_err_t esp_ping_start(esp_ping_handle_t);
+esp_err_t esp_ping_stop(esp_ping_handle_t);
+esp_err_t esp_ping_get_profile(esp_ping_handle_t, esp_ping_profile_t, void*, uint32_t);
@@ -0,0 +1,7 @@
+// Host fake of the generated sdkconfig.h, the configuration the benchmark builds
+#pragma once
+#define CONFIG_BT_ENABLED 1
+#define CONFIG_ESP_COEX_SW_COEXIST_ENABLE 1
+#define CONFIG_BI_WIFI_PROVISIONING 1
+#define CONFIG_BI_WIFI_PROVISIONING_BLE 1
+#define CONFIG_BI_WIFI_RELEASE_BT_MEMORY 1
@@ -0,0 +1,19 @@
+// Host fake of the ESP-IDF wifi_provisioning/manager.h header, only what bi_wifi uses
+#pragma once
+#include "esp_wifi.h"
+typedef struct { void (*prov_start)(void*, void*); int a; } wifi_prov_scheme_t;
+typedef struct { void* event_cb; void* user_data; } wifi_prov_event_handler_t;
+#define WIFI_PROV_EVENT_HANDLER_NONE { NULL, NULL }
+typedef struct { uint32_t wifi_conn_attempts; } wifi_prov_conn_cfg_t;
+typedef struct { wifi_prov_scheme_t scheme; wifi_prov_event_handler_t scheme_event_handler; wifi_prov_event_handler_t app_event_handler; wifi_prov_conn_cfg_t wifi_prov_conn_cfg; } wifi_prov_mgr_config_t;
+typedef enum { WIFI_PROV_INIT, WIFI_PROV_START, WIFI_PROV_CRED_RECV, WIFI_PROV_CRED_FAIL, WIFI_PROV_CRED_SUCCESS, WIFI_PROV_END, WIFI_PROV_DEINIT } wifi_prov_cb_event_t;
+typedef enum { WIFI_PROV_STA_AUTH_ERROR, WIFI_PROV_STA_AP_NOT_FOUND } wifi_prov_sta_fail_reason_t;
+typedef enum { WIFI_PROV_SECURITY_0, WIFI_PROV_SECURITY_1, WIFI_PROV_SECURITY_2 } wifi_prov_security_t;
+esp_err_t wifi_prov_mgr_init(wifi_prov_mgr_config_t);
+void wifi_prov_mgr_deinit(void);
+esp_err_t wifi_prov_mgr_is_provisioned(bool*);
+esp_err_t wifi_prov_mgr_start_provisioning(wifi_prov_security_t, const void*, const char*, const char*);
+void wifi_prov_mgr_stop_provisioning(void);
+esp_err_t wifi_prov_mgr_reset_provisioning(void);
+esp_err_t wifi_prov_mgr_disable_auto_stop(uint32_t);
+extern esp_event_base_t WIFI_PROV_EVENT;
@@ -0,0 +1,8 @@
+// Host fake of the ESP-IDF wifi_provisioning/scheme_ble.h header, only what bi_wifi uses
+#pragma once
+#include "manager.h"
+extern const wifi_prov_scheme_t wifi_prov_scheme_ble;
+#define WIFI_PROV_SCHEME_BLE_EVENT_HANDLER_FREE_BTDM { (void*)1, NULL }
+#define WIFI_PROV_SCHEME_BLE_EVENT_HANDLER_FREE_BLE { NULL, NULL }
+#define WIFI_PROV_SCHEME_BLE_EVENT_HANDLER_FREE_BT { NULL, NULL }
+esp_err_t wifi_prov_scheme_ble_set_service_uuid(uint8_t*);
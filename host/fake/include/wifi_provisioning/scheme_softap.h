@@ -0,0 +1,6 @@
+// Host fake of the ESP-IDF wifi_provisioning/scheme_softap.h header, only what bi_wifi uses
+#pragma once
+#include "manager.h"
+extern const wifi_prov_scheme_t wifi_prov_scheme_softap;
+#define WIFI_PROV_SCHEME_SOFTAP_EVENT_HANDLER_NONE WIFI_PROV_EVENT_HANDLER_NONE
+void wifi_prov_scheme_softap_set_httpd_handle(void*);
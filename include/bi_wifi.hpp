@@ -9,18 +9,61 @@
 #define BI_WIFI_HPP
 
 #include <string>
+#include <string_view>
 #include <memory>
 #include <functional>
+#include <atomic>
+#include <initializer_list>
+#include <type_traits>
 
+#include "sdkconfig.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "esp_netif.h"
+#include "esp_timer.h"
+#include "ping/ping_sock.h"
+#if CONFIG_BI_WIFI_PROVISIONING
 #include "wifi_provisioning/manager.h"
 #include "wifi_provisioning/scheme_softap.h"
+#if CONFIG_BI_WIFI_PROVISIONING_BLE
+#include "wifi_provisioning/scheme_ble.h"
+#endif
+#endif
 
+// Capacity of the observer registry, see WiFiManager::addObserver()
+#ifndef BI_WIFI_MAX_OBSERVERS
+#define BI_WIFI_MAX_OBSERVERS 4
+#endif
+
+// Capacity of the pre-seeded hostname table, see addHostEntry()
+#ifndef BI_WIFI_MAX_HOST_ENTRIES
+#define BI_WIFI_MAX_HOST_ENTRIES 4
+#endif
+
+/**
+ * WiFi manager
+ * 
+ * Methods that change the connection, provisioning, stored networks or
+ * settings can be called from any task once init() returned: they are
+ * queued and run one at a time on the task that handles the WiFi events
+ * (the event loop task, or the worker task when it is running) while the
+ * caller waits for the result. Calls made on that task, which includes
+ * observers and the connection callback, run inline. With the worker
+ * running, do not call them from other handlers of the default event loop.
+ * getState(), getIPv4(), getIPAddress() and getSSID() read snapshots and
+ * never block. The getters that return structs (metrics, configs, scan
+ * results, link events) copy them on that task the same way.
+ *
+ * The WiFi driver, esp_netif and the default event loop are shared through
+ * WiFiDriver, so a SoftApService or EspNowChannel can run next to the
+ * manager and components that started them first keep working. More than
+ * one manager can be initialized, but only one should connect the station.
+ */
 class WiFiManager {
 public:
     enum class WiFiState {
@@ -31,14 +74,445 @@ public:
         ERROR
     };
 
+    enum class PowerProfile {
+        LOW_LATENCY,  // No modem sleep, maximum TX power
+        BALANCED,     // Minimum modem sleep (wake every DTIM)
+        MAX_SAVING    // Maximum modem sleep with a long listen interval, reduced TX power
+    };
+
+    enum class DriverProfile {
+        LOW_MEMORY,       // Few buffers, no AMPDU, for memory-starved devices
+        BALANCED,         // The menuconfig defaults (WIFI_INIT_CONFIG_DEFAULT)
+        HIGH_THROUGHPUT,  // Many buffers and wide AMPDU windows, for bulk transfers
+        CUSTOM            // Set with init(const DriverConfig&)
+    };
+
+    /**
+     * Reconnect scheduler settings
+     */
+    struct ReconnectPolicy {
+        uint32_t base_delay_ms;     // Delay ceiling of the first retry
+        uint32_t max_delay_ms;      // Upper bound of the exponential delay ceiling
+        uint32_t max_attempts;      // Retries before giving up, 0 for unlimited
+        bool provision_on_failure;  // Start provisioning instead of going to ERROR, keeping the stored credentials
+    };
+
+    /**
+     * Worker task settings
+     */
+    struct WorkerConfig {
+        uint32_t stack_size;   // Stack size in bytes
+        UBaseType_t priority;  // FreeRTOS task priority
+        BaseType_t core_id;    // Core to pin the task to, or tskNO_AFFINITY
+    };
+
+    enum class ProvisioningScheme {
+        SOFTAP,  // Phone joins a temporary AP, needs APSTA mode
+        BLE      // Phone connects over BLE, WiFi stays in STA mode
+    };
+
     using ConnectionCallback = std::function<void(WiFiState state, void* data)>;
 
+    enum class ConnectResult {
+        CONNECTED,     // Got an IP address
+        FAILED,        // Gave up, see the disconnect reason
+        TIMEOUT,       // Still not connected when the timeout expired
+        PROVISIONING,  // No stored credentials, provisioning was started
+        START_FAILED   // The connection could not be started
+    };
+
+    /**
+     * Duration statistics of one connection phase, in microseconds
+     */
+    struct PhaseStats {
+        uint32_t last_us;
+        uint32_t min_us;
+        uint32_t max_us;
+        uint32_t ewma_us;  // Exponentially weighted moving average, alpha = 1/8
+        uint32_t count;
+    };
+
+    /**
+     * Connection-phase latency and disconnect counters, reset on boot
+     */
+    struct Metrics {
+        PhaseStats init;                // init()
+        PhaseStats nvs_load;            // Credential load from NVS
+        PhaseStats scan;                // Network selection scan
+        PhaseStats assoc;               // esp_wifi_connect() to WIFI_EVENT_STA_CONNECTED
+        PhaseStats dhcp;                // WIFI_EVENT_STA_CONNECTED to IP_EVENT_STA_GOT_IP
+        PhaseStats provisioning_start;  // startProvisioning() to WIFI_PROV_START
+        PhaseStats provisioning_creds;  // WIFI_PROV_START to WIFI_PROV_CRED_RECV
+        PhaseStats provisioning_end;    // WIFI_PROV_CRED_RECV to WIFI_PROV_END
+        uint32_t provisioning_reclaimed_bytes;  // Heap freed by the last provisioning teardown
+        uint32_t reconnects;            // Reconnect attempts scheduled
+        uint32_t roam_scans;            // Background scans triggered by low RSSI
+        uint32_t roams;                 // Moves to a better AP of the same network
+        uint32_t scan_cache_hits;       // Scans skipped because the cache was fresh
+        PhaseStats probe_rtt;           // Gateway probe round trip
+        uint32_t probe_misses;          // Gateway probes without a reply
+        uint32_t link_failures;         // Reassociations forced by the link watchdog
+        uint32_t disconnects;           // WIFI_EVENT_STA_DISCONNECTED events
+
+        // Disconnects per reason, see getDisconnectCount(). 802.11 reasons 0..63
+        // use the bucket of the same index, ESP reasons 200..231 buckets 64..95,
+        // and every other reason (64..199, 232+) the REASON_OTHER bucket.
+        static constexpr size_t REASON_BUCKETS = 97;
+        static constexpr size_t REASON_OTHER = REASON_BUCKETS - 1;
+        uint16_t disconnect_reasons[REASON_BUCKETS];
+    };
+
+    /**
+     * Link event recorded in the link event log
+     */
+    struct LinkEvent {
+        enum class Type : uint8_t {
+            CONNECTED,     // WIFI_EVENT_STA_CONNECTED
+            DISCONNECTED   // WIFI_EVENT_STA_DISCONNECTED
+        };
+        uint32_t timestamp_ms;  // Milliseconds since boot
+        Type type;
+        uint8_t reason;         // wifi_err_reason_t, 0 for CONNECTED
+        int8_t rssi;            // RSSI in dBm, 0 if unknown
+        uint8_t channel;
+        uint8_t bssid[6];
+        WiFiState state;        // Manager state when the event happened
+    };
+
+    /**
+     * Fixed-size, allocation-free ring buffer of recent link events
+     * 
+     * Once full, each new event overwrites the oldest one. Iteration goes
+     * from the oldest to the newest event.
+     */
+    class LinkEventLog {
+    public:
+        static constexpr size_t CAPACITY = 32;
+
+        // Size of one serialized event and of the serialized header
+        static constexpr size_t SERIALIZED_EVENT_SIZE = 15;
+        static constexpr size_t SERIALIZED_HEADER_SIZE = 2;
+        static constexpr uint8_t SERIALIZED_VERSION = 1;
+
+        class const_iterator {
+        public:
+            const_iterator(const LinkEventLog* log, size_t index) : log_(log), index_(index) {}
+            const LinkEvent& operator*() const { return (*log_)[index_]; }
+            const LinkEvent* operator->() const { return &(*log_)[index_]; }
+            const_iterator& operator++() { ++index_; return *this; }
+            bool operator!=(const const_iterator& other) const { return index_ != other.index_; }
+            bool operator==(const const_iterator& other) const { return index_ == other.index_; }
+        private:
+            const LinkEventLog* log_;
+            size_t index_;
+        };
+
+        LinkEventLog();
+
+        /**
+         * Append an event, overwriting the oldest one if full
+         * 
+         * @param event Event to append
+         */
+        void push(const LinkEvent& event);
+
+        /**
+         * Remove all events
+         */
+        void clear();
+
+        /**
+         * Get the number of events in the log
+         * 
+         * @return Number of events, at most CAPACITY
+         */
+        size_t size() const;
+
+        /**
+         * Get an event by age
+         * 
+         * @param index 0 for the oldest event, size() - 1 for the newest
+         * @return Event at that position
+         */
+        const LinkEvent& operator[](size_t index) const;
+
+        const_iterator begin() const { return const_iterator(this, 0); }
+        const_iterator end() const { return const_iterator(this, size()); }
+
+        /**
+         * Serialize the log into a compact little-endian binary blob
+         * 
+         * Layout: version (1), count (1), then per event from oldest to newest:
+         * timestamp_ms (4), type (1), reason (1), rssi (1), channel (1),
+         * bssid (6), state (1). If the buffer is too small only the newest
+         * events that fit are written.
+         * 
+         * @param buf Output buffer, or nullptr to query the required size
+         * @param len Size of the output buffer
+         * @return Number of bytes written (or required if buf is nullptr)
+         */
+        size_t serialize(uint8_t* buf, size_t len) const;
+
+    private:
+        LinkEvent events_[CAPACITY];
+        size_t head_;   // Next slot to write
+        size_t count_;
+    };
+
+    /**
+     * Events delivered to observers, see addObserver()
+     */
+    enum class EventType : uint8_t {
+        STATE_CHANGED,  // Manager state changed
+        GOT_IP,         // IP_EVENT_STA_GOT_IP, payload in Notification::ip_info
+        LOST_IP,        // IP_EVENT_STA_LOST_IP
+        DISCONNECTED    // WIFI_EVENT_STA_DISCONNECTED, payload in Notification::disconnect
+    };
+
+    // Observer event masks, one bit per EventType
+    static constexpr uint32_t eventMask(EventType type) { return (uint32_t)1 << (uint32_t)type; }
+    static constexpr uint32_t EVENT_MASK_ALL = 0xFFFFFFFF;
+
+    /**
+     * Event payload passed to observers
+     */
+    struct Notification {
+        EventType type;
+        WiFiState state;                   // Manager state when the observer runs
+        union {
+            esp_netif_ip_info_t ip_info;   // GOT_IP
+            struct {
+                uint8_t reason;            // wifi_err_reason_t
+                int8_t rssi;
+            } disconnect;                  // DISCONNECTED
+            struct {
+                uint32_t down_ms;          // Time since the last reported CONNECTED or start
+                uint16_t reconnects;       // Reconnect attempts in that time
+                uint16_t merged;           // State changes folded into this notification
+                uint8_t last_reason;       // Last disconnect reason (wifi_err_reason_t), 0 if none
+            } summary;                     // STATE_CHANGED, only filled with coalescing
+        };
+    };
+
+    using ObserverFn = void (*)(const Notification& notification, void* ctx);
+
+    /**
+     * Fixed-capacity registry of function pointer observers
+     * 
+     * Dispatch is a plain loop over the registered entries, nothing is
+     * allocated or type-erased. Observers run in the context that raised
+     * the event (event loop or worker task) and must not block.
+     * 
+     * @tparam N Maximum number of observers
+     */
+    template <size_t N>
+    class ObserverRegistry {
+    public:
+        ObserverRegistry() : entries_{}, count_(0) {}
+
+        /**
+         * Register an observer, or update the mask if already registered
+         * 
+         * @param fn Function to call
+         * @param ctx Context passed back to fn
+         * @param mask Events to deliver, see eventMask()
+         * @return true if registered, false if fn is null or the registry is full
+         */
+        bool add(ObserverFn fn, void* ctx, uint32_t mask) {
+            if (!fn) {
+                return false;
+            }
+            for (size_t i = 0; i < count_; i++) {
+                if (entries_[i].fn == fn && entries_[i].ctx == ctx) {
+                    entries_[i].mask = mask;
+                    return true;
+                }
+            }
+            if (count_ >= N) {
+                return false;
+            }
+            entries_[count_] = {fn, ctx, mask};
+            count_++;
+            return true;
+        }
+
+        /**
+         * Unregister an observer
+         * 
+         * @param fn Function passed to add()
+         * @param ctx Context passed to add()
+         * @return true if the observer was registered
+         */
+        bool remove(ObserverFn fn, void* ctx) {
+            for (size_t i = 0; i < count_; i++) {
+                if (entries_[i].fn == fn && entries_[i].ctx == ctx) {
+                    for (size_t j = i + 1; j < count_; j++) {
+                        entries_[j - 1] = entries_[j];
+                    }
+                    count_--;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Call every observer whose mask includes the notification type
+         * 
+         * @param notification Event to deliver
+         */
+        void notify(const Notification& notification) const {
+            uint32_t bit = eventMask(notification.type);
+            for (size_t i = 0; i < count_; i++) {
+                if (entries_[i].mask & bit) {
+                    entries_[i].fn(notification, entries_[i].ctx);
+                }
+            }
+        }
+
+        size_t size() const { return count_; }
+        static constexpr size_t capacity() { return N; }
+
+    private:
+        struct Entry {
+            ObserverFn fn;
+            void* ctx;
+            uint32_t mask;
+        };
+        Entry entries_[N];
+        size_t count_;
+    };
+
+    /**
+     * Roaming settings
+     */
+    struct RoamingConfig {
+        bool enabled;                   // Also enables 802.11k/v in the STA config
+        uint32_t sample_interval_ms;    // RSSI sampling period
+        int8_t rssi_threshold;          // Smoothed RSSI below which a scan starts
+        uint8_t rssi_hysteresis;        // dB a candidate must beat the current AP by
+        uint32_t min_roam_interval_ms;  // Minimum time between roaming scans
+    };
+
+    enum class ScanMode {
+        FIRST_MATCH,   // Stop at the first channel with a known network (WIFI_FAST_SCAN)
+        ALL_CHANNELS   // Scan every channel and pick the strongest AP (WIFI_ALL_CHANNEL_SCAN)
+    };
+
+    /**
+     * Scan engine settings
+     */
+    struct ScanConfig {
+        ScanMode mode;
+        bool passive;                   // Listen for beacons instead of sending probes
+        uint16_t active_min_ms;         // Active dwell time per channel
+        uint16_t active_max_ms;
+        uint16_t passive_ms;            // Passive dwell time per channel
+        uint16_t channel_mask;          // Bit n for channel n, 0 to learn it from history
+        uint32_t cache_ttl_ms;          // How long scan results are reused
+    };
+
+    /**
+     * Link watchdog settings
+     */
+    struct LinkWatchdogConfig {
+        bool enabled;
+        uint32_t min_interval_ms;       // Probe period after connecting or a miss
+        uint32_t max_interval_ms;       // Period reached by doubling while the link is healthy
+        uint32_t timeout_ms;            // Time to wait for each reply
+        uint8_t max_misses;             // Consecutive misses before reassociating
+    };
+
+    /**
+     * State notification coalescing settings, see setNotifyConfig()
+     */
+    struct NotifyConfig {
+        bool enabled;
+        uint32_t disconnect_dwell_ms;   // Time the link must stay down before it is reported
+    };
+
+    /**
+     * Static IPv4 settings of a stored network, an ip of 0.0.0.0 means DHCP
+     */
+    struct StaticIpConfig {
+        esp_ip4_addr_t ip;
+        esp_ip4_addr_t netmask;
+        esp_ip4_addr_t gw;
+        esp_ip4_addr_t dns[2];  // Main and backup, 0.0.0.0 if unused
+    };
+
+    /**
+     * WiFi driver buffer settings, applied by init()
+     * 
+     * Each buffer is about 1.6 KB. Static RX buffers are allocated when the
+     * driver starts, dynamic buffers are limits reached under load.
+     */
+    struct DriverConfig {
+        uint16_t static_rx_buf_num;   // At least 2
+        uint16_t dynamic_rx_buf_num;  // 0 for no limit
+        uint16_t static_tx_buf_num;   // Used with static TX buffers (CONFIG_ESP_WIFI_STATIC_TX_BUFFER)
+        uint16_t dynamic_tx_buf_num;  // Used with dynamic TX buffers, at least 1
+        uint16_t cache_tx_buf_num;    // Only used with PSRAM
+        bool ampdu_rx_enable;
+        bool ampdu_tx_enable;
+        uint8_t rx_ba_win;            // AMPDU RX block ack window, 2 to 32
+        uint8_t tx_ba_win;            // AMPDU TX block ack window, 2 to 32
+    };
+
+    /**
+     * Fast-connect counters, reset on boot
+     */
+    struct FastConnectStats {
+        uint32_t attempts;   // Connections started with a known BSSID/channel
+        uint32_t hits;       // Attempts that got an IP without a full scan
+        uint32_t fallbacks;  // Attempts that fell back to an all-channel scan
+    };
+
+    /**
+     * Heap state at one point in time, in bytes
+     */
+    struct HeapSnapshot {
+        uint32_t free;           // MALLOC_CAP_8BIT
+        uint32_t min_free;       // MALLOC_CAP_8BIT low-water mark since boot
+        uint32_t free_internal;  // MALLOC_CAP_INTERNAL
+        uint32_t free_dma;       // MALLOC_CAP_DMA
+        uint32_t largest_block;  // Largest free MALLOC_CAP_8BIT block
+    };
+
+    /**
+     * Heap used by one API call
+     */
+    struct FootprintPhase {
+        HeapSnapshot before;     // Around the last call
+        HeapSnapshot after;
+        int32_t last_delta;      // Bytes kept by the last call, negative if it freed memory
+        int32_t total_delta;     // Sum over all calls
+        uint32_t count;
+    };
+
+    /**
+     * Heap and stack footprint, reset on boot
+     */
+    struct Footprint {
+        FootprintPhase init;
+        FootprintPhase connect;
+        FootprintPhase start_provisioning;
+        FootprintPhase stop_provisioning;
+        uint32_t connected_count;        // IP acquisitions seen
+        uint32_t connected_free_first;   // Free heap at the first IP acquisition
+        uint32_t connected_free_last;    // Free heap at the latest IP acquisition
+        uint32_t connected_free_min;     // Lowest free heap at an IP acquisition
+        uint32_t event_task_stack_free;  // Stack high-water mark of the event handler task, in bytes
+    };
+
     /**
      * Constructor
      * 
      * @param nvs_namespace Namespace for storing WiFi credentials in NVS
+     * @param driver_profile WiFi driver buffer profile applied by init()
      */
-    WiFiManager(const std::string& nvs_namespace = "wifi_config");
+    WiFiManager(const std::string& nvs_namespace = "wifi_config", 
+                DriverProfile driver_profile = DriverProfile::BALANCED);
     
     /**
      * Destructor
@@ -48,10 +522,47 @@ public:
     /**
      * Initialize WiFi subsystem
      * 
+     * The driver profile is checked against the free internal heap first.
+     * If its static buffers do not fit, the next smaller profile is used,
+     * see getDriverProfile().
+     * 
      * @return true if initialization was successful
      */
     bool init();
 
+    /**
+     * Initialize WiFi subsystem with custom driver buffer settings
+     * 
+     * Start from driverProfileConfig() and override the fields to tune.
+     * 
+     * @param config Driver buffer settings
+     * @return true if initialization was successful, false if already
+     *         initialized or the settings are out of range
+     */
+    bool init(const DriverConfig& config);
+
+    /**
+     * Get the driver buffer settings of a profile
+     * 
+     * @param profile Driver profile, CUSTOM returns the BALANCED settings
+     * @return Driver buffer settings
+     */
+    static DriverConfig driverProfileConfig(DriverProfile profile);
+
+    /**
+     * Get the driver profile in use
+     * 
+     * @return Profile requested, or the one init() fell back to
+     */
+    DriverProfile getDriverProfile() const;
+
+    /**
+     * Get the driver buffer settings in use
+     * 
+     * @return Driver buffer settings of getDriverProfile()
+     */
+    DriverConfig getDriverConfig() const;
+
     /**
      * Connect to WiFi using stored credentials if available
      * or start provisioning if no credentials found
@@ -70,6 +581,71 @@ public:
      */
     bool connect(const std::string& ssid, const std::string& password, bool save = true);
 
+    /**
+     * Resume the connection after a deep sleep wake-up
+     * 
+     * Uses the last good connection context kept in RTC memory (credentials,
+     * BSSID, channel and DHCP lease) to reconnect without reading NVS or
+     * scanning. Falls back to connect() when not waking from deep sleep or
+     * when the context fails validation.
+     * 
+     * @return true if connection process started successfully
+     */
+    bool resumeFromSleep();
+
+    /**
+     * Connect to WiFi using stored credentials and wait for the result
+     * 
+     * Must not be called from the event loop task, the worker task or a
+     * connection callback, since those deliver the result.
+     * 
+     * @param timeout Maximum time to wait for an IP address
+     * @param reason Optional output for the last disconnect reason (wifi_err_reason_t)
+     * @return Result of the connection attempt
+     */
+    ConnectResult connectSync(TickType_t timeout, uint8_t* reason = nullptr);
+
+    /**
+     * Connect to WiFi with the given credentials and wait for the result
+     * 
+     * Same restrictions as connectSync(TickType_t, uint8_t*).
+     * 
+     * @param ssid WiFi SSID
+     * @param password WiFi password
+     * @param timeout Maximum time to wait for an IP address
+     * @param save Whether to save the credentials in NVS
+     * @param reason Optional output for the last disconnect reason (wifi_err_reason_t)
+     * @return Result of the connection attempt
+     */
+    ConnectResult connectSync(const std::string& ssid, const std::string& password, 
+                              TickType_t timeout, bool save = true, uint8_t* reason = nullptr);
+
+    /**
+     * Block until connected with an IP address
+     * 
+     * @param timeout Maximum time to wait
+     * @return true if connected before the timeout expired
+     */
+    bool waitForConnected(TickType_t timeout);
+
+    /**
+     * Block until the state is one of the given states
+     * 
+     * @param states States to wait for
+     * @param timeout Maximum time to wait
+     * @param reached Optional output for the state that was reached
+     * @return true if one of the states was reached before the timeout expired
+     */
+    bool waitForAny(std::initializer_list<WiFiState> states, TickType_t timeout, 
+                    WiFiState* reached = nullptr);
+
+    /**
+     * Get the reason of the last STA disconnect
+     * 
+     * @return wifi_err_reason_t value, or 0 if no disconnect happened yet
+     */
+    uint8_t getLastDisconnectReason() const;
+
     /**
      * Disconnect from WiFi
      * 
@@ -78,7 +654,18 @@ public:
     bool disconnect();
 
     /**
-     * Start WiFi provisioning mode using SoftAP
+     * Start WiFi provisioning mode using the default scheme
+     * 
+     * The default scheme is SoftAP unless changed with
+     * setProvisioningScheme(). It is also used when connect() or the
+     * reconnect policy start provisioning. When provisioning ends, the provisioning manager, its event handler
+     * and the SoftAP interface are torn down, and the Bluetooth controller
+     * memory is released if CONFIG_BI_WIFI_RELEASE_BT_MEMORY is set. The
+     * heap reclaimed is reported in Metrics::provisioning_reclaimed_bytes.
+     * Always fails if CONFIG_BI_WIFI_PROVISIONING is disabled.
+     * 
+     * The stored credentials are erased first. When the reconnect policy
+     * starts provisioning on its own they are kept until new ones are saved.
      * 
      * @param ap_ssid SSID for the SoftAP
      * @param ap_password Password for the SoftAP (empty for open network)
@@ -89,6 +676,56 @@ public:
     bool startProvisioning(const std::string& ap_ssid, const std::string& ap_password = "", 
                           uint8_t security = 1, const std::string& pop = "abcd1234");
 
+    /**
+     * Start WiFi provisioning mode with an explicit scheme
+     * 
+     * With BLE, the radio is shared with WiFi: coexistence prefers neither
+     * side and LOW_LATENCY falls back to BALANCED until provisioning ends,
+     * since modem sleep is required. Both schemes report the same
+     * provisioning metrics. BLE needs CONFIG_BI_WIFI_PROVISIONING_BLE and
+     * is unavailable once the Bluetooth controller memory was released.
+     * 
+     * @param scheme Transport used by the provisioning app
+     * @param service_name SoftAP SSID or BLE device name
+     * @param ap_password Password for the SoftAP (empty for open network), ignored for BLE
+     * @param security Whether to use security during provisioning (0 for none, 1 for secure)
+     * @param pop Proof of possession for secure provisioning
+     * @return true if provisioning started successfully
+     */
+    bool startProvisioning(ProvisioningScheme scheme, const std::string& service_name,
+                          const std::string& ap_password = "", uint8_t security = 1, 
+                          const std::string& pop = "abcd1234");
+
+    /**
+     * Start provisioning while keeping the stored credentials
+     * 
+     * Same as startProvisioning() with the default scheme, but the stored
+     * credentials stay until the provisioned ones are saved, so stopping
+     * provisioning without a new network leaves the old one usable.
+     * 
+     * @param service_name SoftAP SSID or BLE device name
+     * @param ap_password Password for the SoftAP (empty for open network), ignored for BLE
+     * @param security Whether to use security during provisioning (0 for none, 1 for secure)
+     * @param pop Proof of possession for secure provisioning
+     * @return true if provisioning started successfully
+     */
+    bool startReprovisioning(const std::string& service_name, const std::string& ap_password = "",
+                             uint8_t security = 1, const std::string& pop = "abcd1234");
+
+    /**
+     * Set the scheme used when provisioning starts without an explicit one
+     * 
+     * @param scheme Default provisioning scheme
+     */
+    void setProvisioningScheme(ProvisioningScheme scheme);
+
+    /**
+     * Get the default provisioning scheme
+     * 
+     * @return Default provisioning scheme
+     */
+    ProvisioningScheme getProvisioningScheme() const;
+
     /**
      * Stop WiFi provisioning mode
      * 
@@ -103,6 +740,190 @@ public:
      */
     void setConnectionCallback(ConnectionCallback callback, void* user_data = nullptr);
 
+    /**
+     * Register an observer for WiFi events
+     * 
+     * Up to BI_WIFI_MAX_OBSERVERS observers can be registered, each with
+     * its own event mask. Unlike setConnectionCallback(), nothing is
+     * allocated and registering does not replace other observers.
+     * 
+     * @param fn Function to call
+     * @param ctx Context passed back to fn
+     * @param mask Events to deliver, e.g. eventMask(EventType::GOT_IP)
+     * @return true if registered, false if the registry is full
+     */
+    bool addObserver(ObserverFn fn, void* ctx = nullptr, uint32_t mask = EVENT_MASK_ALL);
+
+    /**
+     * Unregister an observer
+     * 
+     * @param fn Function passed to addObserver()
+     * @param ctx Context passed to addObserver()
+     * @return true if the observer was registered
+     */
+    bool removeObserver(ObserverFn fn, void* ctx = nullptr);
+
+    /**
+     * Set how state changes are reported to the callback and observers
+     * 
+     * With coalescing enabled, CONNECTING and DISCONNECTED count as "down".
+     * Leaving CONNECTED is reported only once the link stayed down for
+     * disconnect_dwell_ms, and then as a single notification with the
+     * current state. Changes between CONNECTING and DISCONNECTED after that
+     * are not reported. A drop shorter than the dwell time is not reported
+     * at all. CONNECTED, PROVISIONING and ERROR are reported right away,
+     * with Notification::summary describing the outage before them.
+     * getState() and the wait functions always see the real state.
+     * 
+     * @param config Coalescing configuration, disabled by default
+     */
+    void setNotifyConfig(const NotifyConfig& config);
+
+    /**
+     * Get the state notification coalescing settings
+     * 
+     * @return Current coalescing configuration
+     */
+    NotifyConfig getNotifyConfig() const;
+
+    /**
+     * Start the worker task
+     * 
+     * WiFi, IP and provisioning events are copied into a lock-free ring
+     * buffer and handled on a dedicated task, so connection callbacks no
+     * longer run on the default event loop task. If the ring buffer is full,
+     * WiFi events the manager only logs are dropped (and counted); all other
+     * events make the event loop task wait until the worker frees a slot.
+     * 
+     * @param config Stack size, priority and core of the worker task
+     * @return true if the worker task is running
+     */
+    bool startWorker(const WorkerConfig& config = {4096, 5, tskNO_AFFINITY});
+
+    /**
+     * Stop the worker task after draining pending events
+     * 
+     * The event loop task waits for the worker to drain its queue, then
+     * handles the following events itself, so none is lost or reordered.
+     * Must not be called from the worker task, i.e. from an observer or
+     * the connection callback while the worker runs.
+     */
+    void stopWorker();
+
+    /**
+     * Check if the worker task is running
+     * 
+     * @return true if events are handled on the worker task
+     */
+    bool isWorkerRunning() const;
+
+    /**
+     * Get the number of events dropped because the worker queue was full
+     * 
+     * Only WiFi events the manager merely logs are dropped. Connection, IP,
+     * scan, provisioning and internal events make the event loop task wait
+     * for a free slot instead.
+     * 
+     * @return Number of dropped events
+     */
+    uint32_t getDroppedEventCount() const;
+
+    /**
+     * Add a network to the multi-network store
+     * 
+     * When the store holds networks, connect() runs a single scan and picks
+     * the visible candidate with the best combination of RSSI, priority and
+     * connection history, including the credentials saved by connect() and
+     * provisioning. An existing entry with the same SSID is replaced; when
+     * the store is full, the lowest-priority, least recently used entry is.
+     * 
+     * @param ssid WiFi SSID
+     * @param password WiFi password
+     * @param priority Higher values are preferred, one step outweighs 10 dB of RSSI
+     * @return true if the network was stored
+     */
+    bool addNetwork(const std::string& ssid, const std::string& password, uint8_t priority = 0);
+
+    /**
+     * Remove a network from the multi-network store
+     * 
+     * @param ssid WiFi SSID
+     * @return true if the network was found and removed
+     */
+    bool removeNetwork(const std::string& ssid);
+
+    /**
+     * Remove all networks from the multi-network store
+     * 
+     * @return true if the store was cleared successfully
+     */
+    bool clearNetworks();
+
+    /**
+     * Get the number of networks in the multi-network store
+     * 
+     * @return Number of stored networks
+     */
+    size_t getNetworkCount();
+
+    /**
+     * Use a static IPv4 address on a stored network
+     * 
+     * Applies to the credentials saved by connect() or provisioning and to
+     * the multi-network store. The address and DNS servers are set before
+     * esp_wifi_connect() and the DHCP client is not run on that network,
+     * so the IP is available as soon as the station associates. Takes
+     * effect on the next connection to the network.
+     * 
+     * @param ssid WiFi SSID of a stored network
+     * @param config Static IPv4 settings, an ip of 0.0.0.0 goes back to DHCP
+     * @return true if the network was found and the settings were saved
+     */
+    bool setStaticIp(const std::string& ssid, const StaticIpConfig& config);
+
+    /**
+     * Get the static IPv4 settings of a stored network
+     * 
+     * @param ssid WiFi SSID of a stored network
+     * @param config Filled with the settings
+     * @return true if the network uses a static address
+     */
+    bool getStaticIp(const std::string& ssid, StaticIpConfig* config);
+
+    /**
+     * Pre-seed the address of a hostname
+     * 
+     * Seeded hostnames are answered by resolveHost() without a DNS query,
+     * so the first request after connecting does not wait on DNS. Entries
+     * never expire and are kept in RAM only.
+     * 
+     * @param hostname Hostname, at most 63 characters, compared case-insensitively
+     * @param addr IPv4 address
+     * @return true if added or updated, false if the table is full
+     */
+    bool addHostEntry(const char* hostname, esp_ip4_addr_t addr);
+
+    /**
+     * Remove a pre-seeded hostname
+     * 
+     * @param hostname Hostname
+     * @return true if the hostname was in the table
+     */
+    bool removeHostEntry(const char* hostname);
+
+    /**
+     * Resolve a hostname to an IPv4 address
+     * 
+     * Looks the hostname up in the pre-seeded table first and falls back
+     * to a blocking DNS query through lwIP. The table lookup runs on the
+     * calling task and never waits for queued commands.
+     * 
+     * @param hostname Hostname
+     * @param addr Filled with the address
+     * @return true if the hostname was resolved
+     */
+    bool resolveHost(const char* hostname, esp_ip4_addr_t* addr);
+
     /**
      * Check if WiFi credentials are stored in NVS
      * 
@@ -124,6 +945,55 @@ public:
      */
     WiFiState getState() const;
 
+    /**
+     * Set the power-save profile
+     * 
+     * Applies the modem sleep mode and TX power immediately. The listen
+     * interval is part of the STA configuration and takes effect on the next
+     * association. Provisioning always runs with LOW_LATENCY, the requested
+     * profile is restored when it ends.
+     * 
+     * @param profile Power-save profile to use
+     * @return true if the profile was applied successfully
+     */
+    bool setPowerProfile(PowerProfile profile);
+
+    /**
+     * Get the active power-save profile
+     * 
+     * @return Profile currently applied to the radio
+     */
+    PowerProfile getPowerProfile() const;
+
+    /**
+     * Set the reconnect scheduler policy
+     * 
+     * After a disconnect, retries are delayed by a random time between 0 and
+     * min(max_delay_ms, base_delay_ms * 2^attempt) (full jitter), so a fleet
+     * does not hit a rebooting AP at the same moment. Disconnects caused by
+     * wrong credentials are not retried. Once max_attempts is reached the
+     * state goes to ERROR, or provisioning starts if provision_on_failure is
+     * set. The stored credentials are kept, so they are used again on the
+     * next boot if provisioning is not completed.
+     * 
+     * @param policy Reconnect policy to use
+     */
+    void setReconnectPolicy(const ReconnectPolicy& policy);
+
+    /**
+     * Get the reconnect scheduler policy
+     * 
+     * @return Current reconnect policy
+     */
+    ReconnectPolicy getReconnectPolicy() const;
+
+    /**
+     * Get the number of reconnect attempts since the last successful connection
+     * 
+     * @return Number of scheduled reconnect attempts
+     */
+    uint32_t getReconnectAttempts() const;
+
     /**
      * Get current WiFi SSID
      * 
@@ -131,6 +1001,26 @@ public:
      */
     std::string getSSID() const;
 
+    /**
+     * Copy the current WiFi SSID into a caller buffer
+     * 
+     * @param buf Destination, always NUL-terminated
+     * @param len Size of buf (33 bytes fits any SSID)
+     * @return Number of characters copied, 0 if disconnected
+     */
+    size_t getSSID(char* buf, size_t len) const;
+
+    /**
+     * Get the current WiFi SSID without copying
+     * 
+     * The view points into the manager and stays valid until the next
+     * connection attempt changes the SSID. Other tasks should use
+     * getSSID(char*, size_t), which cannot return a torn copy.
+     * 
+     * @return SSID of connected network or empty view if disconnected
+     */
+    std::string_view getSSIDView() const;
+
     /**
      * Get WiFi IP address
      * 
@@ -138,6 +1028,244 @@ public:
      */
     std::string getIPAddress() const;
 
+    /**
+     * Format the WiFi IP address into a caller buffer
+     * 
+     * @param buf Destination, always NUL-terminated
+     * @param len Size of buf (16 bytes fits any address)
+     * @return true if connected and the address fit in buf
+     */
+    bool getIPAddress(char* buf, size_t len) const;
+
+    /**
+     * Get the raw WiFi IPv4 address
+     * 
+     * Served from a copy updated on IP_EVENT_STA_GOT_IP/LOST_IP, so it is
+     * cheap enough to call from high-rate telemetry.
+     * 
+     * @return Address, 0 if not connected
+     */
+    esp_ip4_addr_t getIPv4() const;
+
+    /**
+     * Enable or disable fast-connect
+     * 
+     * When enabled, the BSSID, channel and auth mode of the last network that
+     * delivered an IP are cached in NVS and used to skip the all-channel scan
+     * on the next connection to the same SSID.
+     * 
+     * @param enabled Whether to use the cached fast-connect record
+     */
+    void setFastConnectEnabled(bool enabled);
+
+    /**
+     * Check if fast-connect is enabled
+     * 
+     * @return true if fast-connect is enabled
+     */
+    bool isFastConnectEnabled() const;
+
+    /**
+     * Get fast-connect counters
+     * 
+     * @return Number of fast-connect attempts, hits and fallbacks since boot
+     */
+    FastConnectStats getFastConnectStats() const;
+
+    /**
+     * Enable or disable PMK storage
+     * 
+     * When enabled, the 32-byte PMK is derived once from the passphrase and
+     * SSID and stored in NVS in place of the plaintext passphrase, so the
+     * driver does not run PBKDF2 on every association. Only valid for
+     * WPA/WPA2-PSK networks, WPA3-SAE needs the original passphrase.
+     * 
+     * @param enabled Whether to store the PMK instead of the passphrase
+     */
+    void setPmkStorageEnabled(bool enabled);
+
+    /**
+     * Check if PMK storage is enabled
+     * 
+     * @return true if PMK storage is enabled
+     */
+    bool isPmkStorageEnabled() const;
+
+    /**
+     * Enable or disable the DHCP lease cache
+     * 
+     * When enabled, the IP, netmask, gateway and DNS servers obtained by DHCP
+     * are stored in NVS. A later fast-connect to the same BSSID applies them
+     * as a static configuration while the lease is still before its renewal
+     * time, and hands the interface back to the DHCP client once it is due.
+     * A lease is only reused within the boot session it was obtained in,
+     * which survives deep sleep and software resets but not a power cycle,
+     * since the lease age is measured with the system time.
+     * 
+     * @param enabled Whether to cache and reuse the DHCP lease
+     */
+    void setLeaseCacheEnabled(bool enabled);
+
+    /**
+     * Check if the DHCP lease cache is enabled
+     * 
+     * @return true if the DHCP lease cache is enabled
+     */
+    bool isLeaseCacheEnabled() const;
+
+    /**
+     * Get the time between association and IP acquisition of the last connection
+     * 
+     * @return Time in milliseconds or 0 if no IP was acquired yet
+     */
+    uint32_t getIpAcquisitionTimeMs() const;
+
+    /**
+     * Get connection-phase latency metrics and disconnect counters
+     * 
+     * @return Copy of the current metrics
+     */
+    Metrics getMetrics() const;
+
+    /**
+     * Reset all metrics to zero
+     */
+    void resetMetrics();
+
+    /**
+     * Get the number of disconnects with the given reason
+     * 
+     * Reasons without a bucket of their own return the shared
+     * Metrics::REASON_OTHER count.
+     * 
+     * @param reason wifi_err_reason_t value
+     * @return Number of disconnects with that reason since the last reset
+     */
+    uint32_t getDisconnectCount(uint8_t reason) const;
+
+    /**
+     * Get the log of recent link events
+     * 
+     * @return Copy of the link event log, taken on the event handler task
+     */
+    LinkEventLog getLinkEvents() const;
+
+    /**
+     * Set the roaming configuration
+     * 
+     * While connected, the RSSI is sampled periodically. When its smoothed
+     * value drops below the threshold, a background scan runs on the
+     * channels known for the network (fast-connect record, multi-network
+     * store, current channel, or 1/6/11 if nothing else is known). The
+     * device moves to the strongest AP found if it beats the current one by
+     * the hysteresis. 802.11k/v is enabled on the next connection so the AP
+     * can steer the device as well. The state is CONNECTING while the
+     * device moves, until the new AP hands out an IP.
+     * 
+     * @param config Roaming configuration
+     */
+    void setRoamingConfig(const RoamingConfig& config);
+
+    /**
+     * Get the roaming configuration
+     * 
+     * @return Current roaming configuration
+     */
+    RoamingConfig getRoamingConfig() const;
+
+    /**
+     * Set the scan engine configuration
+     * 
+     * The mode also selects the driver scan method used when connecting
+     * without a known BSSID.
+     * 
+     * @param config Scan configuration
+     */
+    void setScanConfig(const ScanConfig& config);
+
+    /**
+     * Get the scan engine configuration
+     * 
+     * @return Current scan configuration
+     */
+    ScanConfig getScanConfig() const;
+
+    /**
+     * Scan for networks and update the scan cache
+     * 
+     * Scans the channel mask, or the channels the known networks were last
+     * seen on, followed by all channels if no known network was found
+     * there. The cache is shared with multi-network selection and roaming,
+     * so a fresh cache skips their scans too.
+     * 
+     * The scan never blocks the event loop. Called from another task this
+     * waits for the sweep to finish, called from an observer or callback it
+     * only starts the sweep and the results reach the cache later.
+     * 
+     * @param use_cache Return without scanning if the cache is still fresh
+     * @return true if at least one scan completed (or the cache was fresh),
+     *         or the sweep was started when called from the event task
+     */
+    bool scanNetworks(bool use_cache = true);
+
+    /**
+     * Copy the cached scan results, strongest first
+     * 
+     * Only results younger than the cache TTL are returned, e.g. to build an
+     * AP list for a custom provisioning UI.
+     * 
+     * @param records Output array
+     * @param max_records Size of the output array
+     * @return Number of records written
+     */
+    size_t getScanResults(wifi_ap_record_t* records, size_t max_records) const;
+
+    /**
+     * Drop all cached scan results
+     */
+    void clearScanCache();
+
+    /**
+     * Set the link watchdog configuration
+     * 
+     * While connected, the gateway is pinged over the STA interface. The
+     * interval doubles up to max_interval_ms while replies arrive and drops
+     * back to min_interval_ms after a miss. After max_misses consecutive
+     * misses the link is considered dead and the station reassociates
+     * through the reconnect policy. Round trip times are reported in
+     * Metrics::probe_rtt.
+     * 
+     * @param config Link watchdog configuration
+     */
+    void setLinkWatchdogConfig(const LinkWatchdogConfig& config);
+
+    /**
+     * Get the link watchdog configuration
+     * 
+     * @return Current link watchdog configuration
+     */
+    LinkWatchdogConfig getLinkWatchdogConfig() const;
+
+    /**
+     * Get the heap and stack footprint
+     * 
+     * Each phase covers the synchronous part of the call. The heap taken by
+     * the connection itself (DHCP, lwIP buffers) shows up in the free heap
+     * at IP acquisition instead: if connected_free_last keeps dropping
+     * below connected_free_first over many reconnect cycles, memory is
+     * leaking. The stack mark is sampled on the task that runs the event
+     * handlers, the event loop task or the worker task when it is running.
+     * Only collected with CONFIG_BI_WIFI_FOOTPRINT, otherwise all zero.
+     * 
+     * @return Copy of the current footprint
+     */
+    Footprint getFootprint() const;
+
+    /**
+     * Reset the footprint to zero
+     */
+    void resetFootprint();
+
 private:
     static constexpr const char* TAG = "WiFiManager";
     
@@ -145,7 +1273,7 @@ private:
     std::string nvs_namespace_;
     
     // Current WiFi state
-    WiFiState state_;
+    std::atomic<WiFiState> state_;
     
     // Callback for connection state changes
     ConnectionCallback connection_callback_;
@@ -158,34 +1286,495 @@ private:
     bool initialized_;
     
     // Provisioning mode
-    bool provisioning_active_;
+    std::atomic<bool> provisioning_active_;
     
-    // Current connection info
-    std::string current_ssid_;
-    std::string current_password_;
+    // Current connection info, fixed storage so the accessors never allocate
+    char current_ssid_[sizeof(wifi_sta_config_t::ssid) + 1];
+    std::atomic<uint32_t> ssid_seq_;     // Odd while current_ssid_ is being written
+    std::atomic<uint32_t> ip_addr_;      // STA address from IP_EVENT_STA_GOT_IP, 0 without one
     
-    // NVS keys for stored data
+    // NVS keys for stored data (SSID and password keys are the legacy layout)
+    static constexpr const char* NVS_KEY_CREDENTIALS = "wifi_cred";
     static constexpr const char* NVS_KEY_SSID = "wifi_ssid";
     static constexpr const char* NVS_KEY_PASSWORD = "wifi_pass";
+    static constexpr const char* NVS_KEY_FAST_CONNECT = "wifi_fast";
+
+    // Fast-connect record stored as a blob under NVS_KEY_FAST_CONNECT
+    struct FastConnectRecord {
+        uint8_t version;
+        uint8_t channel;
+        uint8_t authmode;
+        uint8_t bssid[6];
+        char ssid[33];
+    };
+    static constexpr uint8_t FAST_CONNECT_VERSION = 1;
+
+    // DHCP lease stored as a blob under NVS_KEY_LEASE
+    static constexpr const char* NVS_KEY_LEASE = "wifi_lease";
+    struct LeaseRecord {
+        uint8_t version;
+        uint8_t bssid[6];
+        uint32_t ip;
+        uint32_t netmask;
+        uint32_t gw;
+        uint32_t dns[2];
+        int64_t acquired_at;  // System time seconds, only comparable within the same boot session
+        uint32_t lease_s;
+        uint32_t session;     // bootSession() the lease was obtained in
+    };
+    static constexpr uint8_t LEASE_VERSION = 2;
+    static constexpr int64_t LEASE_MARGIN_S = 60;
 
-    // netif instances for STA and AP
+    // netif instances for STA and AP, owned by WiFiDriver (AP only held while provisioning)
     esp_netif_t* netif_sta_;
     esp_netif_t* netif_ap_;
 
+    // Fast-connect state
+    bool fast_connect_enabled_;
+    bool fast_connect_pending_;
+    bool fast_record_valid_;
+    FastConnectRecord fast_record_;
+    FastConnectStats fast_connect_stats_;
+
+    // Store the derived PMK instead of the passphrase
+    bool pmk_storage_enabled_;
+    static constexpr size_t PMK_LEN = 32;
+    static constexpr size_t PMK_HEX_LEN = PMK_LEN * 2;
+
+    // Connection context kept in RTC memory across deep sleep
+    struct RtcContext {
+        uint32_t magic;
+        FastConnectRecord fast;
+        LeaseRecord lease;
+        bool lease_valid;
+        StaticIpConfig static_ip;
+        char key[PMK_HEX_LEN + 1];  // Passphrase or PMK as handed to the driver
+        uint32_t crc;
+    };
+    static constexpr uint32_t RTC_CONTEXT_MAGIC = 0x57464358;
+    static RtcContext rtc_context_;
+
+    // Boot session identifier, kept across deep sleep and software resets but
+    // not power loss, during which the system time stops
+    struct RtcSession {
+        uint32_t id;
+        uint32_t check;  // ~id, detects the random contents after power-on
+    };
+    static RtcSession rtc_session_;
+
+    // DHCP lease cache state
+    bool lease_cache_enabled_;
+    bool lease_applied_;
+    bool lease_record_valid_;
+    LeaseRecord lease_record_;
+    esp_timer_handle_t lease_renew_timer_;
+    int64_t sta_connected_at_us_;
+
+    // Static address of the current connection, the RTC copy is used once on resume
+    StaticIpConfig static_ip_;
+    bool static_ip_applied_;
+    bool static_ip_from_rtc_;
+
+    // Requested power-save profile
+    PowerProfile power_profile_;
+
+    // Driver buffer settings, fixed once init() starts the driver
+    static constexpr uint32_t WIFI_BUFFER_BYTES = 1600;
+    static constexpr uint32_t DRIVER_HEAP_RESERVE = 48 * 1024;  // Driver, lwIP and dynamic buffers
+    DriverProfile driver_profile_;
+    DriverConfig driver_config_;
+
+    // Reason of the last WIFI_EVENT_STA_DISCONNECTED
+    std::atomic<uint8_t> last_disconnect_reason_;
+
+    // Reconnect scheduler state
+    enum class ReconnectAction {
+        BACKOFF,       // Retry with the exponential delay
+        SLOW_BACKOFF,  // AP is overloaded, retry with a longer delay
+        AUTH_RETRY,    // Wrong credentials or a weak link, retried a few times in a row
+        ABORT          // Retrying cannot succeed (wrong credentials)
+    };
+    static constexpr uint8_t AUTH_FAIL_LIMIT = 2;        // AUTH_FAIL in a row before giving up
+    static constexpr uint8_t HANDSHAKE_RETRY_LIMIT = 3;  // Handshake timeouts in a row before giving up
+    ReconnectPolicy reconnect_policy_;
+    esp_timer_handle_t reconnect_timer_;
+    uint32_t reconnect_attempts_;
+    uint8_t auth_failures_;              // Authentication failures since the last association
+    uint32_t jitter_state_;
+
+    // Private events that move timer, ping and command work to the event handler task
+    enum InternalEventId : int32_t {
+        INTERNAL_COMMAND,
+        INTERNAL_RECONNECT_TIMER,
+        INTERNAL_ROAM_TIMER,
+        INTERNAL_PROBE_TIMER,
+        INTERNAL_PROBE_SUCCESS,
+        INTERNAL_PROBE_TIMEOUT,
+        INTERNAL_LEASE_RENEW_TIMER,
+        INTERNAL_NOTIFY_TIMER,
+        INTERNAL_WORKER_STOP
+    };
+    struct InternalEvent {
+        WiFiManager* target;  // Every manager receives the event, only the target handles it
+        uint32_t value;       // Probe RTT in ms
+    };
+
+    // Event copied to the worker task, payload depends on base and id
+    union EventPayload {
+        wifi_event_sta_connected_t sta_connected;
+        wifi_event_sta_disconnected_t sta_disconnected;
+        wifi_event_ap_staconnected_t ap_staconnected;
+        wifi_event_ap_stadisconnected_t ap_stadisconnected;
+        ip_event_got_ip_t got_ip;
+        InternalEvent internal;
+#if CONFIG_BI_WIFI_PROVISIONING
+        wifi_sta_config_t prov_sta_config;
+        wifi_prov_sta_fail_reason_t prov_fail_reason;
+#endif
+    };
+    struct EventMessage {
+        esp_event_base_t base;
+        int32_t id;
+        bool has_data;
+        EventPayload data;
+    };
+
+    // Single-producer (event loop task) single-consumer (worker) ring buffer
+    static constexpr uint32_t WORKER_QUEUE_LEN = 16;
+    EventMessage worker_queue_[WORKER_QUEUE_LEN];
+    std::atomic<uint32_t> worker_head_;
+    std::atomic<uint32_t> worker_tail_;
+    std::atomic<uint32_t> worker_dropped_;
+    std::atomic<bool> worker_stop_;
+    std::atomic<bool> worker_space_wanted_;  // Event loop task waits for a free slot
+    std::atomic<TaskHandle_t> worker_task_;
+
+    // Stored credentials, loaded from NVS on first use and updated on save/clear
+    static constexpr size_t MAX_SSID_LEN = sizeof(wifi_sta_config_t::ssid);
+    static constexpr size_t MAX_PASSWORD_LEN = sizeof(wifi_sta_config_t::password);
+    struct CredentialCache {
+        bool loaded;
+        bool present;
+        char ssid[MAX_SSID_LEN + 1];
+        char key[MAX_PASSWORD_LEN + 1];  // Passphrase or PMK as stored in NVS
+        StaticIpConfig static_ip;
+    };
+    CredentialCache creds_;
+
+    // Credentials stored as a single CRC-protected blob under NVS_KEY_CREDENTIALS,
+    // version 1 records had no static_ip and still load. The CRC covers every
+    // byte up to crc, so the layout has no implicit padding.
+    struct CredentialRecord {
+        uint8_t version;
+        char ssid[MAX_SSID_LEN + 1];
+        char key[MAX_PASSWORD_LEN + 1];
+        uint8_t reserved;  // Aligns static_ip, always 0
+        StaticIpConfig static_ip;
+        uint32_t crc;
+    };
+    static_assert(sizeof(CredentialRecord) ==
+                  1 + (MAX_SSID_LEN + 1) + (MAX_PASSWORD_LEN + 1) + 1 + sizeof(StaticIpConfig) + 4,
+                  "CredentialRecord has implicit padding");
+    static constexpr uint8_t CREDENTIAL_VERSION = 2;
+
+    // Multi-network store, packed into a single blob under NVS_KEY_NETWORKS
+    static constexpr const char* NVS_KEY_NETWORKS = "wifi_nets";
+    static constexpr uint8_t MAX_NETWORKS = 5;
+    static constexpr uint8_t NETWORK_STORE_VERSION = 2;  // Version 1 had no static_ip
+    static constexpr uint16_t MAX_SCAN_RECORDS = 20;
+    static constexpr int64_t RECENT_SUCCESS_S = 7 * 24 * 3600;
+    static constexpr int64_t HISTORY_UPDATE_S = 3600;
+    struct NetworkProfile {
+        char ssid[MAX_SSID_LEN + 1];
+        char key[PMK_HEX_LEN + 1];
+        uint8_t priority;
+        uint8_t channel;
+        uint8_t bssid[6];
+        int64_t last_success;  // Wall-clock seconds, 0 if never connected
+        StaticIpConfig static_ip;
+    };
+    struct NetworkStore {
+        uint8_t version;
+        uint8_t count;
+        NetworkProfile entries[MAX_NETWORKS];
+    };
+    bool networks_loaded_;
+    NetworkStore networks_;
+
+    // Connection-phase metrics and the start timestamps of running phases
+    Metrics metrics_;
+    int64_t assoc_started_at_us_;
+    int64_t prov_started_at_us_;
+    int64_t prov_phase_at_us_;
+
+    // Recent link events and the channel of the current association
+    LinkEventLog link_events_;
+    uint8_t link_channel_;
+
+    // Roaming state
+    RoamingConfig roaming_config_;
+    esp_timer_handle_t roam_timer_;
+    int roam_rssi_;                      // Smoothed RSSI, 0 if no sample yet
+    bool roam_scan_active_;
+    uint16_t roam_scan_channels_;        // Channels left to scan, bit n for channel n
+    int64_t last_roam_scan_us_;
+    wifi_ap_record_t roam_candidate_;    // Best AP seen by the running scan
+    bool roam_pending_;                  // Waiting for the disconnect from the old AP
+    bool roam_attempt_;                  // Associating with the roam target
+
+    // Link watchdog state
+    LinkWatchdogConfig watchdog_config_;
+    esp_ping_handle_t probe_session_;    // Single-shot ping session, restarted per probe
+    esp_timer_handle_t probe_timer_;
+    uint32_t probe_gateway_;
+    uint32_t probe_interval_ms_;
+    uint8_t probe_misses_;
+
+    // Provisioning scheme state
+    ProvisioningScheme default_scheme_;
+    ProvisioningScheme provisioning_scheme_;  // Scheme of the running session
+    bool coex_active_;                        // BLE shares the radio
+
+    // Credentials received from the provisioning app, persisted off the event loop
+    char prov_ssid_[MAX_SSID_LEN + 1];
+    char prov_password_[MAX_PASSWORD_LEN + 1];
+    struct PendingCredentials {
+        WiFiManager* self;
+        char ssid[MAX_SSID_LEN + 1];
+        char password[MAX_PASSWORD_LEN + 1];
+    };
+
+    // Scan engine state, the cache is allocated on the first scan
+    static constexpr uint16_t CHANNEL_MASK_ALL = 0x3FFE;  // Channels 1-13
+    struct CachedAp {
+        wifi_ap_record_t ap;
+        int64_t seen_at_us;
+    };
+    ScanConfig scan_config_;
+    std::unique_ptr<CachedAp[]> scan_cache_;
+    uint16_t scan_cache_count_;
+    int64_t scan_cache_at_us_;           // Last time a scan completed
+
+    // Non-blocking scan sweep, advanced on each WIFI_EVENT_SCAN_DONE
+    static constexpr uint32_t SCAN_WAIT_MS = 20000;  // Bound for callers waiting on a full sweep
+    bool sweep_active_;
+    uint16_t sweep_channels_;            // Channels left to scan, bit n for channel n
+    bool sweep_stop_on_match_;
+    bool sweep_fallback_;                // Sweep all channels if the learned ones had no known network
+    bool sweep_scanned_;                 // At least one scan of this sweep completed
+    bool sweep_connect_;                 // Join the best network when the sweep is done
+    int64_t sweep_started_us_;
+
+    // Observers registered with addObserver()
+    ObserverRegistry<BI_WIFI_MAX_OBSERVERS> observers_;
+
+    // Pre-seeded hostname table for resolveHost()
+    static constexpr size_t MAX_HOSTNAME_LEN = 63;
+    struct HostEntry {
+        char name[MAX_HOSTNAME_LEN + 1];
+        esp_ip4_addr_t addr;
+    };
+    HostEntry hosts_[BI_WIFI_MAX_HOST_ENTRIES];
+    uint8_t host_count_;
+    std::atomic<uint32_t> hosts_seq_;    // Odd while hosts_ is being written
+
+    // State notification coalescing, reported_state_ is what the callback last saw
+    NotifyConfig notify_config_;
+    WiFiState reported_state_;
+    esp_timer_handle_t notify_timer_;
+    int64_t down_since_us_;             // 0 while the link is reported up
+    uint32_t down_reconnects_base_;     // metrics_.reconnects when the link went down
+    uint16_t pending_changes_;          // State changes not reported yet
+
+    // Calls from other tasks, queued by runCommand() and run by drainCommands()
+    struct Command {
+        bool (*invoke)(void* fn);
+        void* fn;                // Callable on the caller's stack, valid until done is given
+        bool result;
+        SemaphoreHandle_t done;
+    };
+    static constexpr UBaseType_t COMMAND_QUEUE_LEN = 8;
+    QueueHandle_t command_queue_;
+    std::atomic<TaskHandle_t> event_task_;  // Task that runs eventHandler() without the worker
+
+    // Event handler registrations, removed by the destructor
+    esp_event_handler_instance_t wifi_event_handler_;
+    esp_event_handler_instance_t got_ip_handler_;
+    esp_event_handler_instance_t lost_ip_handler_;
+    esp_event_handler_instance_t internal_event_handler_;
+
+#if CONFIG_BI_WIFI_FOOTPRINT
+    // Heap and stack footprint, FootprintScope records one call
+    Footprint footprint_;
+    class FootprintScope {
+    public:
+        explicit FootprintScope(FootprintPhase& phase);
+        ~FootprintScope();
+    private:
+        FootprintPhase& phase_;
+    };
+#endif
+
     // Event handler for WiFi and IP events
     static void eventHandler(void* arg, esp_event_base_t event_base, 
                             int32_t event_id, void* event_data);
     
+#if CONFIG_BI_WIFI_PROVISIONING
     // Provisioning event handler
     static void provisioningEventHandler(void* arg, esp_event_base_t event_base,
                                         int32_t event_id, void* event_data);
+    void teardownProvisioning();
+    void releaseProvisioningRadio();
+    void persistProvisionedCredentials();
+    static void persistTask(void* arg);
+    static void savePendingCredentials(PendingCredentials* job);
+#endif
 
     // Internal methods
-    bool saveCredentials(const std::string& ssid, const std::string& password);
-    bool loadCredentials(std::string& ssid, std::string& password);
+    bool connectInternal(const char* ssid, const char* password, bool save,
+                         const wifi_ap_record_t* ap = nullptr);
+    bool connectBestNetwork();
+    bool storeNetwork(const char* ssid, const char* key, uint8_t priority);
+    bool selectBestNetwork();
+    static int networkScore(const wifi_ap_record_t& ap, uint8_t priority, 
+                            const uint8_t* cached_bssid, int64_t last_success, int64_t now);
+    bool loadNetworks();
+    bool saveNetworks();
+    void updateNetworkHistory();
+    bool prepareKey(const char* ssid, const char* password, char (&key)[PMK_HEX_LEN + 1]);
+    bool saveCredentials(const char* ssid, const char* password);
+    bool saveCredentialRecord(CredentialRecord& record);
+    bool loadCredentials();
+    bool writeCredentialRecord(nvs_handle_t nvs_handle, CredentialRecord& record);
+    bool loadLegacyCredentials(nvs_handle_t nvs_handle, CredentialRecord& record);
+    void migrateLegacyCredentials(CredentialRecord& record);
+    bool loadFastConnectRecord(const char* ssid);
+    bool saveFastConnectRecord();
+    void fallbackToFullScan();
+    bool loadLeaseRecord();
+    bool saveLeaseRecord(const esp_netif_ip_info_t& ip_info, const uint8_t* bssid);
+    bool applyCachedLease(const uint8_t* bssid);
+    bool applyStaticIp(const StaticIpConfig& config);
+    bool findStaticIp(const char* ssid, StaticIpConfig* config);
+    bool storeStaticIp(const char* ssid, const StaticIpConfig& config);
+    void restoreDhcp();
+    static void leaseRenewTimerCallback(void* arg);
+    void saveRtcContext();
+    static void invalidateRtcContext();
+    static bool isRtcContextValid();
+    static uint32_t rtcContextCrc();
+    static uint32_t bootSession();
+    static bool isPassphrase(const char* password);
+    static bool derivePmk(const char* ssid, const char* passphrase,
+                          char (&pmk_hex)[PMK_HEX_LEN + 1]);
     void updateState(WiFiState new_state);
+    esp_err_t startAssociation();
+    static void recordPhase(PhaseStats& stats, int64_t start_us);
+    static void recordSample(PhaseStats& stats, uint32_t duration_us);
+    static HeapSnapshot heapSnapshot();
+    void recordConnectedFootprint();
+    static size_t disconnectReasonIndex(uint8_t reason);
+    void applyRoamingConfig();
+    void startRoamScan(const wifi_ap_record_t& current);
+    bool scanNextRoamChannel();
+    void handleRoamScanDone();
+    void evaluateRoamCandidates();
+    wifi_scan_config_t makeScanConfig(uint8_t channel) const;
+    uint16_t learnedChannelMask(const char* ssid) const;
+    bool startNetworkScan();
+    bool startScanSweep(uint16_t channels, bool stop_on_match, bool fallback);
+    bool scanNextSweepChannel();
+    void handleSweepScanDone();
+    void finishScanSweep();
+    uint16_t fetchScanResults();
+    bool isCacheEntryFresh(const CachedAp& entry) const;
+    bool isScanCacheFresh() const;
+    bool hasKnownNetworkCached() const;
+    const wifi_ap_record_t* bestCachedAp(const char* ssid, const uint8_t* exclude_bssid) const;
+    static void roamTimerCallback(void* arg);
+    void startLinkWatchdog(uint32_t gateway);
+    void stopLinkWatchdog();
+    static void probeTimerCallback(void* arg);
+    static void probeSuccessCallback(esp_ping_handle_t handle, void* arg);
+    static void probeTimeoutCallback(esp_ping_handle_t handle, void* arg);
+    void handleProbeSuccess(uint32_t rtt_ms);
+    void handleProbeTimeout();
+    void notifyObservers(Notification& notification);
+    void recordLinkEvent(LinkEvent::Type type, uint8_t reason, int8_t rssi, const uint8_t* bssid);
+    static EventBits_t stateBit(WiFiState state);
     bool initNVS();
     bool initWiFi();
+    void applyDriverConfig(wifi_init_config_t& cfg);
+    static bool isDriverConfigValid(const DriverConfig& config);
+    static uint32_t driverStaticBytes(const DriverConfig& config, const wifi_init_config_t& cfg);
+    bool enableApInterface();
+    bool applyPowerProfile();
+    static uint16_t listenInterval(PowerProfile profile);
+    bool postToWorker(esp_event_base_t event_base, int32_t event_id, void* event_data);
+    static void workerTask(void* arg);
+    static bool isDroppableEvent(esp_event_base_t event_base, int32_t event_id);
+    void signalWorkerSpace();
+    void joinWorker();
+    bool isEventContext() const;
+    bool deferCommand() const;
+    bool submitCommand(Command& command);
+    void drainCommands();
+    bool postInternalEvent(int32_t event_id, uint32_t value, TickType_t timeout);
+    void handleInternalEvent(int32_t event_id, const InternalEvent& event);
+    void setCurrentSsid(const char* ssid);
+    void beginHostsWrite();
+    void endHostsWrite();
+    static bool isDownState(WiFiState state);
+    void reportState(WiFiState state);
+    void deliverState(WiFiState state);
+    void handleNotifyTimer();
+    
+    /**
+     * Run fn on the event handler task and wait for its result
+     * 
+     * Runs fn inline when already there or before init(), when nothing
+     * else can be running.
+     */
+    template <typename F>
+    bool runCommand(F&& fn) {
+        if (!deferCommand()) {
+            return fn();
+        }
+        Command command = {};
+        command.invoke = [](void* f) { return (*static_cast<std::remove_reference_t<F>*>(f))(); };
+        command.fn = &fn;
+        return submitCommand(command);
+    }
+    
+    // Getters read state the event task writes, so they run there like the commands
+    template <typename F>
+    void runReader(F&& fn) const {
+        const_cast<WiFiManager*>(this)->runCommand([&] { fn(); return true; });
+    }
+    template <typename T>
+    T snapshot(const T& value) const {
+        T copy;
+        runReader([&] { copy = value; });
+        return copy;
+    }
+    
+    // Timers only post an event, the work runs where the other events are handled
+    template <int32_t EVENT_ID>
+    static void postTimerEvent(void* arg) {
+        static_cast<WiFiManager*>(arg)->postInternalEvent(EVENT_ID, 0, 0);
+    }
+    void makeProvisioningName(char* name, size_t len);
+    bool beginProvisioning(ProvisioningScheme scheme, const std::string& service_name,
+                           const std::string& ap_password, uint8_t security,
+                           const std::string& pop, bool erase_credentials);
+    bool startAutoProvisioning();
+    bool scheduleReconnect(uint8_t reason);
+    void cancelReconnect();
+    void handleReconnectFailure();
+    uint32_t nextJitter();
+    static ReconnectAction reconnectAction(uint8_t reason);
+    static void reconnectTimerCallback(void* arg);
+    void disableApInterface();
 };
 
 #endif // BI_WIFI_HPP
\ No newline at end of file
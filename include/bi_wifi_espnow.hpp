@@ -0,0 +1,110 @@
+/**
+ * bi_wifi_espnow.hpp
+ * ESP-NOW side channel for ESP-IDF
+ *
+ * Sends and receives ESP-NOW frames on the station interface of the shared
+ * WiFi driver core, next to a WiFiManager connection
+ */
+
+#ifndef BI_WIFI_ESPNOW_HPP
+#define BI_WIFI_ESPNOW_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#include "esp_now.h"
+#include "bi_wifi_driver.hpp"
+
+/**
+ * ESP-NOW side channel
+ *
+ * Holds the ESPNOW role of WiFiDriver while running. Frames go out on the
+ * channel the station is on, so peers must follow the same AP or a fixed
+ * channel when the station is not connected. Only one instance can run at
+ * a time, ESP-NOW has a single set of callbacks. Modem sleep makes the
+ * station miss frames between beacons, use PowerProfile::LOW_LATENCY on the
+ * WiFiManager when latency matters.
+ */
+class EspNowChannel {
+public:
+    /**
+     * Receive callback, runs on the WiFi driver task and must return quickly
+     * @param mac Sender address
+     * @param data Frame payload, only valid during the call
+     * @param len Payload length
+     * @param user_data Pointer given to begin()
+     */
+    using ReceiveCallback = void (*)(const uint8_t* mac, const uint8_t* data, size_t len, void* user_data);
+
+    EspNowChannel();
+    ~EspNowChannel();
+
+    EspNowChannel(const EspNowChannel&) = delete;
+    EspNowChannel& operator=(const EspNowChannel&) = delete;
+
+    /**
+     * Start ESP-NOW, starting the WiFi driver if no other role did
+     * @param callback Receive callback, nullptr to only send
+     * @param user_data Pointer passed to the callback
+     * @return true if ESP-NOW is running
+     */
+    bool begin(ReceiveCallback callback, void* user_data = nullptr);
+
+    /**
+     * Stop ESP-NOW and release the ESPNOW role, all peers are dropped
+     */
+    void end();
+
+    /**
+     * Check if ESP-NOW is running
+     * @return true if started
+     */
+    bool isRunning() const;
+
+    /**
+     * Add a peer, or update it if already known
+     * @param mac Peer address, ESP_NOW_ETH_ALEN bytes
+     * @param lmk Local master key of ESP_NOW_KEY_LEN bytes, nullptr for unencrypted frames
+     * @return true on success
+     */
+    bool addPeer(const uint8_t* mac, const uint8_t* lmk = nullptr);
+
+    /**
+     * Remove a peer
+     * @param mac Peer address
+     * @return true if removed
+     */
+    bool removePeer(const uint8_t* mac);
+
+    /**
+     * Queue a frame for sending, the result is counted by getSendFailures()
+     * @param mac Peer address, nullptr to send to all peers
+     * @param data Payload
+     * @param len Payload length, up to ESP_NOW_MAX_DATA_LEN
+     * @return true if queued
+     */
+    bool send(const uint8_t* mac, const uint8_t* data, size_t len);
+
+    /**
+     * Get the number of frames that were not acknowledged
+     * @return Failure count since begin()
+     */
+    uint32_t getSendFailures() const;
+
+private:
+    static constexpr const char* TAG = "EspNowChannel";
+
+    // ESP-NOW callbacks carry no context pointer
+    static std::atomic<EspNowChannel*> active_;
+
+    static void receiveCallback(const esp_now_recv_info_t* info, const uint8_t* data, int len);
+    static void sendCallback(const uint8_t* mac, esp_now_send_status_t status);
+
+    ReceiveCallback callback_;
+    void* user_data_;
+    bool running_;
+    std::atomic<uint32_t> send_failures_;
+};
+
+#endif // BI_WIFI_ESPNOW_HPP
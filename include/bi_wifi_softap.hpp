@@ -0,0 +1,89 @@
+/**
+ * bi_wifi_softap.hpp
+ * SoftAP service for ESP-IDF
+ *
+ * Runs a SoftAP next to the WiFiManager station on the shared WiFi driver core
+ */
+
+#ifndef BI_WIFI_SOFTAP_HPP
+#define BI_WIFI_SOFTAP_HPP
+
+#include <string>
+#include <atomic>
+
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "bi_wifi_driver.hpp"
+
+/**
+ * SoftAP service
+ *
+ * Holds the AP role of WiFiDriver while running, so the radio works in
+ * APSTA mode when a WiFiManager is also connected. The AP interface has a
+ * single owner: start() fails while SoftAP provisioning runs and the other
+ * way round. While the station is associated the driver keeps the AP on the
+ * station channel, whatever channel was requested.
+ */
+class SoftApService {
+public:
+    // Station limit of the driver
+    static constexpr uint8_t MAX_CONNECTIONS = 10;
+
+    SoftApService();
+    ~SoftApService();
+
+    SoftApService(const SoftApService&) = delete;
+    SoftApService& operator=(const SoftApService&) = delete;
+
+    /**
+     * Start the SoftAP
+     * @param ssid Network name, 1 to 32 characters
+     * @param password WPA2 passphrase of 8 to 63 characters, empty for an open network
+     * @param channel Channel 1-13, 0 to use the station channel (or 1 when not associated)
+     * @param max_connections Stations allowed at once, 1 to MAX_CONNECTIONS
+     * @param hidden true to leave the SSID out of the beacons
+     * @return true if the SoftAP is running
+     */
+    bool start(const std::string& ssid, const std::string& password, uint8_t channel = 0,
+               uint8_t max_connections = 4, bool hidden = false);
+
+    /**
+     * Stop the SoftAP and release the AP role
+     */
+    void stop();
+
+    /**
+     * Check if the SoftAP is running
+     * @return true if started
+     */
+    bool isRunning() const;
+
+    /**
+     * Get the number of associated stations
+     * @return Station count
+     */
+    uint8_t getStationCount() const;
+
+    /**
+     * Get the SoftAP netif, e.g. to change the DHCP server settings
+     * @return Netif handle, nullptr when not running
+     */
+    esp_netif_t* getNetif() const;
+
+private:
+    static constexpr const char* TAG = "SoftApService";
+
+    /**
+     * Track stations joining and leaving
+     */
+    static void eventHandler(void* arg, esp_event_base_t event_base,
+                             int32_t event_id, void* event_data);
+
+    bool running_;
+    std::atomic<uint8_t> station_count_;
+    esp_event_handler_instance_t connected_handler_;
+    esp_event_handler_instance_t disconnected_handler_;
+};
+
+#endif // BI_WIFI_SOFTAP_HPP